@@ -0,0 +1,146 @@
+// --------------------------------------------
+// Freezer X Controller - Hardware Abstraction
+// --------------------------------------------
+
+// the firmware only talks to the clock, gpio, adc, eeprom & watchdog through these, so the whole
+// control core can be built on a host with -DNATIVE (see the native folder & the native env).
+// on the avr they are inline forwards to the arduino core, so they cost nothing over calling it directly
+
+#pragma once
+
+#include <stdint.h>
+
+// --------------------------------------
+// Profiling
+
+// markers around the sections the simavr harness times (native/hil.cpp). in a -DHIL build each one is a single
+// write to GPIOR0 that the harness watches, the section in the low bits & HAL_PROFILE_END on the way out.
+// everywhere else they compile to nothing
+enum hal_profile_section
+{
+  profile_boot = 1,
+  profile_watchdog_reset = 2,
+  profile_update_state = 3,
+  profile_save_data_point = 4,
+  profile_refresh_display = 5,
+};
+
+const uint8_t HAL_PROFILE_SECTION_COUNT = 6;
+const uint8_t HAL_PROFILE_END = 0x80;
+
+#ifndef NATIVE
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <avr/wdt.h>
+
+// --------------------------------------
+// Clock
+
+inline uint32_t hal_millis() { return millis(); }
+inline uint32_t hal_micros() { return micros(); }
+inline void hal_delay(uint32_t ms) { delay(ms); }
+
+// --------------------------------------
+// GPIO
+
+inline void hal_pin_mode(uint8_t pin, uint8_t mode) { pinMode(pin, mode); }
+inline void hal_digital_write(uint8_t pin, uint8_t value) { digitalWrite(pin, value); }
+inline int hal_digital_read(uint8_t pin) { return digitalRead(pin); }
+
+// --------------------------------------
+// ADC
+
+inline uint16_t hal_analog_read(uint8_t pin) { return analogRead(pin); }
+
+// --------------------------------------
+// Storage
+
+// put only writes the bytes that changed, like EEPROM.put()
+template<typename T> inline T& hal_storage_get(int address, T& value) { return EEPROM.get(address, value); }
+template<typename T> inline const T& hal_storage_put(int address, const T& value) { return EEPROM.put(address, value); }
+
+// --------------------------------------
+// Profiling
+
+#ifdef HIL
+inline void hal_profile_begin(uint8_t section) { GPIOR0 = section; }
+inline void hal_profile_end(uint8_t section) { GPIOR0 = section | HAL_PROFILE_END; }
+#else
+inline void hal_profile_begin(uint8_t section) {}
+inline void hal_profile_end(uint8_t section) {}
+#endif
+
+// --------------------------------------
+// Watchdog
+
+// returns true if the last reset was the watchdog's
+inline bool hal_start_watchdog()
+{
+  bool reset_by_watchdog = MCUSR & (1 << WDRF);
+  MCUSR = 0;
+
+  wdt_enable(WDTO_2S);
+  hal_profile_begin(hal_profile_section::profile_boot);
+
+  return reset_by_watchdog;
+}
+
+inline void hal_reset_watchdog()
+{
+  wdt_reset();
+  hal_profile_begin(hal_profile_section::profile_watchdog_reset);
+}
+
+#else
+
+// --------------------------------------
+// Host
+
+// implemented by native/hal_native.cpp, the harness drives them through native/hal_native.h
+
+uint32_t hal_millis();
+uint32_t hal_micros();
+void hal_delay(uint32_t ms);
+
+void hal_pin_mode(uint8_t pin, uint8_t mode);
+void hal_digital_write(uint8_t pin, uint8_t value);
+int hal_digital_read(uint8_t pin);
+
+uint16_t hal_analog_read(uint8_t pin);
+
+uint8_t hal_storage_read(int address);
+void hal_storage_update(int address, uint8_t value);
+
+template<typename T> inline T& hal_storage_get(int address, T& value)
+{
+  uint8_t* bytes = (uint8_t*)&value;
+
+  for(unsigned int i = 0; i < sizeof(T); i++)
+  {
+    bytes[i] = hal_storage_read(address + i);
+  }
+
+  return value;
+}
+
+template<typename T> inline const T& hal_storage_put(int address, const T& value)
+{
+  const uint8_t* bytes = (const uint8_t*)&value;
+
+  for(unsigned int i = 0; i < sizeof(T); i++)
+  {
+    hal_storage_update(address + i, bytes[i]);
+  }
+
+  return value;
+}
+
+bool hal_start_watchdog();
+void hal_reset_watchdog();
+
+// the host runner times update_state() itself
+inline void hal_profile_begin(uint8_t section) {}
+inline void hal_profile_end(uint8_t section) {}
+
+#endif
@@ -0,0 +1,274 @@
+// --------------------------------------------
+// Freezer X Controller - Host Hardware
+// --------------------------------------------
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "hal.h"
+#include "hal_native.h"
+
+// --------------------------------------
+// State
+
+uint64_t native_time_us = 0;
+
+uint8_t native_digital[HAL_NATIVE_PIN_COUNT];
+uint8_t native_pin_modes[HAL_NATIVE_PIN_COUNT];
+uint16_t native_analog[HAL_NATIVE_PIN_COUNT];
+
+uint8_t native_storage[HAL_NATIVE_STORAGE_SIZE];
+uint32_t native_storage_writes = 0;
+
+bool native_reset_by_watchdog = false;
+uint32_t native_watchdog_reset_at = 0;
+
+void (*native_interrupts[HAL_NATIVE_PIN_COUNT])() {};
+
+struct native_spi_device
+{
+  uint8_t cs_pin = 0;
+  void (*select)(bool selected) = nullptr;
+  uint8_t (*transfer)(uint8_t data) = nullptr;
+} native_spi_device;
+
+uint16_t (*hal_native_analog_read)(uint8_t pin) = nullptr;
+uint32_t hal_native_spi_clock = 4000000; // the arduino default, until a transaction sets it
+int32_t hal_native_encoder_position = 0;
+
+SPIClass SPI;
+
+// the arrays start like the board does after a reset
+struct native_initializer
+{
+  native_initializer()
+  {
+    memset(native_digital, HIGH, sizeof(native_digital));
+    memset(native_storage, 0xFF, sizeof(native_storage));
+  }
+} native_initialized;
+
+// --------------------------------------
+// hal.h
+
+uint32_t hal_millis()
+{
+  return native_time_us / 1000;
+}
+
+uint32_t hal_micros()
+{
+  return native_time_us;
+}
+
+// nothing is waiting on the host, a delay just moves the clock on
+void hal_delay(uint32_t ms)
+{
+  native_time_us += (uint64_t)ms * 1000;
+}
+
+void hal_pin_mode(uint8_t pin, uint8_t mode)
+{
+  if(pin < HAL_NATIVE_PIN_COUNT)
+  {
+    native_pin_modes[pin] = mode;
+  }
+}
+
+void hal_digital_write(uint8_t pin, uint8_t value)
+{
+  if(pin < HAL_NATIVE_PIN_COUNT)
+  {
+    uint8_t previous = native_digital[pin];
+    native_digital[pin] = value ? HIGH : LOW;
+
+    if(native_spi_device.select && pin == native_spi_device.cs_pin && native_digital[pin] != previous)
+    {
+      native_spi_device.select(native_digital[pin] == LOW);
+    }
+  }
+}
+
+int hal_digital_read(uint8_t pin)
+{
+  return pin < HAL_NATIVE_PIN_COUNT ? native_digital[pin] : LOW;
+}
+
+uint16_t hal_analog_read(uint8_t pin)
+{
+  if(hal_native_analog_read)
+  {
+    return hal_native_analog_read(pin);
+  }
+
+  return pin < HAL_NATIVE_PIN_COUNT ? native_analog[pin] : 0;
+}
+
+uint8_t hal_storage_read(int address)
+{
+  return address >= 0 && address < HAL_NATIVE_STORAGE_SIZE ? native_storage[address] : 0xFF;
+}
+
+void hal_storage_update(int address, uint8_t value)
+{
+  if(address < 0 || address >= HAL_NATIVE_STORAGE_SIZE || native_storage[address] == value)
+  {
+    return;
+  }
+
+  native_storage[address] = value;
+  native_storage_writes++;
+}
+
+bool hal_start_watchdog()
+{
+  native_watchdog_reset_at = hal_millis();
+
+  bool reset_by_watchdog = native_reset_by_watchdog;
+  native_reset_by_watchdog = false;
+
+  return reset_by_watchdog;
+}
+
+void hal_reset_watchdog()
+{
+  native_watchdog_reset_at = hal_millis();
+}
+
+// --------------------------------------
+// Arduino.h
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int mode)
+{
+  if(interrupt < HAL_NATIVE_PIN_COUNT)
+  {
+    native_interrupts[interrupt] = handler;
+  }
+}
+
+long random(long max_value)
+{
+  return max_value > 0 ? rand() % max_value : 0;
+}
+
+long random(long min_value, long max_value)
+{
+  return min_value + random(max_value - min_value);
+}
+
+void randomSeed(unsigned long seed)
+{
+  srand(seed);
+}
+
+char* dtostrf(double value, signed char width, unsigned char precision, char* buffer)
+{
+  sprintf(buffer, "%*.*f", width, precision, value);
+  return buffer;
+}
+
+// --------------------------------------
+// SPI.h
+
+uint8_t hal_native_spi_transfer(uint8_t data)
+{
+  if(!native_spi_device.transfer)
+  {
+    return 0xFF;
+  }
+
+  hal_native_advance_us(8000000 / hal_native_spi_clock);
+
+  return native_digital[native_spi_device.cs_pin] == LOW ? native_spi_device.transfer(data) : 0xFF;
+}
+
+// --------------------------------------
+// hal_native.h
+
+void hal_native_advance(uint32_t ms)
+{
+  native_time_us += (uint64_t)ms * 1000;
+}
+
+void hal_native_advance_us(uint32_t us)
+{
+  native_time_us += us;
+}
+
+void hal_native_set_time(uint32_t ms)
+{
+  native_time_us = (uint64_t)ms * 1000;
+}
+
+void hal_native_set_digital(uint8_t pin, uint8_t value)
+{
+  hal_digital_write(pin, value);
+}
+
+uint8_t hal_native_get_digital(uint8_t pin)
+{
+  return hal_digital_read(pin);
+}
+
+uint8_t hal_native_get_pin_mode(uint8_t pin)
+{
+  return pin < HAL_NATIVE_PIN_COUNT ? native_pin_modes[pin] : INPUT;
+}
+
+void hal_native_set_analog(uint8_t pin, uint16_t value)
+{
+  if(pin < HAL_NATIVE_PIN_COUNT)
+  {
+    native_analog[pin] = value;
+  }
+}
+
+uint8_t* hal_native_storage()
+{
+  return native_storage;
+}
+
+void hal_native_erase_storage()
+{
+  memset(native_storage, 0xFF, sizeof(native_storage));
+}
+
+uint32_t hal_native_storage_writes()
+{
+  return native_storage_writes;
+}
+
+void hal_native_set_reset_by_watchdog(bool reset_by_watchdog)
+{
+  native_reset_by_watchdog = reset_by_watchdog;
+}
+
+uint32_t hal_native_watchdog_age()
+{
+  return hal_millis() - native_watchdog_reset_at;
+}
+
+void hal_native_attach_spi_device(uint8_t cs_pin, void (*select)(bool selected), uint8_t (*transfer)(uint8_t data))
+{
+  native_spi_device.cs_pin = cs_pin < HAL_NATIVE_PIN_COUNT ? cs_pin : 0;
+  native_spi_device.select = select;
+  native_spi_device.transfer = transfer;
+
+  if(select)
+  {
+    select(native_digital[native_spi_device.cs_pin] == LOW);
+  }
+}
+
+void hal_native_set_encoder(int32_t position)
+{
+  hal_native_encoder_position = position;
+}
+
+void hal_native_trigger_interrupt(uint8_t pin)
+{
+  if(pin < HAL_NATIVE_PIN_COUNT && native_interrupts[pin])
+  {
+    native_interrupts[pin]();
+  }
+}
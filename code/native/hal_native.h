@@ -0,0 +1,47 @@
+// --------------------------------------------
+// Freezer X Controller - Host Hardware
+// --------------------------------------------
+
+// the virtual hardware behind hal.h on the host. nothing moves on its own, the harness sets the inputs,
+// advances the clock & reads back the outputs between calls into the firmware
+
+#pragma once
+
+#include <stdint.h>
+
+const int HAL_NATIVE_PIN_COUNT = 32;
+const int HAL_NATIVE_STORAGE_SIZE = 1024; // same as the atmega32u4 eeprom
+
+// Clock
+void hal_native_advance(uint32_t ms);
+void hal_native_advance_us(uint32_t us);
+void hal_native_set_time(uint32_t ms);
+
+// GPIO, the inputs start HIGH like the pulled up ones on the board
+void hal_native_set_digital(uint8_t pin, uint8_t value);
+uint8_t hal_native_get_digital(uint8_t pin);
+uint8_t hal_native_get_pin_mode(uint8_t pin);
+
+// ADC
+void hal_native_set_analog(uint8_t pin, uint16_t value);
+
+// a hook that's asked for every adc read instead of the fixed values, for noise or a live model
+extern uint16_t (*hal_native_analog_read)(uint8_t pin);
+
+// SPI, a device (like native/sd_card.h) is told when its chip select pin goes LOW & HIGH and gets the bytes in between.
+// without one the bus reads 0xFF like an empty socket. only while there is one, a byte takes its 8 clocks at the speed
+// of the last transaction
+void hal_native_attach_spi_device(uint8_t cs_pin, void (*select)(bool selected), uint8_t (*transfer)(uint8_t data));
+
+// Storage, starts erased (0xFF) like a new chip
+uint8_t* hal_native_storage();
+void hal_native_erase_storage();
+uint32_t hal_native_storage_writes(); // bytes that actually changed, the eeprom wear
+
+// Watchdog
+void hal_native_set_reset_by_watchdog(bool reset_by_watchdog); // what the next hal_start_watchdog() reports
+uint32_t hal_native_watchdog_age(); // ms since the firmware last reset the watchdog
+
+// Input
+void hal_native_set_encoder(int32_t position);
+void hal_native_trigger_interrupt(uint8_t pin);
@@ -0,0 +1,456 @@
+// --------------------------------------------
+// Freezer X Controller - Hardware In The Loop
+// --------------------------------------------
+
+// boots the real firmware (the elf from `pio run -e hil`) on simavr's atmega32u4 at 16 MHz, so the timings are the
+// board's to the cycle. the thermistor inputs follow a temperature profile, the virtual sd card (native/sd_card.h)
+// sits on the spi bus behind MICRO_SD_CS and everything else on the bus (the display) reads 0xFF.
+//
+// the hil build writes a marker to GPIOR0 around update_state(), save_data_point() & refresh_display() and on every
+// watchdog reset (see hal_profile_begin in include/hal.h), those are timed here against simavr's cycle counter.
+//
+// the profile is a text file of "seconds cabinet compressor" lines (# starts a comment), the temperatures are
+// interpolated between the lines & held after the last one. without one it's a steady -18 / 30.
+//
+// usage: program firmware.elf [--seconds N] [--profile file] [--card image]
+//
+// exits with 2 if the watchdog reset the firmware, or the longest time between resets left less than WATCHDOG_MIN_MARGIN
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+#include <simavr/avr_adc.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_spi.h>
+
+#include "hal.h"
+#include "sd_card.h"
+
+// --------------------------------------
+// Board
+
+const uint32_t CPU_FREQUENCY = 16000000;
+const uint32_t SUPPLY_MILLIVOLTS = 5000;
+
+// the pro micro pins main.cpp uses, as ports
+const char MICRO_SD_CS_PORT = 'B'; // D10
+const uint8_t MICRO_SD_CS_BIT = 6;
+const char COMPRESSOR_RELAY_PORT = 'F'; // D18 / A0
+const uint8_t COMPRESSOR_RELAY_BIT = 7;
+
+// A8 & A9 are ADC11 & ADC12 on the 32u4
+const uint8_t CABINET_ADC_CHANNEL = 11;
+const uint8_t COMPRESSOR_ADC_CHANNEL = 12;
+
+// the encoder & demand response inputs are pulled up on the board, these hold them high
+const struct
+{
+  char port;
+  uint8_t bit;
+} PULLED_UP_INPUTS[] = {
+    {'D', 1}, // ROTARY_CLK, D2
+    {'D', 0}, // ROTARY_DT, D3
+    {'E', 6}, // ROTARY_SW, D7
+    {'C', 6}, // DEMAND_RESPONSE_PIN, D5
+};
+
+// data space addresses
+const avr_io_addr_t GPIOR0_ADDRESS = 0x3E;
+const avr_io_addr_t PLLCSR_ADDRESS = 0x49;
+const uint8_t PLLCSR_PLOCK = 1 << 0;
+const uint8_t PLLCSR_PLLE = 1 << 1;
+
+// the same divider & curve as the simulator
+const double NTC_BETA = 3950;
+const double NTC_SERIES_RESISTOR = 10000;
+const double CABINET_NTC_R25 = 10000;
+const double COMPRESSOR_NTC_R25 = 100000;
+
+const double ADC_UPDATE_INTERVAL = 0.1; // seconds
+const uint32_t WATCHDOG_TIMEOUT_MS = 2000; // WDTO_2S
+const double WATCHDOG_MIN_MARGIN = 0.5; // of the timeout
+
+const char* section_names[HAL_PROFILE_SECTION_COUNT] = {
+    "",
+    "boot",
+    "watchdog reset",
+    "update_state()",
+    "save_data_point()",
+    "refresh_display()",
+};
+
+// --------------------------------------
+// Harness
+
+struct profile_point
+{
+  double second;
+  double cabinet;
+  double compressor;
+};
+
+struct section_timing
+{
+  avr_cycle_count_t started_at = 0;
+  bool running = false;
+
+  uint32_t count = 0;
+  avr_cycle_count_t total = 0;
+  avr_cycle_count_t shortest = 0;
+  avr_cycle_count_t longest = 0;
+};
+
+struct harness
+{
+  avr_t* avr = nullptr;
+
+  profile_point* profile = nullptr;
+  uint32_t profile_length = 0;
+
+  avr_irq_t* spi_input = nullptr;
+  bool sd_selected = false;
+  uint32_t display_bytes = 0;
+
+  section_timing sections[HAL_PROFILE_SECTION_COUNT];
+
+  uint32_t boots = 0;
+  avr_cycle_count_t watchdog_reset_at = 0;
+  avr_cycle_count_t longest_watchdog_gap = 0;
+
+  bool compressor_on = false;
+  uint32_t compressor_starts = 0;
+};
+
+harness hil;
+
+double cycles_to_us(avr_cycle_count_t cycles)
+{
+  return cycles * 1000000.0 / CPU_FREQUENCY;
+}
+
+uint32_t temperature_to_millivolts(double temperature, double r25)
+{
+  double resistance = r25 * exp(NTC_BETA * (1 / (temperature + 273.15) - 1 / 298.15));
+
+  return lround(SUPPLY_MILLIVOLTS * resistance / (resistance + NTC_SERIES_RESISTOR));
+}
+
+bool load_profile(const char* path)
+{
+  FILE* file = fopen(path, "r");
+
+  if(!file)
+  {
+    return false;
+  }
+
+  char line[128];
+  uint32_t capacity = 0;
+
+  while(fgets(line, sizeof(line), file))
+  {
+    profile_point point;
+
+    if(line[0] == '#' || sscanf(line, "%lf %lf %lf", &point.second, &point.cabinet, &point.compressor) != 3)
+    {
+      continue;
+    }
+
+    if(hil.profile_length == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 64;
+      hil.profile = (profile_point*)realloc(hil.profile, capacity * sizeof(profile_point));
+    }
+
+    hil.profile[hil.profile_length++] = point;
+  }
+
+  fclose(file);
+
+  return hil.profile_length > 0;
+}
+
+profile_point get_profile_point(double second)
+{
+  if(hil.profile_length == 0)
+  {
+    return profile_point {second, -18, 30};
+  }
+
+  uint32_t next = 0;
+
+  while(next < hil.profile_length && hil.profile[next].second <= second)
+  {
+    next++;
+  }
+
+  if(next == 0 || next == hil.profile_length)
+  {
+    return hil.profile[next == 0 ? 0 : hil.profile_length - 1];
+  }
+
+  const profile_point& from = hil.profile[next - 1];
+  const profile_point& to = hil.profile[next];
+  double fraction = (second - from.second) / (to.second - from.second);
+
+  return profile_point {second, from.cabinet + (to.cabinet - from.cabinet) * fraction, from.compressor + (to.compressor - from.compressor) * fraction};
+}
+
+void update_adc_inputs(double second)
+{
+  profile_point point = get_profile_point(second);
+
+  avr_raise_irq(avr_io_getirq(hil.avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + CABINET_ADC_CHANNEL), temperature_to_millivolts(point.cabinet, CABINET_NTC_R25));
+  avr_raise_irq(avr_io_getirq(hil.avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + COMPRESSOR_ADC_CHANNEL), temperature_to_millivolts(point.compressor, COMPRESSOR_NTC_R25));
+}
+
+// --------------------------------------
+// Callbacks
+
+void on_profile_marker(avr_t* avr, avr_io_addr_t address, uint8_t value, void* param)
+{
+  avr->data[address] = value;
+
+  uint8_t index = value & ~HAL_PROFILE_END;
+
+  if(index == 0 || index >= HAL_PROFILE_SECTION_COUNT)
+  {
+    return;
+  }
+
+  section_timing& section = hil.sections[index];
+
+  if(index == hal_profile_section::profile_boot)
+  {
+    hil.boots++;
+    hil.watchdog_reset_at = avr->cycle;
+    section.count++;
+  }
+  else if(index == hal_profile_section::profile_watchdog_reset)
+  {
+    avr_cycle_count_t gap = avr->cycle - hil.watchdog_reset_at;
+
+    hil.longest_watchdog_gap = gap > hil.longest_watchdog_gap ? gap : hil.longest_watchdog_gap;
+    hil.watchdog_reset_at = avr->cycle;
+    section.count++;
+  }
+  else if(!(value & HAL_PROFILE_END))
+  {
+    section.started_at = avr->cycle;
+    section.running = true;
+  }
+  else if(section.running)
+  {
+    avr_cycle_count_t cycles = avr->cycle - section.started_at;
+
+    section.shortest = section.count == 0 || cycles < section.shortest ? cycles : section.shortest;
+    section.longest = cycles > section.longest ? cycles : section.longest;
+    section.total += cycles;
+    section.count++;
+    section.running = false;
+  }
+}
+
+// the usb pll never locks in some simavr versions, the arduino core waits on it before setup()
+void on_pll_write(avr_t* avr, avr_io_addr_t address, uint8_t value, void* param)
+{
+  avr->data[address] = value & PLLCSR_PLLE ? value | PLLCSR_PLOCK : value & ~PLLCSR_PLOCK;
+}
+
+// the card's busy & latency times run on the avr's clock
+uint32_t get_card_time_us()
+{
+  return hil.avr->cycle / (CPU_FREQUENCY / 1000000);
+}
+
+void on_sd_chip_select(avr_irq_t* irq, uint32_t value, void* param)
+{
+  hil.sd_selected = value == 0;
+  sd_card_select(hil.sd_selected);
+}
+
+// every byte the master clocks out, the reply goes back in before the firmware reads SPDR
+void on_spi_byte(avr_irq_t* irq, uint32_t value, void* param)
+{
+  uint8_t reply = 0xFF;
+
+  if(hil.sd_selected)
+  {
+    reply = sd_card_transfer(value);
+  }
+  else
+  {
+    hil.display_bytes++;
+  }
+
+  avr_raise_irq(hil.spi_input, reply);
+}
+
+void on_compressor_relay(avr_irq_t* irq, uint32_t value, void* param)
+{
+  hil.compressor_starts += value && !hil.compressor_on;
+  hil.compressor_on = value;
+}
+
+// --------------------------------------
+
+void connect_board()
+{
+  avr_t* avr = hil.avr;
+
+  avr_register_io_write(avr, GPIOR0_ADDRESS, on_profile_marker, nullptr);
+  avr_register_io_write(avr, PLLCSR_ADDRESS, on_pll_write, nullptr);
+
+  hil.spi_input = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_INPUT);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_OUTPUT), on_spi_byte, nullptr);
+
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(MICRO_SD_CS_PORT), MICRO_SD_CS_BIT), on_sd_chip_select, nullptr);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(COMPRESSOR_RELAY_PORT), COMPRESSOR_RELAY_BIT), on_compressor_relay, nullptr);
+
+  for(uint8_t i = 0; i < sizeof(PULLED_UP_INPUTS) / sizeof(PULLED_UP_INPUTS[0]); i++)
+  {
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(PULLED_UP_INPUTS[i].port), PULLED_UP_INPUTS[i].bit), 1);
+  }
+
+  update_adc_inputs(0);
+}
+
+void print_results(double seconds)
+{
+  const sd_card_statistics& card = sd_card_get_statistics();
+
+  printf("ran:               %.1f s, %lu boots, compressor %lu starts, %lu blocks read, %lu written, %lu display bytes\n", seconds,
+      (unsigned long)hil.boots, (unsigned long)hil.compressor_starts, (unsigned long)card.blocks_read, (unsigned long)card.blocks_written,
+      (unsigned long)hil.display_bytes);
+
+  for(uint8_t i = hal_profile_section::profile_update_state; i < HAL_PROFILE_SECTION_COUNT; i++)
+  {
+    const section_timing& section = hil.sections[i];
+
+    if(section.count == 0)
+    {
+      printf("%-19s never ran\n", section_names[i]);
+      continue;
+    }
+
+    printf("%-19s %6lu runs, %10.0f us mean, %10.0f us min, %10.0f us max (%llu cycles)\n", section_names[i], (unsigned long)section.count,
+        cycles_to_us(section.total / section.count), cycles_to_us(section.shortest), cycles_to_us(section.longest), (unsigned long long)section.longest);
+  }
+
+  double longest_gap_ms = cycles_to_us(hil.longest_watchdog_gap) / 1000;
+
+  printf("watchdog:          %.1f ms longest between resets of %lu ms, %.0f%% margin\n", longest_gap_ms, (unsigned long)WATCHDOG_TIMEOUT_MS,
+      100 * (1 - longest_gap_ms / WATCHDOG_TIMEOUT_MS));
+}
+
+int main(int argc, char** argv)
+{
+  if(argc < 2 || argc % 2 != 0)
+  {
+    fprintf(stderr, "usage: %s firmware.elf [--seconds N] [--profile file] [--card image]\n", argv[0]);
+    return 1;
+  }
+
+  double seconds = 300;
+  const char* card_path = "hil-card.img";
+
+  for(int i = 2; i + 1 < argc; i += 2)
+  {
+    const char* name = argv[i];
+    const char* value = argv[i + 1];
+
+    if(strcmp(name, "--seconds") == 0) seconds = atof(value);
+    else if(strcmp(name, "--profile") == 0)
+    {
+      if(!load_profile(value))
+      {
+        fprintf(stderr, "can't read a profile from %s\n", value);
+        return 1;
+      }
+    }
+    else if(strcmp(name, "--card") == 0) card_path = value;
+    else
+    {
+      fprintf(stderr, "unknown option %s\n", name);
+      return 1;
+    }
+  }
+
+  elf_firmware_t firmware;
+  memset(&firmware, 0, sizeof(firmware));
+
+  if(elf_read_firmware(argv[1], &firmware) != 0)
+  {
+    fprintf(stderr, "can't read the firmware from %s\n", argv[1]);
+    return 1;
+  }
+
+  hil.avr = avr_make_mcu_by_name("atmega32u4");
+
+  sd_card_options card_options;
+  card_options.clock_us = get_card_time_us;
+
+  if(!hil.avr || !sd_card_open(card_path, card_options))
+  {
+    fprintf(stderr, "can't set up the atmega32u4 or the card image\n");
+    return 1;
+  }
+
+  avr_init(hil.avr);
+  avr_load_firmware(hil.avr, &firmware);
+
+  // arduino elfs don't carry the simavr mcu section, so these aren't in the firmware
+  hil.avr->frequency = CPU_FREQUENCY;
+  hil.avr->vcc = SUPPLY_MILLIVOLTS;
+  hil.avr->avcc = SUPPLY_MILLIVOLTS;
+  hil.avr->aref = SUPPLY_MILLIVOLTS;
+
+  connect_board();
+
+  avr_cycle_count_t end = (avr_cycle_count_t)(seconds * CPU_FREQUENCY);
+  avr_cycle_count_t next_adc_update = 0;
+  int state = cpu_Running;
+
+  while(hil.avr->cycle < end && state != cpu_Done && state != cpu_Crashed)
+  {
+    state = avr_run(hil.avr);
+
+    if(hil.avr->cycle >= next_adc_update)
+    {
+      update_adc_inputs((double)hil.avr->cycle / CPU_FREQUENCY);
+      next_adc_update += (avr_cycle_count_t)(ADC_UPDATE_INTERVAL * CPU_FREQUENCY);
+    }
+  }
+
+  print_results((double)hil.avr->cycle / CPU_FREQUENCY);
+
+  sd_card_close();
+
+  if(state == cpu_Crashed)
+  {
+    fprintf(stderr, "the firmware crashed at pc 0x%04x\n", (unsigned int)hil.avr->pc);
+    return 1;
+  }
+
+  bool watchdog_reset = hil.boots > 1;
+  bool short_margin = cycles_to_us(hil.longest_watchdog_gap) / 1000 > WATCHDOG_TIMEOUT_MS * (1 - WATCHDOG_MIN_MARGIN);
+
+  if(watchdog_reset)
+  {
+    fprintf(stderr, "the watchdog reset the firmware\n");
+    return 2;
+  }
+
+  if(short_margin)
+  {
+    fprintf(stderr, "less than %.0f%% watchdog margin\n", 100 * WATCHDOG_MIN_MARGIN);
+    return 2;
+  }
+
+  return 0;
+}
@@ -0,0 +1,399 @@
+// --------------------------------------------
+// Freezer X Controller - Logger Bench
+// --------------------------------------------
+
+// runs the firmware's own sd driver (init_sd_card, read_card_block, write_card_block) & save_data_point() against the
+// virtual sd card (native/sd_card.h) on the virtual clock, a record after another as fast as the card takes them. the
+// bus runs at the driver's 250 kHz, so the times are the ones the board would see, less the avr's own time.
+//
+// --power-cuts spreads that many power losses over the run, each one in the middle of one of the blocks a save writes.
+// after one the card is power cycled & the firmware starts over with init_sd_card() like after a brown out. a save that
+// keeps the card from the watchdog for longer than its timeout is a watchdog reset, and starts over the same way.
+//
+// the card is read back afterwards like replay does (native/replay.cpp): every save that returned true should be there
+// once, in order & intact. a failed save may leave a hole (a block that isn't a record) but nothing more.
+//
+// the image is emptied first, it's the bench's card.
+//
+// usage: program image [--records N] [--blocks N] [--init-polls N] [--read-latency us] [--write-latency min-max]
+//                      [--stalls %] [--stall-ms ms] [--crc-errors %] [--power-cuts N] [--torn-bytes N] [--seed N]
+//
+// exits with 2 if a saved record went missing, a failed save did more than leave a hole, or a save took the watchdog
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/main.cpp"
+
+#include "hal_native.h"
+#include "sd_card.h"
+
+// --------------------------------------
+// Constants
+
+const uint32_t WATCHDOG_TIMEOUT_MS = 2000; // WDTO_2S
+const uint32_t UPDATE_INTERVAL_MS = 1000; // a record per update
+const uint32_t COUNT_BLOCKS = 2; // record n is in block n + 2, blocks 0 & 1 hold the count
+const uint8_t SAVE_WRITES = 3; // both counts & the record, a cut lands on one of them
+
+// --------------------------------------
+// Bench
+
+struct bench_options
+{
+  uint32_t records = 10000;
+  uint32_t power_cuts = 0;
+  uint32_t seed = 1;
+
+  sd_card_options card;
+};
+
+struct bench_results
+{
+  uint32_t saved = 0;
+  uint32_t failed = 0;
+  uint32_t watchdog_resets = 0;
+  uint32_t power_losses = 0;
+  uint32_t boots = 0;
+  uint32_t failed_boots = 0;
+
+  uint64_t save_us = 0;
+  uint32_t longest_save_us = 0;
+};
+
+struct image_check
+{
+  uint32_t count = 0;
+  uint32_t records = 0;
+  uint32_t holes = 0; // blocks under the count that aren't a record
+  uint32_t lost = 0; // saved but not on the card
+  uint32_t duplicates = 0;
+  uint32_t out_of_order = 0;
+  uint32_t unsaved = 0; // on the card but the save failed, it made it before the cut
+};
+
+bench_options options;
+bench_results results;
+
+bool* saved_records = nullptr;
+jmp_buf watchdog_reset;
+
+// --------------------------------------
+
+// the board's watchdog, the bus is the only thing that moves the clock during a save
+uint8_t transfer_to_card(uint8_t data)
+{
+  if(hal_native_watchdog_age() > WATCHDOG_TIMEOUT_MS)
+  {
+    longjmp(watchdog_reset, 1);
+  }
+
+  return sd_card_transfer(data);
+}
+
+// what setup() does for the card after a reset, the chip select starts released
+void boot_card()
+{
+  hal_digital_write(MICRO_SD_CS, HIGH);
+  hal_reset_watchdog();
+
+  results.boots++;
+  results.failed_boots += !init_sd_card();
+}
+
+// log_state() with the sequence number for the time, so the check can tell the records apart
+bool save_record(uint32_t sequence)
+{
+  freezer_state_data_point data_point {};
+
+  data_point.ms_since_startup = sequence;
+  data_point.state = current_state;
+  data_point.config = active_config;
+
+  data_point.crc = calculate_crc8((uint8_t*)&data_point, sizeof(freezer_state_data_point));
+
+  return save_data_point(&data_point);
+}
+
+// one of the blocks the next save programs loses power
+void arm_power_cut()
+{
+  options.card.power_loss_at_write = sd_card_get_statistics().blocks_programmed + 1 + random(SAVE_WRITES);
+  sd_card_set_options(options.card);
+}
+
+void run_bench()
+{
+  uint32_t next_cut = 0;
+
+  boot_card();
+
+  for(uint32_t sequence = 0; sequence < options.records; sequence++)
+  {
+    if(next_cut < options.power_cuts && sequence == (uint64_t)(next_cut + 1) * options.records / (options.power_cuts + 1))
+    {
+      arm_power_cut();
+      next_cut++;
+    }
+
+    hal_reset_watchdog();
+    uint32_t started_at = hal_micros();
+
+    volatile bool saved = false;
+
+    if(setjmp(watchdog_reset) == 0)
+    {
+      saved = save_record(sequence);
+    }
+    else
+    {
+      results.watchdog_resets++;
+    }
+
+    uint32_t duration = hal_micros() - started_at;
+    results.save_us += duration;
+    results.longest_save_us = duration > results.longest_save_us ? duration : results.longest_save_us;
+
+    saved_records[sequence] = saved;
+    results.saved += saved;
+    results.failed += !saved;
+
+    if(!sd_card_get_statistics().powered)
+    {
+      results.power_losses++;
+
+      sd_card_power_cycle();
+      boot_card();
+    }
+    else if(hal_native_watchdog_age() > WATCHDOG_TIMEOUT_MS)
+    {
+      boot_card();
+    }
+  }
+}
+
+// --------------------------------------
+// Check
+
+bool read_image_block(FILE* image, uint32_t block, uint8_t* data)
+{
+  memset(data, 0, SD_BLOCK_SIZE);
+
+  if(fseek(image, (long)block * SD_BLOCK_SIZE, SEEK_SET) != 0)
+  {
+    return false;
+  }
+
+  fread(data, 1, SD_BLOCK_SIZE, image);
+
+  return true;
+}
+
+// the same choice save_data_point() makes between the two copies
+uint32_t read_record_count(FILE* image)
+{
+  uint8_t blocks[2][SD_BLOCK_SIZE];
+
+  read_image_block(image, 0, blocks[0]);
+  read_image_block(image, 1, blocks[1]);
+
+  uint8_t chosen = 0;
+
+  if(calculate_crc8(blocks[0], sizeof(uint32_t)) != blocks[0][sizeof(uint32_t)]
+      && calculate_crc8(blocks[1], sizeof(uint32_t)) == blocks[1][sizeof(uint32_t)])
+  {
+    chosen = 1;
+  }
+
+  uint32_t count;
+  memcpy(&count, blocks[chosen], sizeof(uint32_t));
+
+  return count;
+}
+
+bool read_record(FILE* image, uint32_t index, uint32_t& sequence)
+{
+  uint8_t block[SD_BLOCK_SIZE];
+  read_image_block(image, index + COUNT_BLOCKS, block);
+
+  freezer_state_data_point data_point;
+  memcpy((void*)&data_point, block, sizeof(freezer_state_data_point));
+
+  uint8_t crc = data_point.crc;
+  data_point.crc = 0;
+
+  if(memcmp((const void*)data_point.start_magic_bytes, "FZXE", 4) != 0
+      || crc != calculate_crc8((uint8_t*)&data_point, sizeof(freezer_state_data_point)))
+  {
+    return false;
+  }
+
+  sequence = data_point.ms_since_startup;
+
+  return sequence < options.records;
+}
+
+bool check_image(const char* path, image_check& check)
+{
+  FILE* image = fopen(path, "rb");
+
+  if(!image)
+  {
+    return false;
+  }
+
+  uint8_t* found = (uint8_t*)calloc(options.records, 1);
+
+  check.count = read_record_count(image);
+
+  uint32_t last_sequence = 0;
+
+  for(uint32_t index = 1; index <= check.count && index < options.card.block_count - COUNT_BLOCKS; index++)
+  {
+    uint32_t sequence;
+
+    if(!read_record(image, index, sequence))
+    {
+      check.holes++;
+      continue;
+    }
+
+    check.records++;
+    check.duplicates += found[sequence] > 0;
+    check.out_of_order += check.records > 1 && sequence <= last_sequence;
+
+    found[sequence]++;
+    last_sequence = sequence;
+  }
+
+  for(uint32_t sequence = 0; sequence < options.records; sequence++)
+  {
+    check.lost += saved_records[sequence] && !found[sequence];
+    check.unsaved += !saved_records[sequence] && found[sequence];
+  }
+
+  free(found);
+  fclose(image);
+
+  return true;
+}
+
+// --------------------------------------
+
+void parse_options(int argc, char** argv)
+{
+  for(int i = 2; i + 1 < argc; i += 2)
+  {
+    const char* name = argv[i];
+    const char* value = argv[i + 1];
+
+    if(strcmp(name, "--records") == 0) options.records = strtoul(value, nullptr, 10);
+    else if(strcmp(name, "--blocks") == 0) options.card.block_count = strtoul(value, nullptr, 10);
+    else if(strcmp(name, "--init-polls") == 0) options.card.initialization_polls = atoi(value);
+    else if(strcmp(name, "--read-latency") == 0) options.card.read_latency_us = strtoul(value, nullptr, 10);
+    else if(strcmp(name, "--write-latency") == 0)
+    {
+      // in us, a single value is a fixed latency
+      char* end = nullptr;
+      options.card.write_latency_min_us = strtoul(value, &end, 10);
+      options.card.write_latency_max_us = *end == '-' ? strtoul(end + 1, nullptr, 10) : options.card.write_latency_min_us;
+    }
+    else if(strcmp(name, "--stalls") == 0) options.card.stall_probability = atof(value) / 100;
+    else if(strcmp(name, "--stall-ms") == 0) options.card.stall_us = strtoul(value, nullptr, 10) * 1000;
+    else if(strcmp(name, "--crc-errors") == 0) options.card.write_crc_error_probability = options.card.read_crc_error_probability = atof(value) / 100;
+    else if(strcmp(name, "--power-cuts") == 0) options.power_cuts = strtoul(value, nullptr, 10);
+    else if(strcmp(name, "--torn-bytes") == 0) options.card.power_loss_torn_bytes = atoi(value);
+    else if(strcmp(name, "--seed") == 0) options.seed = strtoul(value, nullptr, 10);
+    else
+    {
+      fprintf(stderr, "unknown option %s\n", name);
+      exit(1);
+    }
+  }
+
+  if(options.card.write_latency_max_us < options.card.write_latency_min_us)
+  {
+    options.card.write_latency_max_us = options.card.write_latency_min_us;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  if(argc < 2 || argc % 2 != 0)
+  {
+    fprintf(stderr, "usage: %s image [--records N] [--blocks N] [--init-polls N] [--read-latency us] [--write-latency min-max]"
+        " [--stalls %%] [--stall-ms ms] [--crc-errors %%] [--power-cuts N] [--torn-bytes N] [--seed N]\n", argv[0]);
+    return 1;
+  }
+
+  parse_options(argc, argv);
+
+  options.card.seed = options.seed;
+  options.card.clock_us = hal_micros;
+  randomSeed(options.seed);
+
+  // a new card every run
+  FILE* empty = fopen(argv[1], "wb");
+
+  if(empty)
+  {
+    fclose(empty);
+  }
+
+  if(!empty || !sd_card_open(argv[1], options.card))
+  {
+    fprintf(stderr, "can't create the card image %s\n", argv[1]);
+    return 1;
+  }
+
+  hal_native_attach_spi_device(MICRO_SD_CS, sd_card_select, transfer_to_card);
+
+  saved_records = (bool*)calloc(options.records, sizeof(bool));
+
+  run_bench();
+
+  sd_card_statistics card = sd_card_get_statistics();
+  sd_card_close();
+
+  image_check check {};
+
+  if(!check_image(argv[1], check))
+  {
+    fprintf(stderr, "can't read the card image back\n");
+    return 1;
+  }
+
+  uint32_t saves = results.saved + results.failed;
+  double mean_save_ms = saves ? results.save_us / 1000.0 / saves : 0;
+  double longest_save_ms = results.longest_save_us / 1000.0;
+
+  printf("saves:         %lu of %lu (%lu failed, %lu power losses, %lu watchdog resets)\n", (unsigned long)results.saved,
+      (unsigned long)saves, (unsigned long)results.failed, (unsigned long)results.power_losses, (unsigned long)results.watchdog_resets);
+  printf("boots:         %lu (%lu with init_sd_card() failing)\n", (unsigned long)results.boots, (unsigned long)results.failed_boots);
+  printf("save time:     %.1f ms mean, %.1f ms longest (%.0f%% of an update)\n", mean_save_ms, longest_save_ms,
+      100 * longest_save_ms / UPDATE_INTERVAL_MS);
+  printf("throughput:    %.1f records/s, %.1f KB/s of blocks written\n", results.save_us ? results.saved * 1e6 / results.save_us : 0,
+      results.save_us ? card.blocks_written * (SD_BLOCK_SIZE / 1024.0) * 1e6 / results.save_us : 0);
+  printf("card:          %lu blocks read, %lu written, %lu crc errors, %lu stalls, %.1f ms longest write\n",
+      (unsigned long)card.blocks_read, (unsigned long)card.blocks_written, (unsigned long)card.crc_errors, (unsigned long)card.stalls,
+      card.longest_write_us / 1000.0);
+  printf("image:         count %lu, %lu records, %lu holes, %lu lost, %lu duplicated, %lu out of order, %lu from failed saves\n",
+      (unsigned long)check.count, (unsigned long)check.records, (unsigned long)check.holes, (unsigned long)check.lost,
+      (unsigned long)check.duplicates, (unsigned long)check.out_of_order, (unsigned long)check.unsaved);
+
+  bool consistent = check.lost == 0 && check.duplicates == 0 && check.out_of_order == 0 && check.holes <= results.failed;
+
+  if(!consistent)
+  {
+    fprintf(stderr, "the card isn't consistent with the saves\n");
+  }
+
+  if(results.watchdog_resets > 0)
+  {
+    fprintf(stderr, "a save held the watchdog for longer than %lu ms\n", (unsigned long)WATCHDOG_TIMEOUT_MS);
+  }
+
+  return consistent && results.watchdog_resets == 0 ? 0 : 2;
+}
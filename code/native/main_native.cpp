@@ -0,0 +1,128 @@
+// --------------------------------------------
+// Freezer X Controller - Host Runner
+// --------------------------------------------
+
+// boots the unmodified firmware on the virtual hardware, runs it on the virtual clock against a small model of the
+// two probes & reports what the outputs did. it's a check that the host build works end to end, so the model only
+// has to make the firmware cycle like it would on a freezer: the cabinet leaks towards the ambient & gets pulled down
+// while the compressor runs, and the compressor shell warms up while it runs. fixed readings wouldn't do, the stuck
+// check takes a probe out when it doesn't move during a run. for anything closer to a real freezer see simulator.cpp.
+// the update_state() timing is a benchmark of this machine on the normal control path, only useful to compare two
+// builds with each other
+//
+// usage: program [seconds] [cabinet C] [ambient C]
+
+#include <chrono>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hal_native.h"
+
+// main.cpp
+void setup();
+void loop();
+void update_state();
+
+// the firmware pins, Arduino.h isn't included here since its min/max macros break the standard headers
+const uint8_t THERMISTOR_1_PIN = 26; // A8
+const uint8_t THERMISTOR_2_PIN = 27; // A9
+const uint8_t COMPRESSOR_RELAY = 18;
+
+const uint32_t LOOP_STEP = 50; // ms of virtual time per loop(), the firmware only updates once a second anyway
+const uint32_t BENCHMARK_UPDATES = 10000;
+
+// the probes, like the firmware's ntc channels: a 10k & a 100k ntc under a 10k resistor
+const double NTC_BETA = 3950;
+const double NTC_SERIES_RESISTOR = 10000;
+const double CABINET_NTC_R25 = 10000;
+const double COMPRESSOR_NTC_R25 = 100000;
+
+const double CABINET_LEAK_TAU = 25000; // seconds, about 1.5 degrees in 15 minutes at -18 in a 25 degree room
+const double CABINET_PULL_DOWN = 0.003; // degrees per second while running
+const double COMPRESSOR_RUNNING = 35; // the shell settles here while running, well clear of the max temp
+const double COMPRESSOR_TAU = 600; // seconds
+
+double ambient = 25;
+double cabinet_temperature = 25;
+double compressor_temperature = 25;
+
+uint16_t temperature_to_adc(double temperature, double r25)
+{
+  double resistance = r25 * exp(NTC_BETA * (1 / (temperature + 273.15) - 1 / 298.15));
+
+  return (uint16_t)(1023 * resistance / (resistance + NTC_SERIES_RESISTOR) + 0.5);
+}
+
+uint16_t read_probe_adc(uint8_t pin)
+{
+  if(pin == THERMISTOR_1_PIN)
+  {
+    return temperature_to_adc(cabinet_temperature, CABINET_NTC_R25);
+  }
+
+  if(pin == THERMISTOR_2_PIN)
+  {
+    return temperature_to_adc(compressor_temperature, COMPRESSOR_NTC_R25);
+  }
+
+  return 0;
+}
+
+void update_model(double seconds, bool running)
+{
+  cabinet_temperature += (ambient - cabinet_temperature) / CABINET_LEAK_TAU * seconds - (running ? CABINET_PULL_DOWN * seconds : 0);
+  compressor_temperature += ((running ? COMPRESSOR_RUNNING : ambient) - compressor_temperature) / COMPRESSOR_TAU * seconds;
+}
+
+int main(int argc, char** argv)
+{
+  uint32_t seconds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 24UL * 60 * 60;
+  cabinet_temperature = argc > 2 ? atof(argv[2]) : 25;
+  ambient = argc > 3 ? atof(argv[3]) : 25;
+  compressor_temperature = ambient;
+
+  hal_native_analog_read = read_probe_adc;
+
+  setup();
+
+  uint32_t started_at = hal_native_storage_writes();
+  uint32_t on_ms = 0;
+  uint32_t starts = 0;
+  uint8_t compressor = hal_native_get_digital(COMPRESSOR_RELAY);
+
+  for(uint32_t ms = 0; ms < seconds * 1000; ms += LOOP_STEP)
+  {
+    loop();
+    hal_native_advance(LOOP_STEP);
+
+    uint8_t state = hal_native_get_digital(COMPRESSOR_RELAY);
+    update_model(LOOP_STEP / 1000.0, state);
+
+    starts += state && !compressor;
+    on_ms += state ? LOOP_STEP : 0;
+    compressor = state;
+  }
+
+  printf("ran %lu s, compressor %s, %lu starts, on %lu s, cabinet %.1f C, %lu eeprom bytes written\n", (unsigned long)seconds,
+      compressor ? "on" : "off", (unsigned long)starts, (unsigned long)(on_ms / 1000), cabinet_temperature,
+      (unsigned long)(hal_native_storage_writes() - started_at));
+
+  // each update is a second later, like in loop(), and the probes keep following the model so this is the
+  // normal control path rather than the failed sensor one
+  std::chrono::steady_clock::time_point benchmark_started_at = std::chrono::steady_clock::now();
+
+  for(uint32_t i = 0; i < BENCHMARK_UPDATES; i++)
+  {
+    hal_native_advance(1000);
+    update_state();
+    update_model(1, hal_native_get_digital(COMPRESSOR_RELAY));
+  }
+
+  double update_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - benchmark_started_at).count() / BENCHMARK_UPDATES;
+
+  printf("update_state(): %.0f ns\n", update_ns);
+
+  return 0;
+}
@@ -0,0 +1,646 @@
+// --------------------------------------------
+// Freezer X Controller - Log Replay
+// --------------------------------------------
+
+// feeds the temperatures recorded on a card image back through the firmware on the virtual clock, a record per
+// update like on the board, and reports where its compressor decision differs from the recorded one. run it with
+// the firmware that wrote the card and it should agree, run it with new control logic and the differences (and the
+// on time) are what the change would have done to that freezer. the recorded cabinet still follows the recorded
+// decisions, so that only holds while they stay close, the simulator is the better judge of a big change.
+//
+// every boot on the card (the time since startup going backwards) is replayed in its own process, so every global
+// in main.cpp starts over like on the board and only the eeprom carries across.
+//
+// the recorded config is used, the options below override parts of it. the old 'FZZX' records only had the
+// temperatures, the compressor & the basic timings, the rest of the config is the default.
+//
+// usage: program image [--show N] [--tolerance %] [--target C] [--mode timed|band] [--hysteresis S]
+//                      [--cut-in C] [--cut-out C] [--dead-time M] [--min-run M]
+//
+// exits with 2 if the disagreements are more than --tolerance percent of the replayed time
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../src/main.cpp"
+
+#include "hal_native.h"
+
+// --------------------------------------
+// Constants
+
+const uint32_t FIRST_RECORD_BLOCK = 3; // record n is in block n + 2, blocks 0 & 1 hold the count
+
+// the first 'FZZX' layout, as the avr packed it: 4 byte doubles & a 2 byte enum
+const uint8_t LEGACY_RECORD_SIZE = 41;
+const uint8_t LEGACY_TARGET_OFFSET = 12; // float
+const uint8_t LEGACY_HYSTERESIS_TIME_OFFSET = 16;
+const uint8_t LEGACY_DEAD_TIME_OFFSET = 18;
+const uint8_t LEGACY_MAX_RUN_TIME_OFFSET = 20;
+const uint8_t LEGACY_MAX_TEMP_OFFSET = 22; // float
+const uint8_t LEGACY_STARTUP_DELAY_OFFSET = 26;
+const uint8_t LEGACY_NTC1_OFFSET = 28; // float
+const uint8_t LEGACY_NTC2_OFFSET = 32; // float
+const uint8_t LEGACY_ACTUAL_STATE_OFFSET = 37;
+const uint8_t LEGACY_STATUS_OFFSET = 38;
+
+// --------------------------------------
+// Replay
+
+struct replay_options
+{
+  uint32_t show = 10; // disagreements printed
+  double tolerance = -1; // percent, -1 never fails
+
+  double target = NAN; // NAN keeps the recorded value
+  int16_t hysteresis_mode = -1;
+  int16_t hysteresis_time = -1;
+  double cut_in = -1;
+  double cut_out = -1;
+  int16_t dead_time = -1;
+  int16_t min_run_time = -1;
+};
+
+enum record_format
+{
+  current_format = 0,
+  legacy_format = 1,
+  unknown_format = 2, // one of the layouts in between, or not a record at all
+  corrupt_record = 3,
+};
+
+struct replay_record
+{
+  uint32_t ms_since_startup = 0;
+
+  temperature cabinet = degrees(0);
+  temperature compressor = degrees(0);
+
+  bool compressor_on = false;
+  uint8_t status = freezer_status::off;
+
+  freezer_config config; // the defaults with what the legacy records had
+};
+
+// what a boot's process sends back
+struct replay_results
+{
+  uint32_t next_record = 0;
+
+  uint32_t records = 0;
+  uint32_t unknown_records = 0;
+  uint32_t corrupt_records = 0;
+
+  // summed over every boot, a card can hold months of records which is past where a 32 bit ms count wraps
+  uint64_t compared_ms = 0;
+  uint32_t disagreements = 0; // records
+  uint64_t disagreement_ms = 0;
+  uint32_t disagreement_spans = 0;
+  uint32_t shown = 0;
+
+  uint64_t recorded_on_ms = 0;
+  uint32_t recorded_starts = 0;
+  uint64_t replayed_on_ms = 0;
+  uint32_t replayed_starts = 0;
+
+  double recorded_watt_hours = 0;
+  double replayed_watt_hours = 0;
+
+  uint8_t storage[HAL_NATIVE_STORAGE_SIZE];
+};
+
+replay_options options;
+
+int image = -1;
+uint32_t record_count = 0;
+uint32_t shown = 0; // disagreements printed by the boots before
+
+// what the ntc channels should read, the recorded temperatures
+temperature replayed_temperatures[NTC_CHANNEL_COUNT];
+uint16_t replayed_adc_sums[NTC_CHANNEL_COUNT];
+uint8_t channel_reads[NTC_CHANNEL_COUNT];
+
+// the oversampled sum the firmware's own table turns into the temperature, so the replayed readings are the
+// recorded ones to the centi-degree (with whatever calibration the board had already applied)
+uint16_t temperature_to_adc_sum(uint8_t channel, temperature value)
+{
+  const temperature* table = sensors.table(channel);
+
+  // the table falls as the sum rises, this finds the first sum at or below the temperature
+  uint16_t low = 0;
+  uint16_t high = (uint16_t)ANALOG_RESOLUTION * NTC_SAMPLE_COUNT - 1;
+
+  while(low < high)
+  {
+    uint16_t middle = (low + high) / 2;
+
+    if(lookup_ntc_temperature(table, middle) > value)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+
+  if(low > 0 && lookup_ntc_temperature(table, low - 1) - value < value - lookup_ntc_temperature(table, low))
+  {
+    low--;
+  }
+
+  return low;
+}
+
+// every sweep is a dummy read & then NTC_SAMPLE_COUNT that are summed, the sum is spread over those
+uint16_t read_recorded_adc(uint8_t pin)
+{
+  uint8_t channel = pin == THERMISTOR_1_PIN ? CABINET_NTC : pin == THERMISTOR_2_PIN ? COMPRESSOR_NTC : NTC_CHANNEL_COUNT;
+
+  if(channel == NTC_CHANNEL_COUNT)
+  {
+    return 0;
+  }
+
+  uint8_t sample = channel_reads[channel];
+  channel_reads[channel] = (sample + 1) % (NTC_SAMPLE_COUNT + 1);
+
+  if(sample == 0)
+  {
+    replayed_adc_sums[channel] = temperature_to_adc_sum(channel, replayed_temperatures[channel]);
+  }
+
+  uint16_t sum = replayed_adc_sums[channel];
+
+  return sum / NTC_SAMPLE_COUNT + (sample > 0 && sample - 1 < sum % NTC_SAMPLE_COUNT);
+}
+
+bool read_image_block(uint32_t block, uint8_t* data)
+{
+  return pread(image, data, SD_BLOCK_SIZE, (off_t)block * SD_BLOCK_SIZE) == SD_BLOCK_SIZE;
+}
+
+// the same choice save_data_point() makes between the two copies
+bool read_record_count()
+{
+  uint8_t blocks[2][SD_BLOCK_SIZE];
+
+  if(!read_image_block(0, blocks[0]) || !read_image_block(1, blocks[1]))
+  {
+    return false;
+  }
+
+  uint8_t chosen = 0;
+
+  if(calculate_crc8(blocks[0], sizeof(uint32_t)) != blocks[0][sizeof(uint32_t)]
+      && calculate_crc8(blocks[1], sizeof(uint32_t)) == blocks[1][sizeof(uint32_t)])
+  {
+    chosen = 1;
+  }
+
+  memcpy(&record_count, blocks[chosen], sizeof(uint32_t));
+
+  return true;
+}
+
+float read_float(const uint8_t* data)
+{
+  float value;
+  memcpy(&value, data, sizeof(float));
+
+  return value;
+}
+
+int16_t read_int16(const uint8_t* data)
+{
+  int16_t value;
+  memcpy(&value, data, sizeof(int16_t));
+
+  return value;
+}
+
+temperature float_to_temperature(float value)
+{
+  return centi_degrees(lround(value * 100));
+}
+
+record_format decode_legacy_record(uint8_t* block, replay_record& record)
+{
+  uint8_t crc = block[LEGACY_RECORD_SIZE - 1];
+  block[LEGACY_RECORD_SIZE - 1] = 0;
+
+  if(crc != calculate_crc8(block, LEGACY_RECORD_SIZE))
+  {
+    return record_format::corrupt_record;
+  }
+
+  memcpy(&record.ms_since_startup, block + 4, sizeof(uint32_t));
+
+  record.cabinet = float_to_temperature(read_float(block + LEGACY_NTC1_OFFSET));
+  record.compressor = float_to_temperature(read_float(block + LEGACY_NTC2_OFFSET));
+  record.compressor_on = block[LEGACY_ACTUAL_STATE_OFFSET];
+  record.status = read_int16(block + LEGACY_STATUS_OFFSET);
+
+  record.config = freezer_config {};
+  record.config.target_temperature = float_to_temperature(read_float(block + LEGACY_TARGET_OFFSET));
+  record.config.target_temperature_hysteresis_time = read_int16(block + LEGACY_HYSTERESIS_TIME_OFFSET);
+  record.config.compressor_dead_time = read_int16(block + LEGACY_DEAD_TIME_OFFSET);
+  record.config.compressor_max_run_time = read_int16(block + LEGACY_MAX_RUN_TIME_OFFSET);
+  record.config.compressor_max_temp = float_to_temperature(read_float(block + LEGACY_MAX_TEMP_OFFSET));
+  record.config.freezer_startup_delay = read_int16(block + LEGACY_STARTUP_DELAY_OFFSET);
+
+  return record_format::legacy_format;
+}
+
+record_format read_record(uint32_t index, replay_record& record)
+{
+  uint8_t block[SD_BLOCK_SIZE];
+
+  if(!read_image_block(index + FIRST_RECORD_BLOCK - 1, block))
+  {
+    return record_format::corrupt_record;
+  }
+
+  if(memcmp(block, "FZZX", 4) == 0)
+  {
+    return decode_legacy_record(block, record);
+  }
+
+  freezer_state_data_point data_point;
+  memcpy((void*)&data_point, block, sizeof(freezer_state_data_point));
+
+  if(memcmp((const void*)data_point.start_magic_bytes, "FZXE", 4) != 0)
+  {
+    return record_format::unknown_format;
+  }
+
+  uint8_t crc = data_point.crc;
+  data_point.crc = 0;
+
+  if(crc != calculate_crc8((uint8_t*)&data_point, sizeof(freezer_state_data_point)))
+  {
+    return record_format::corrupt_record;
+  }
+
+  record.ms_since_startup = data_point.ms_since_startup;
+  record.cabinet = data_point.state.ntc_temperatures[CABINET_NTC];
+  record.compressor = data_point.state.ntc_temperatures[COMPRESSOR_NTC];
+  record.compressor_on = data_point.state.actual_compressor_state;
+  record.status = data_point.state.status;
+  record.config = data_point.config;
+
+  return record_format::current_format;
+}
+
+// the recorded config with the options on top, saved like the menu would
+void configure_firmware(const freezer_config& config)
+{
+  dirty_config = config;
+
+  if(!isnan(options.target))
+  {
+    dirty_config.target_temperature = centi_degrees(lround(options.target * 100));
+  }
+
+  if(options.hysteresis_mode >= 0)
+  {
+    dirty_config.hysteresis_mode = options.hysteresis_mode;
+  }
+
+  if(options.hysteresis_time >= 0)
+  {
+    dirty_config.target_temperature_hysteresis_time = options.hysteresis_time;
+  }
+
+  if(options.cut_in >= 0)
+  {
+    dirty_config.cut_in_offset = centi_degrees(lround(options.cut_in * 100));
+  }
+
+  if(options.cut_out >= 0)
+  {
+    dirty_config.cut_out_offset = centi_degrees(lround(options.cut_out * 100));
+  }
+
+  if(options.dead_time >= 0)
+  {
+    dirty_config.compressor_dead_time = options.dead_time;
+  }
+
+  if(options.min_run_time >= 0)
+  {
+    dirty_config.compressor_min_run_time = options.min_run_time;
+  }
+
+  save_dirty_config();
+  active_config = dirty_config;
+}
+
+// the screen strings are padded to 13 characters
+const char* get_status_name(uint8_t status, char* name)
+{
+  if(status >= sizeof(freezer_status_strings) / sizeof(freezer_status_strings[0]))
+  {
+    return "?";
+  }
+
+  const char* padded = freezer_status_strings[status];
+
+  while(*padded == ' ')
+  {
+    padded++;
+  }
+
+  strcpy(name, padded);
+
+  for(int i = strlen(name) - 1; i >= 0 && name[i] == ' '; i--)
+  {
+    name[i] = '\0';
+  }
+
+  return name[0] ? name : "Off";
+}
+
+// where the replay & the recording went separate ways, printed once they agree again
+struct disagreement
+{
+  uint32_t started_at = 0;
+  replay_record record;
+  bool replayed_on = false;
+  uint8_t replayed_status = freezer_status::off;
+};
+
+void print_disagreement(uint32_t boot, const disagreement& span, uint32_t ended_at)
+{
+  uint32_t seconds = span.started_at / 1000;
+  char recorded_status[16];
+  char replayed_status[16];
+
+  printf("boot %lu at %lu:%02lu:%02lu for %lu s: recorded %s (%s), replayed %s (%s), cabinet %.2f, compressor %.2f\n",
+      (unsigned long)boot, (unsigned long)(seconds / 3600), (unsigned long)(seconds / 60 % 60), (unsigned long)(seconds % 60),
+      (unsigned long)((ended_at - span.started_at) / 1000), span.record.compressor_on ? "on" : "off", get_status_name(span.record.status, recorded_status),
+      span.replayed_on ? "on" : "off", get_status_name(span.replayed_status, replayed_status),
+      span.record.cabinet.centi_degrees / 100.0, span.record.compressor.centi_degrees / 100.0);
+}
+
+// runs in its own process, from the first record of a boot to the last
+void replay_boot(uint32_t boot, uint32_t first_record, replay_results& results)
+{
+  hal_native_analog_read = read_recorded_adc;
+
+  replay_record record;
+  replay_record last_record;
+  bool started = false;
+  bool recorded_on = false;
+  bool replayed_on = false;
+  bool disagreeing = false;
+  disagreement span;
+  uint32_t last_ms = 0;
+
+  uint32_t index = first_record;
+
+  for(; index <= record_count; index++)
+  {
+    record_format format = read_record(index, record);
+
+    if(format == record_format::unknown_format || format == record_format::corrupt_record)
+    {
+      format == record_format::unknown_format ? results.unknown_records++ : results.corrupt_records++;
+      continue;
+    }
+
+    if(started && record.ms_since_startup < last_record.ms_since_startup)
+    {
+      break; // the next boot
+    }
+
+    replayed_temperatures[CABINET_NTC] = record.cabinet;
+    replayed_temperatures[COMPRESSOR_NTC] = record.compressor;
+
+    if(!started)
+    {
+      setup();
+      configure_firmware(record.config);
+    }
+    else if(memcmp(&record.config, &last_record.config, sizeof(freezer_config)) != 0)
+    {
+      configure_firmware(record.config); // changed from the menu
+    }
+
+    // an update a second, even if the board logged two a bit closer than that
+    uint32_t ms = started ? max(record.ms_since_startup, last_ms + 1000) : max(record.ms_since_startup, hal_millis() + 1000);
+    uint32_t elapsed = started ? ms - last_ms : 0;
+
+    hal_native_set_time(ms);
+    loop();
+
+    // the time since the last record is counted with the state it left behind
+    results.compared_ms += elapsed;
+    results.recorded_on_ms += recorded_on ? elapsed : 0;
+    results.replayed_on_ms += replayed_on ? elapsed : 0;
+    results.recorded_watt_hours += recorded_on ? (double)elapsed * active_config.compressor_power / 3600000.0 : 0;
+    results.replayed_watt_hours += replayed_on ? (double)elapsed * active_config.compressor_power / 3600000.0 : 0;
+    results.disagreement_ms += disagreeing ? elapsed : 0;
+
+    results.recorded_starts += record.compressor_on && !recorded_on;
+    results.replayed_starts += current_state.actual_compressor_state && !replayed_on;
+
+    recorded_on = record.compressor_on;
+    replayed_on = current_state.actual_compressor_state;
+
+    if(recorded_on != replayed_on)
+    {
+      results.disagreements++;
+
+      if(!disagreeing)
+      {
+        span.started_at = ms;
+        span.record = record;
+        span.replayed_on = replayed_on;
+        span.replayed_status = current_state.status;
+        results.disagreement_spans++;
+      }
+    }
+    else if(disagreeing && shown + results.shown < options.show)
+    {
+      print_disagreement(boot, span, ms);
+      results.shown++;
+    }
+
+    disagreeing = recorded_on != replayed_on;
+
+    results.records++;
+    last_record = record;
+    last_ms = ms;
+    started = true;
+  }
+
+  if(disagreeing && shown + results.shown < options.show)
+  {
+    print_disagreement(boot, span, last_ms);
+    results.shown++;
+  }
+
+  results.next_record = index;
+  memcpy(results.storage, hal_native_storage(), HAL_NATIVE_STORAGE_SIZE);
+}
+
+// a fresh process per boot, so the firmware's globals start over
+bool run_boot(uint32_t boot, uint32_t first_record, replay_results& results)
+{
+  int pipe_ends[2];
+
+  if(pipe(pipe_ends) != 0)
+  {
+    return false;
+  }
+
+  fflush(stdout);
+  pid_t child = fork();
+
+  if(child < 0)
+  {
+    return false;
+  }
+
+  if(child == 0)
+  {
+    close(pipe_ends[0]);
+
+    results = replay_results {};
+    replay_boot(boot, first_record, results);
+
+    fflush(stdout);
+    bool sent = write(pipe_ends[1], &results, sizeof(results)) == sizeof(results);
+    _exit(sent ? 0 : 1);
+  }
+
+  close(pipe_ends[1]);
+
+  uint8_t* bytes = (uint8_t*)&results;
+  size_t received = 0;
+
+  while(received < sizeof(results))
+  {
+    ssize_t count = read(pipe_ends[0], bytes + received, sizeof(results) - received);
+
+    if(count <= 0)
+    {
+      break;
+    }
+
+    received += count;
+  }
+
+  close(pipe_ends[0]);
+
+  int status = 0;
+  waitpid(child, &status, 0);
+
+  return received == sizeof(results) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void parse_options(int argc, char** argv)
+{
+  for(int i = 2; i + 1 < argc; i += 2)
+  {
+    const char* name = argv[i];
+    const char* value = argv[i + 1];
+
+    if(strcmp(name, "--show") == 0) options.show = strtoul(value, nullptr, 10);
+    else if(strcmp(name, "--tolerance") == 0) options.tolerance = atof(value);
+    else if(strcmp(name, "--target") == 0) options.target = atof(value);
+    else if(strcmp(name, "--mode") == 0) options.hysteresis_mode = strcmp(value, "band") == 0 ? hysteresis_mode::band_hysteresis : hysteresis_mode::timed_hysteresis;
+    else if(strcmp(name, "--hysteresis") == 0) options.hysteresis_time = atoi(value);
+    else if(strcmp(name, "--cut-in") == 0) options.cut_in = atof(value);
+    else if(strcmp(name, "--cut-out") == 0) options.cut_out = atof(value);
+    else if(strcmp(name, "--dead-time") == 0) options.dead_time = atoi(value);
+    else if(strcmp(name, "--min-run") == 0) options.min_run_time = atoi(value);
+    else
+    {
+      fprintf(stderr, "unknown option %s\n", name);
+      exit(1);
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  if(argc < 2 || argc % 2 != 0)
+  {
+    fprintf(stderr, "usage: %s image [--show N] [--tolerance %%] [--target C] [--mode timed|band] [--hysteresis S]"
+        " [--cut-in C] [--cut-out C] [--dead-time M] [--min-run M]\n", argv[0]);
+    return 1;
+  }
+
+  parse_options(argc, argv);
+
+  image = open(argv[1], O_RDONLY);
+
+  if(image < 0 || !read_record_count())
+  {
+    fprintf(stderr, "can't read the record count from %s\n", argv[1]);
+    return 1;
+  }
+
+  replay_results total {};
+  replay_results results {};
+  uint32_t boots = 0;
+  uint32_t next_record = 1;
+
+  while(next_record <= record_count)
+  {
+    if(!run_boot(boots + 1, next_record, results))
+    {
+      fprintf(stderr, "replaying the boot from record %lu failed\n", (unsigned long)next_record);
+      return 1;
+    }
+
+    boots += results.records > 0;
+    next_record = results.next_record;
+    memcpy(hal_native_storage(), results.storage, HAL_NATIVE_STORAGE_SIZE);
+
+    total.records += results.records;
+    total.unknown_records += results.unknown_records;
+    total.corrupt_records += results.corrupt_records;
+    total.compared_ms += results.compared_ms;
+    total.disagreements += results.disagreements;
+    total.disagreement_ms += results.disagreement_ms;
+    total.disagreement_spans += results.disagreement_spans;
+    shown += results.shown;
+    total.recorded_on_ms += results.recorded_on_ms;
+    total.recorded_starts += results.recorded_starts;
+    total.replayed_on_ms += results.replayed_on_ms;
+    total.replayed_starts += results.replayed_starts;
+    total.recorded_watt_hours += results.recorded_watt_hours;
+    total.replayed_watt_hours += results.replayed_watt_hours;
+  }
+
+  double hours = total.compared_ms / 3600000.0;
+  double disagreeing = total.compared_ms ? 100.0 * total.disagreement_ms / total.compared_ms : 0;
+
+  printf("records:         %lu of %lu (%lu unknown format, %lu bad crc)\n", (unsigned long)total.records, (unsigned long)record_count,
+      (unsigned long)total.unknown_records, (unsigned long)total.corrupt_records);
+  printf("boots:           %lu\n", (unsigned long)boots);
+  printf("time:            %.1f h\n", hours);
+  printf("disagreements:   %lu records, %llu s (%.3f%%) in %lu spans\n", (unsigned long)total.disagreements,
+      (unsigned long long)(total.disagreement_ms / 1000), disagreeing, (unsigned long)total.disagreement_spans);
+  printf("recorded:        %.1f h on, %lu starts, %.2f kWh\n", total.recorded_on_ms / 3600000.0, (unsigned long)total.recorded_starts, total.recorded_watt_hours / 1000);
+  printf("replayed:        %.1f h on, %lu starts, %.2f kWh", total.replayed_on_ms / 3600000.0, (unsigned long)total.replayed_starts, total.replayed_watt_hours / 1000);
+
+  if(total.recorded_watt_hours > 0)
+  {
+    printf(" (%+.1f%%)", 100.0 * (total.replayed_watt_hours / total.recorded_watt_hours - 1));
+  }
+
+  printf("\n");
+
+  close(image);
+
+  return options.tolerance >= 0 && disagreeing > options.tolerance ? 2 : 0;
+}
@@ -0,0 +1,585 @@
+// --------------------------------------------
+// Freezer X Controller - Virtual SD Card
+// --------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sd_card.h"
+
+// --------------------------------------
+// Protocol
+
+const uint8_t SD_COMMAND_SIZE = 6; // command, 4 argument bytes & the crc
+const uint8_t SD_CSD_SIZE = 16;
+
+const uint8_t SD_DATA_TOKEN = 0xFE;
+const uint8_t SD_MULTIPLE_WRITE_TOKEN = 0xFC;
+const uint8_t SD_STOP_TRANSMISSION_TOKEN = 0xFD;
+
+// data responses
+const uint8_t SD_DATA_ACCEPTED = 0x05;
+const uint8_t SD_DATA_CRC_ERROR = 0x0B;
+const uint8_t SD_DATA_WRITE_ERROR = 0x0D;
+
+// r1 bits
+const uint8_t SD_R1_READY = 0x00;
+const uint8_t SD_R1_IDLE = 0x01;
+const uint8_t SD_R1_ILLEGAL_COMMAND = 0x04;
+const uint8_t SD_R1_COMMAND_CRC_ERROR = 0x08;
+const uint8_t SD_R1_ADDRESS_ERROR = 0x20;
+
+const uint32_t SD_OCR = 0x00FF8000; // 2.7 - 3.6 V
+const uint32_t SD_OCR_POWERED_UP = 0x80000000;
+const uint32_t SD_OCR_HIGH_CAPACITY = 0x40000000; // block addressed
+
+const uint32_t SD_DEFAULT_BYTE_US = 32; // 8 clocks at 250 kHz, when there's no clock
+const uint32_t SD_STOP_BUSY_US = 100;
+
+enum sd_card_phase
+{
+  sd_waiting_for_command = 0,
+  sd_receiving_command = 1,
+  sd_waiting_for_write_token = 2,
+  sd_receiving_write_data = 3,
+  sd_waiting_for_multiple_write_token = 4, // CMD25, a block or the stop token
+  sd_receiving_multiple_write_data = 5,
+};
+
+// --------------------------------------
+// State
+
+struct sd_card
+{
+  FILE* image = nullptr;
+  sd_card_options options;
+  sd_card_statistics statistics;
+
+  uint64_t random_state = 0;
+  uint32_t transfers = 0;
+
+  bool selected = false;
+  bool idle = true; // until ACMD41 finishes the initialization
+  uint8_t initialization_polls = 0;
+  bool application_command = false; // the last command was CMD55
+
+  uint8_t phase = sd_card_phase::sd_waiting_for_command;
+
+  uint8_t command[SD_COMMAND_SIZE];
+  uint8_t command_length = 0;
+
+  uint32_t write_block = 0;
+  uint8_t write_data[SD_CARD_BLOCK_SIZE + 2]; // with the crc
+  uint16_t write_length = 0;
+
+  // what the card shifts out next, a read is the biggest: the response time, the r1, the token, the block & the crc.
+  // everything from data_position on waits for data_ready_at, the card is still reading the block until then
+  uint8_t output[1 + 1 + 1 + SD_CARD_BLOCK_SIZE + 2];
+  uint16_t output_length = 0;
+  uint16_t output_position = 0;
+  uint16_t data_position = 0;
+  uint32_t data_ready_at = 0;
+
+  // programming a block, DO is held low until then
+  bool busy = false;
+  uint32_t busy_until = 0;
+};
+
+sd_card card;
+
+// --------------------------------------
+
+uint32_t sd_get_time_us()
+{
+  return card.options.clock_us ? card.options.clock_us() : card.transfers * SD_DEFAULT_BYTE_US;
+}
+
+// wraps around like millis(), so it's compared by the difference
+bool sd_has_time_passed(uint32_t time)
+{
+  return (int32_t)(sd_get_time_us() - time) >= 0;
+}
+
+// xorshift, the same seed gives the same faults every run
+float sd_random()
+{
+  card.random_state ^= card.random_state << 13;
+  card.random_state ^= card.random_state >> 7;
+  card.random_state ^= card.random_state << 17;
+
+  return (card.random_state >> 40) / 16777216.0f;
+}
+
+uint8_t calculate_sd_crc7(const uint8_t* data, uint8_t length)
+{
+  uint8_t crc = 0;
+
+  for(uint8_t i = 0; i < length; i++)
+  {
+    for(uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc <<= 1;
+
+      if(((data[i] << bit) ^ crc) & 0x80)
+      {
+        crc ^= 0x09;
+      }
+    }
+  }
+
+  return crc & 0x7F;
+}
+
+uint16_t calculate_sd_crc16(const uint8_t* data, uint16_t length)
+{
+  uint16_t crc = 0;
+
+  for(uint16_t i = 0; i < length; i++)
+  {
+    crc ^= (uint16_t)data[i] << 8;
+
+    for(uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+void sd_clear_output()
+{
+  card.output_length = 0;
+  card.output_position = 0;
+  card.data_position = 0;
+}
+
+void sd_queue_output(uint8_t value)
+{
+  if(card.output_length < sizeof(card.output))
+  {
+    card.output[card.output_length++] = value;
+  }
+}
+
+void sd_queue_r1(uint8_t flags)
+{
+  sd_queue_output((card.idle ? SD_R1_IDLE : SD_R1_READY) | flags);
+}
+
+void sd_queue_uint32(uint32_t value)
+{
+  sd_queue_output(value >> 24);
+  sd_queue_output(value >> 16);
+  sd_queue_output(value >> 8);
+  sd_queue_output(value);
+}
+
+// a data block after the read latency: the token, the data & its crc
+void sd_queue_data(const uint8_t* data, uint16_t length)
+{
+  card.data_position = card.output_length;
+  card.data_ready_at = sd_get_time_us() + card.options.read_latency_us;
+
+  sd_queue_output(SD_DATA_TOKEN);
+
+  for(uint16_t i = 0; i < length; i++)
+  {
+    sd_queue_output(data[i]);
+  }
+
+  // a bit flipped on the way, the crc is still the one the card worked out
+  if(sd_random() < card.options.read_crc_error_probability)
+  {
+    uint16_t bit = sd_random() * length * 8;
+    card.output[card.data_position + 1 + bit / 8] ^= 1 << bit % 8;
+
+    card.statistics.crc_errors++;
+  }
+
+  uint16_t crc = calculate_sd_crc16(data, length);
+  sd_queue_output(crc >> 8);
+  sd_queue_output(crc);
+}
+
+bool sd_read_image_block(uint32_t block, uint8_t* data)
+{
+  memset(data, 0, SD_CARD_BLOCK_SIZE);
+
+  if(fseek(card.image, (long)block * SD_CARD_BLOCK_SIZE, SEEK_SET) != 0)
+  {
+    return false;
+  }
+
+  // past the end of the image is a block that was never written
+  fread(data, 1, SD_CARD_BLOCK_SIZE, card.image);
+
+  return true;
+}
+
+bool sd_write_image_block(uint32_t block, const uint8_t* data)
+{
+  if(fseek(card.image, (long)block * SD_CARD_BLOCK_SIZE, SEEK_SET) != 0)
+  {
+    return false;
+  }
+
+  bool written = fwrite(data, SD_CARD_BLOCK_SIZE, 1, card.image) == 1;
+  fflush(card.image);
+
+  return written;
+}
+
+void sd_read_block(uint32_t block)
+{
+  if(block >= card.options.block_count)
+  {
+    sd_queue_r1(SD_R1_ADDRESS_ERROR);
+    card.statistics.address_errors++;
+    return;
+  }
+
+  uint8_t data[SD_CARD_BLOCK_SIZE];
+  sd_read_image_block(block, data);
+
+  sd_queue_r1(0);
+  sd_queue_data(data, SD_CARD_BLOCK_SIZE);
+
+  card.statistics.blocks_read++;
+}
+
+// csd version 2, everything but the size is what a typical sdhc card reports
+void sd_read_csd()
+{
+  uint32_t size = card.options.block_count / 1024 - 1; // in 512 KB units
+
+  uint8_t csd[SD_CSD_SIZE] = {0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00, (uint8_t)(size >> 16 & 0x3F), (uint8_t)(size >> 8), (uint8_t)size,
+      0x7F, 0x80, 0x0A, 0x40, 0x00, 0x00};
+
+  csd[SD_CSD_SIZE - 1] = calculate_sd_crc7(csd, SD_CSD_SIZE - 1) << 1 | 1;
+
+  sd_queue_r1(0);
+  sd_queue_data(csd, SD_CSD_SIZE);
+}
+
+void sd_start_write(uint32_t block, uint8_t token_phase)
+{
+  if(block >= card.options.block_count)
+  {
+    sd_queue_r1(SD_R1_ADDRESS_ERROR);
+    card.statistics.address_errors++;
+    return;
+  }
+
+  sd_queue_r1(0);
+
+  card.write_block = block;
+  card.phase = token_phase;
+}
+
+void sd_run_command()
+{
+  uint8_t index = card.command[0] & 0x3F;
+  uint32_t argument = (uint32_t)card.command[1] << 24 | (uint32_t)card.command[2] << 16 | (uint32_t)card.command[3] << 8 | card.command[4];
+
+  bool application_command = card.application_command;
+  card.application_command = false;
+
+  sd_clear_output();
+  sd_queue_output(0xFF); // a byte of command response time
+
+  // spi mode only checks the crc of these two, the rest wait for CMD59 to turn it on (the driver never does)
+  if((index == 0 || index == 8) && card.command[5] != (calculate_sd_crc7(card.command, SD_COMMAND_SIZE - 1) << 1 | 1))
+  {
+    sd_queue_r1(SD_R1_COMMAND_CRC_ERROR);
+    return;
+  }
+
+  if(index == 0)
+  {
+    card.idle = true;
+    card.initialization_polls = 0;
+    sd_queue_r1(0);
+  }
+  else if(index == 8)
+  {
+    // echoes the voltage & the check pattern back
+    sd_queue_r1(0);
+    sd_queue_uint32(argument & 0xFFF);
+  }
+  else if(index == 55)
+  {
+    card.application_command = true;
+    sd_queue_r1(0);
+  }
+  else if(index == 41 && application_command)
+  {
+    card.idle = ++card.initialization_polls < card.options.initialization_polls;
+    sd_queue_r1(0);
+  }
+  else if(index == 58)
+  {
+    sd_queue_r1(0);
+    sd_queue_uint32(card.idle ? SD_OCR : SD_OCR | SD_OCR_POWERED_UP | SD_OCR_HIGH_CAPACITY);
+  }
+  else if(card.idle)
+  {
+    sd_queue_r1(SD_R1_ILLEGAL_COMMAND); // the rest need the initialization done
+  }
+  else if(index == 9)
+  {
+    sd_read_csd();
+  }
+  else if(index == 17)
+  {
+    sd_read_block(argument);
+  }
+  else if(index == 24)
+  {
+    sd_start_write(argument, sd_card_phase::sd_waiting_for_write_token);
+  }
+  else if(index == 25)
+  {
+    sd_start_write(argument, sd_card_phase::sd_waiting_for_multiple_write_token);
+  }
+  else
+  {
+    sd_queue_r1(SD_R1_ILLEGAL_COMMAND);
+  }
+}
+
+void sd_start_busy(uint32_t duration)
+{
+  card.busy = true;
+  card.busy_until = sd_get_time_us() + duration;
+}
+
+// the power goes while the block is being programmed, some of it made it & the card is gone until a power cycle
+void sd_lose_power()
+{
+  uint8_t data[SD_CARD_BLOCK_SIZE];
+  sd_read_image_block(card.write_block, data);
+
+  int16_t torn_bytes = card.options.power_loss_torn_bytes;
+
+  if(torn_bytes < 0 || torn_bytes > SD_CARD_BLOCK_SIZE)
+  {
+    torn_bytes = sd_random() * (SD_CARD_BLOCK_SIZE + 1);
+  }
+
+  memcpy(data, card.write_data, torn_bytes);
+  sd_write_image_block(card.write_block, data);
+
+  card.statistics.powered = false;
+  sd_clear_output();
+}
+
+void sd_program_block()
+{
+  bool multiple = card.phase == sd_card_phase::sd_receiving_multiple_write_data;
+
+  card.phase = multiple ? sd_card_phase::sd_waiting_for_multiple_write_token : sd_card_phase::sd_waiting_for_command;
+  sd_clear_output();
+
+  if(sd_random() < card.options.write_crc_error_probability)
+  {
+    sd_queue_output(SD_DATA_CRC_ERROR);
+    card.statistics.crc_errors++;
+
+    // that's the end of a multiple block write too, the host stops it with CMD12
+    card.phase = sd_card_phase::sd_waiting_for_command;
+    return;
+  }
+
+  card.statistics.blocks_programmed++;
+
+  if(card.statistics.blocks_programmed == card.options.power_loss_at_write)
+  {
+    sd_lose_power();
+    return;
+  }
+
+  if(!sd_write_image_block(card.write_block, card.write_data))
+  {
+    sd_queue_output(SD_DATA_WRITE_ERROR);
+    card.phase = sd_card_phase::sd_waiting_for_command;
+    return;
+  }
+
+  uint32_t duration = card.options.write_latency_min_us + sd_random() * (card.options.write_latency_max_us - card.options.write_latency_min_us);
+
+  if(sd_random() < card.options.stall_probability)
+  {
+    duration = card.options.stall_us;
+    card.statistics.stalls++;
+  }
+
+  card.statistics.longest_write_us = duration > card.statistics.longest_write_us ? duration : card.statistics.longest_write_us;
+  card.statistics.blocks_written++;
+
+  sd_queue_output(SD_DATA_ACCEPTED);
+  sd_start_busy(duration);
+
+  card.write_block++; // the next one of a multiple block write
+}
+
+void sd_receive_byte(uint8_t value)
+{
+  if(card.phase == sd_card_phase::sd_waiting_for_command)
+  {
+    // every command starts with a 0 then a 1 bit, anything else is the host clocking out a response.
+    // a busy card isn't listening
+    if((value & 0xC0) == 0x40 && !card.busy)
+    {
+      card.command[0] = value;
+      card.command_length = 1;
+      card.phase = sd_card_phase::sd_receiving_command;
+    }
+  }
+  else if(card.phase == sd_card_phase::sd_receiving_command)
+  {
+    card.command[card.command_length++] = value;
+
+    if(card.command_length == SD_COMMAND_SIZE)
+    {
+      card.phase = sd_card_phase::sd_waiting_for_command;
+      sd_run_command();
+    }
+  }
+  else if(card.phase == sd_card_phase::sd_waiting_for_write_token || card.phase == sd_card_phase::sd_waiting_for_multiple_write_token)
+  {
+    bool multiple = card.phase == sd_card_phase::sd_waiting_for_multiple_write_token;
+
+    if(card.busy)
+    {
+      return;
+    }
+
+    if(value == (multiple ? SD_MULTIPLE_WRITE_TOKEN : SD_DATA_TOKEN))
+    {
+      card.write_length = 0;
+      card.phase = multiple ? sd_card_phase::sd_receiving_multiple_write_data : sd_card_phase::sd_receiving_write_data;
+    }
+    else if(multiple && value == SD_STOP_TRANSMISSION_TOKEN)
+    {
+      card.phase = sd_card_phase::sd_waiting_for_command;
+      sd_clear_output();
+      sd_start_busy(SD_STOP_BUSY_US);
+    }
+    else if((value & 0xC0) == 0x40)
+    {
+      // a command instead of the data
+      card.phase = sd_card_phase::sd_waiting_for_command;
+      sd_receive_byte(value);
+    }
+  }
+  else
+  {
+    card.write_data[card.write_length++] = value;
+
+    if(card.write_length == sizeof(card.write_data))
+    {
+      sd_program_block();
+    }
+  }
+}
+
+// --------------------------------------
+// sd_card.h
+
+bool sd_card_open(const char* image_path, const sd_card_options& options)
+{
+  sd_card_close();
+
+  card.image = fopen(image_path, "r+b");
+
+  if(!card.image)
+  {
+    card.image = fopen(image_path, "w+b");
+  }
+
+  sd_card_set_options(options);
+  card.random_state = 0x9E3779B97F4A7C15ULL ^ options.seed;
+  card.statistics.powered = card.image != nullptr;
+
+  return card.image != nullptr;
+}
+
+void sd_card_close()
+{
+  if(card.image)
+  {
+    fclose(card.image);
+  }
+
+  card = sd_card {};
+}
+
+void sd_card_set_options(const sd_card_options& options)
+{
+  card.options = options;
+}
+
+void sd_card_power_cycle()
+{
+  // everything the card was doing is gone, the image & the counters stay
+  sd_card fresh;
+  fresh.image = card.image;
+  fresh.options = card.options;
+  fresh.statistics = card.statistics;
+  fresh.statistics.powered = card.image != nullptr;
+  fresh.random_state = card.random_state;
+  fresh.transfers = card.transfers;
+
+  card = fresh;
+}
+
+void sd_card_select(bool selected)
+{
+  card.selected = selected;
+
+  // a command that was cut off is dropped
+  if(!selected && card.phase == sd_card_phase::sd_receiving_command)
+  {
+    card.phase = sd_card_phase::sd_waiting_for_command;
+  }
+}
+
+uint8_t sd_card_transfer(uint8_t value)
+{
+  card.transfers++;
+
+  if(!card.selected || !card.statistics.powered)
+  {
+    return 0xFF; // the card lets go of the bus
+  }
+
+  if(card.busy && sd_has_time_passed(card.busy_until))
+  {
+    card.busy = false;
+  }
+
+  uint8_t output = 0xFF;
+
+  if(card.output_position < card.output_length)
+  {
+    // a data block is 0xFF until the card has read it
+    if(card.data_position == 0 || card.output_position < card.data_position || sd_has_time_passed(card.data_ready_at))
+    {
+      output = card.output[card.output_position++];
+    }
+  }
+  else if(card.busy)
+  {
+    output = 0x00;
+  }
+
+  sd_receive_byte(value);
+
+  return output;
+}
+
+const sd_card_statistics& sd_card_get_statistics()
+{
+  return card.statistics;
+}
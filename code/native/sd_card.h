@@ -0,0 +1,72 @@
+// --------------------------------------------
+// Freezer X Controller - Virtual SD Card
+// --------------------------------------------
+
+// a high capacity card in spi mode, a byte each way per transfer like the real bus, backed by an image file so the
+// card can be read back (or replayed, see native/replay.cpp) afterwards. it speaks CMD0, CMD8, CMD55 & ACMD41 to
+// start, CMD58 & CMD9 for the registers, CMD17 to read a block, CMD24 to write one and CMD25 to write a run of them.
+//
+// the timings are the card's, not the bus's: a block takes a while to read & to program, and some writes stall for
+// a lot longer while the card cleans up after itself. on top of that it can answer with crc errors, refuse anything
+// past its capacity & lose power half way through programming a block.
+//
+// there's a single card, like on the board, whoever owns the bus (native/hil.cpp, native/logger.cpp) forwards the cs
+// line & the bytes
+
+#pragma once
+
+#include <stdint.h>
+
+const uint16_t SD_CARD_BLOCK_SIZE = 512;
+const uint32_t SD_CARD_DEFAULT_BLOCKS = 8UL * 1024 * 1024 * 2; // 8 GB
+
+struct sd_card_options
+{
+  uint32_t block_count = SD_CARD_DEFAULT_BLOCKS; // the capacity, anything past it is an address error
+
+  uint8_t initialization_polls = 1; // ACMD41s answered with idle before the card is ready
+
+  uint32_t read_latency_us = 100; // from CMD17 / CMD9 to the data token
+  uint32_t write_latency_min_us = 500; // programming a block, uniform between the two
+  uint32_t write_latency_max_us = 2000;
+  float stall_probability = 0; // of a write taking stall_us instead
+  uint32_t stall_us = 250000;
+
+  float write_crc_error_probability = 0; // a block answered with a crc error & not written
+  float read_crc_error_probability = 0; // a block garbled on the way, only its crc tells
+
+  uint32_t power_loss_at_write = 0; // the nth block programmed since the card was opened loses power, 0 never
+  int16_t power_loss_torn_bytes = -1; // how much of that block makes it, -1 picks at random
+
+  uint32_t seed = 1;
+
+  // the card's clock, busy & latency times are measured on it. without one every transfer counts as a byte at 250 kHz
+  uint32_t (*clock_us)() = nullptr;
+};
+
+struct sd_card_statistics
+{
+  uint32_t blocks_read = 0;
+  uint32_t blocks_written = 0;
+  uint32_t blocks_programmed = 0; // written or torn, what power_loss_at_write counts
+  uint32_t crc_errors = 0; // injected, both ways
+  uint32_t address_errors = 0;
+  uint32_t stalls = 0;
+  uint32_t longest_write_us = 0;
+  bool powered = false;
+};
+
+// the image is created if it doesn't exist, blocks past its end read as zeros until they're written
+bool sd_card_open(const char* image_path, const sd_card_options& options = sd_card_options {});
+void sd_card_close();
+
+// takes effect from the next command, like power_loss_at_write for another cut
+void sd_card_set_options(const sd_card_options& options);
+
+// after a power loss the card stays dead until this, which leaves it like it was just plugged in
+void sd_card_power_cycle();
+
+void sd_card_select(bool selected); // the cs line is active low, so selected is cs LOW
+uint8_t sd_card_transfer(uint8_t value); // the byte from the host in, the card's byte out
+
+const sd_card_statistics& sd_card_get_statistics();
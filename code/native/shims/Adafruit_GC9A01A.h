@@ -0,0 +1,58 @@
+// --------------------------------------------
+// Freezer X Controller - Host Display Shim
+// --------------------------------------------
+
+// the display isn't part of the control core, on the host everything drawn is dropped
+
+#pragma once
+
+#include <Arduino.h>
+
+#define GC9A01A_BLACK 0x0000
+#define GC9A01A_NAVY 0x000F
+#define GC9A01A_DARKGREEN 0x03E0
+#define GC9A01A_DARKCYAN 0x03EF
+#define GC9A01A_MAROON 0x7800
+#define GC9A01A_PURPLE 0x780F
+#define GC9A01A_OLIVE 0x7BE0
+#define GC9A01A_LIGHTGREY 0xC618
+#define GC9A01A_DARKGREY 0x7BEF
+#define GC9A01A_BLUE 0x001F
+#define GC9A01A_GREEN 0x07E0
+#define GC9A01A_CYAN 0x07FF
+#define GC9A01A_RED 0xF800
+#define GC9A01A_MAGENTA 0xF81F
+#define GC9A01A_YELLOW 0xFFE0
+#define GC9A01A_WHITE 0xFFFF
+#define GC9A01A_ORANGE 0xFD20
+#define GC9A01A_GREENYELLOW 0xAFE5
+#define GC9A01A_PINK 0xFC18
+
+class Adafruit_GC9A01A
+{
+public:
+  Adafruit_GC9A01A(int8_t cs, int8_t dc, int8_t rst) {}
+
+  void begin() {}
+  void setRotation(uint8_t rotation) {}
+  void fillScreen(uint16_t color) {}
+  void setTextWrap(bool wrap) {}
+  void setTextSize(uint8_t size) {}
+  void setTextColor(uint16_t color, uint16_t background) {}
+  void setCursor(int16_t x, int16_t y) {}
+  void print(const char* text) {}
+  void drawCircle(int16_t x, int16_t y, int16_t radius, uint16_t color) {}
+  void fillCircle(int16_t x, int16_t y, int16_t radius, uint16_t color) {}
+  void fillRect(int16_t x, int16_t y, int16_t width, int16_t height, uint16_t color) {}
+
+  void getTextBounds(const char* text, int16_t x, int16_t y, int16_t* x1, int16_t* y1, uint16_t* width, uint16_t* height)
+  {
+    *x1 = x;
+    *y1 = y;
+    *width = 0;
+    *height = 0;
+  }
+
+  int16_t width() { return 240; }
+  int16_t height() { return 240; }
+};
@@ -0,0 +1,77 @@
+// --------------------------------------------
+// Freezer X Controller - Host Arduino Shim
+// --------------------------------------------
+
+// just the types, constants & helpers main.cpp uses from the arduino core. the hardware calls (millis, digitalWrite,
+// analogRead, EEPROM, ...) are deliberately missing, everything has to go through hal.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+// the analog pins of the micro (leonardo variant)
+#define A0 18
+#define A1 19
+#define A2 20
+#define A3 21
+#define A4 22
+#define A5 23
+#define A6 24
+#define A7 25
+#define A8 26
+#define A9 27
+#define A10 28
+#define A11 29
+
+// there's no separate program memory on the host, the flash strings & tables are plain ones
+#define PROGMEM
+#define F(x) x
+#define PSTR(x) x
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define sprintf_P sprintf
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// the interrupt number is the pin, the harness triggers it with hal_native_trigger_interrupt()
+#define digitalPinToInterrupt(pin) (pin)
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int mode);
+
+long random(long max_value);
+long random(long min_value, long max_value);
+void randomSeed(unsigned long seed);
+
+char* dtostrf(double value, signed char width, unsigned char precision, char* buffer);
+
+inline char* itoa(int value, char* buffer, int base)
+{
+  sprintf(buffer, base == 16 ? "%x" : "%d", value);
+  return buffer;
+}
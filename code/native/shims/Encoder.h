@@ -0,0 +1,19 @@
+// --------------------------------------------
+// Freezer X Controller - Host Encoder Shim
+// --------------------------------------------
+
+#pragma once
+
+#include <Arduino.h>
+
+// set by the harness with hal_native_set_encoder()
+extern int32_t hal_native_encoder_position;
+
+class Encoder
+{
+public:
+  Encoder(uint8_t pin_1, uint8_t pin_2) {}
+
+  int32_t read() { return hal_native_encoder_position; }
+  void write(int32_t position) { hal_native_encoder_position = position; }
+};
@@ -0,0 +1,21 @@
+// --------------------------------------------
+// Freezer X Controller - Host RTC Shim
+// --------------------------------------------
+
+// the rtc is disabled in the firmware, these are only here so the globals compile
+
+#pragma once
+
+#include <Arduino.h>
+
+class ThreeWire
+{
+public:
+  ThreeWire(uint8_t io, uint8_t clk, uint8_t ce) {}
+};
+
+template<typename T> class RtcDS1302
+{
+public:
+  RtcDS1302(T& wire) {}
+};
@@ -0,0 +1,34 @@
+// --------------------------------------------
+// Freezer X Controller - Host SPI Shim
+// --------------------------------------------
+
+#pragma once
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+// the bus is in hal_native.cpp, a harness attaches a device (like an sd card model) with hal_native_attach_spi_device()
+extern uint32_t hal_native_spi_clock;
+uint8_t hal_native_spi_transfer(uint8_t data);
+
+class SPISettings
+{
+public:
+  SPISettings(uint32_t clock, uint8_t bit_order, uint8_t data_mode) : clock(clock) {}
+
+  uint32_t clock;
+};
+
+class SPIClass
+{
+public:
+  void begin() {}
+  void beginTransaction(SPISettings settings) { hal_native_spi_clock = settings.clock; }
+  void endTransaction() {}
+
+  uint8_t transfer(uint8_t data) { return hal_native_spi_transfer(data); }
+};
+
+extern SPIClass SPI;
@@ -0,0 +1,424 @@
+// --------------------------------------------
+// Freezer X Controller - Thermal Simulator
+// --------------------------------------------
+
+// runs the unmodified firmware against a model of the freezer on the virtual clock, a simulated second per loop(),
+// so a year takes seconds to a minute. the model is a few lumped thermal masses (cabinet air, contents, evaporator
+// and compressor shell) with random door openings, daily & seasonal ambient swings and power cuts.
+//
+// a power cut resets the controller like it would on the board: the model is saved & the program starts itself again,
+// so every global in main.cpp starts over and only the eeprom carries across.
+//
+// usage: program [--days N] [--seed N] [--target C] [--mode timed|band] [--hysteresis S] [--cut-in C] [--cut-out C]
+//                [--dead-time M] [--min-run M] [--doors N/day] [--power-cuts N/year] [--ambient C] [--band C]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/main.cpp"
+
+#include "hal_native.h"
+
+// --------------------------------------
+// Model Constants
+
+// time constants in seconds, roughly a 100 liter chest freezer half full
+const double EVAPORATOR_PULL_DOWN_TAU = 300; // towards the saturation temperature while running
+const double EVAPORATOR_SATURATION = -30;
+const double EVAPORATOR_WARM_UP_TAU = 600; // towards the air while off
+const double AIR_EVAPORATOR_TAU = 1200;
+const double AIR_CONTENTS_TAU = 1800;
+const double CONTENTS_AIR_TAU = 40000; // the contents are a lot heavier than the air
+const double AIR_LEAK_TAU = 20000; // through the walls
+const double AIR_DOOR_TAU = 120; // while the door is open
+const double COMPRESSOR_TAU = 600;
+const double COMPRESSOR_RISE = 35; // over ambient while running
+const double CABINET_PROBE_TAU = 90; // the probe sits in a sleeve
+
+const double NTC_BETA = 3950;
+const double NTC_SERIES_RESISTOR = 10000;
+const double CABINET_NTC_R25 = 10000;
+const double COMPRESSOR_NTC_R25 = 100000;
+const double ADC_NOISE = 0.7; // lsb
+
+const uint32_t MIN_DOOR_OPENING = 10; // seconds
+const uint32_t MAX_DOOR_OPENING = 60;
+const uint32_t MIN_POWER_CUT = 5 * 60;
+const uint32_t MAX_POWER_CUT = 4 * 60 * 60;
+
+const uint32_t SHORT_RUN = 60; // seconds, the min runtime should make these rare
+
+const uint32_t SECONDS_PER_DAY = 24UL * 60 * 60;
+
+// --------------------------------------
+// Simulation
+
+struct simulation_options
+{
+  uint32_t days = 365;
+  uint32_t seed = 1;
+
+  // only applied to the config on the first boot, after that it's whatever the eeprom has like on the board
+  double target = -18;
+  int16_t hysteresis_mode = hysteresis_mode::timed_hysteresis;
+  int16_t hysteresis_time = -1; // -1 keeps the firmware default
+  double cut_in = -1;
+  double cut_out = -1;
+  int16_t dead_time = -1;
+  int16_t min_run_time = -1;
+
+  double doors_per_day = 8;
+  double power_cuts_per_year = 6;
+  double ambient = 25; // mean, it swings 3 a day & 5 over the year
+  double band = 3; // out of band is further than this from the target
+};
+
+struct simulation_results
+{
+  uint32_t seconds = 0;
+  uint32_t on_seconds = 0;
+  uint32_t starts = 0;
+  uint32_t short_runs = 0; // under SHORT_RUN
+  uint32_t out_of_band_seconds = 0;
+  double air_sum = 0;
+  double air_min = 100;
+  double air_max = -100;
+  double watt_hours = 0;
+  uint32_t door_openings = 0;
+  uint32_t power_cuts = 0;
+  uint32_t alarms = 0;
+};
+
+// everything that survives a power cut, written to a file before the program starts itself again
+struct simulation
+{
+  simulation_options options;
+  simulation_results results;
+
+  uint64_t random_state = 0;
+
+  double air = -18;
+  double contents = -18;
+  double evaporator = -18;
+  double compressor = 25;
+  double probe = -18;
+
+  bool compressor_on = false;
+  uint32_t run_started_at = 0;
+  uint8_t alarms_active = 0;
+
+  uint32_t door_open_until = 0;
+  uint32_t power_back_at = 0;
+  bool configured = false;
+
+  uint8_t storage[HAL_NATIVE_STORAGE_SIZE];
+};
+
+simulation sim;
+
+// xorshift, so the random state is just a number in the saved simulation
+double random_uniform()
+{
+  sim.random_state ^= sim.random_state << 13;
+  sim.random_state ^= sim.random_state >> 7;
+  sim.random_state ^= sim.random_state << 17;
+
+  return (sim.random_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// triangular, close enough to a normal for adc noise & a lot cheaper since the firmware oversamples every reading
+double random_noise()
+{
+  return (random_uniform() + random_uniform() - 1) * 2.449; // a standard deviation of 1
+}
+
+double get_ambient(uint32_t second)
+{
+  double day = (double)second / SECONDS_PER_DAY;
+
+  // warmest in the afternoon & in the middle of the year
+  return sim.options.ambient + 3 * sin(2 * M_PI * (day - 0.375)) + 5 * sin(2 * M_PI * (day / 365 - 0.25));
+}
+
+// the adc code without the noise, worked out once per step
+double cabinet_adc = 0;
+double compressor_adc = 0;
+
+double temperature_to_adc(double temperature, double r25)
+{
+  double resistance = r25 * exp(NTC_BETA * (1 / (temperature + 273.15) - 1 / 298.15));
+
+  return 1023 * resistance / (resistance + NTC_SERIES_RESISTOR);
+}
+
+uint16_t read_model_adc(uint8_t pin)
+{
+  double code = 0;
+
+  if(pin == THERMISTOR_1_PIN)
+  {
+    code = cabinet_adc + random_noise() * ADC_NOISE;
+  }
+  else if(pin == THERMISTOR_2_PIN)
+  {
+    code = compressor_adc + random_noise() * ADC_NOISE;
+  }
+
+  return code < 0 ? 0 : code > 1023 ? 1023 : (uint16_t)(code + 0.5);
+}
+
+void step_model(uint32_t second, bool powered)
+{
+  double ambient = get_ambient(second);
+  bool on = powered && hal_native_get_digital(COMPRESSOR_RELAY);
+
+  sim.evaporator += on ? (EVAPORATOR_SATURATION - sim.evaporator) / EVAPORATOR_PULL_DOWN_TAU : (sim.air - sim.evaporator) / EVAPORATOR_WARM_UP_TAU;
+  sim.air += (sim.evaporator - sim.air) / AIR_EVAPORATOR_TAU + (sim.contents - sim.air) / AIR_CONTENTS_TAU + (ambient - sim.air) / AIR_LEAK_TAU;
+  sim.contents += (sim.air - sim.contents) / CONTENTS_AIR_TAU;
+  sim.compressor += ((on ? ambient + COMPRESSOR_RISE : ambient) - sim.compressor) / COMPRESSOR_TAU;
+
+  if(second < sim.door_open_until)
+  {
+    sim.air += (ambient - sim.air) / AIR_DOOR_TAU;
+  }
+  else if(random_uniform() < sim.options.doors_per_day / SECONDS_PER_DAY)
+  {
+    sim.door_open_until = second + MIN_DOOR_OPENING + random_uniform() * (MAX_DOOR_OPENING - MIN_DOOR_OPENING);
+    sim.results.door_openings++;
+  }
+
+  sim.probe += (sim.air - sim.probe) / CABINET_PROBE_TAU;
+
+  cabinet_adc = temperature_to_adc(sim.probe, CABINET_NTC_R25);
+  compressor_adc = temperature_to_adc(sim.compressor, COMPRESSOR_NTC_R25);
+
+  simulation_results& results = sim.results;
+
+  if(on && !sim.compressor_on)
+  {
+    results.starts++;
+    sim.run_started_at = second;
+  }
+  else if(!on && sim.compressor_on && second - sim.run_started_at < SHORT_RUN)
+  {
+    results.short_runs++;
+  }
+
+  sim.compressor_on = on;
+
+  results.seconds++;
+  results.on_seconds += on;
+  results.watt_hours += on ? active_config.compressor_power / 3600.0 : 0;
+  results.out_of_band_seconds += fabs(sim.air - sim.options.target) > sim.options.band;
+  results.air_sum += sim.air;
+  results.air_min = min(results.air_min, sim.air);
+  results.air_max = max(results.air_max, sim.air);
+}
+
+// the options only go into the config on the very first boot, the firmware saves it to the eeprom from there
+void configure_firmware()
+{
+  const simulation_options& options = sim.options;
+
+  dirty_config.target_temperature = centi_degrees(lround(options.target * 100));
+  dirty_config.hysteresis_mode = options.hysteresis_mode;
+
+  if(options.hysteresis_time >= 0)
+  {
+    dirty_config.target_temperature_hysteresis_time = options.hysteresis_time;
+  }
+
+  if(options.cut_in >= 0)
+  {
+    dirty_config.cut_in_offset = centi_degrees(lround(options.cut_in * 100));
+  }
+
+  if(options.cut_out >= 0)
+  {
+    dirty_config.cut_out_offset = centi_degrees(lround(options.cut_out * 100));
+  }
+
+  if(options.dead_time >= 0)
+  {
+    dirty_config.compressor_dead_time = options.dead_time;
+  }
+
+  if(options.min_run_time >= 0)
+  {
+    dirty_config.compressor_min_run_time = options.min_run_time;
+  }
+
+  save_dirty_config();
+  active_config = dirty_config;
+
+  sim.configured = true;
+}
+
+// a power cut resets the controller, so the program starts over with the saved simulation
+void restart(const char* state_path)
+{
+  memcpy(sim.storage, hal_native_storage(), HAL_NATIVE_STORAGE_SIZE);
+
+  FILE* file = fopen(state_path, "wb");
+
+  if(!file || fwrite(&sim, sizeof(sim), 1, file) != 1)
+  {
+    fprintf(stderr, "can't save the simulation to %s\n", state_path);
+    exit(1);
+  }
+
+  fclose(file);
+
+  char resume_argument[] = "--resume";
+  char* arguments[] = {(char*)"simulator", resume_argument, (char*)state_path, nullptr};
+
+  execv("/proc/self/exe", arguments);
+
+  fprintf(stderr, "can't restart the simulator\n");
+  exit(1);
+}
+
+bool resume(const char* state_path)
+{
+  FILE* file = fopen(state_path, "rb");
+
+  if(!file)
+  {
+    return false;
+  }
+
+  bool loaded = fread(&sim, sizeof(sim), 1, file) == 1;
+  fclose(file);
+
+  memcpy(hal_native_storage(), sim.storage, HAL_NATIVE_STORAGE_SIZE);
+
+  return loaded;
+}
+
+void parse_options(int argc, char** argv)
+{
+  simulation_options& options = sim.options;
+
+  for(int i = 1; i + 1 < argc; i += 2)
+  {
+    const char* name = argv[i];
+    const char* value = argv[i + 1];
+
+    if(strcmp(name, "--days") == 0) options.days = strtoul(value, nullptr, 10);
+    else if(strcmp(name, "--seed") == 0) options.seed = strtoul(value, nullptr, 10);
+    else if(strcmp(name, "--target") == 0) options.target = atof(value);
+    else if(strcmp(name, "--mode") == 0) options.hysteresis_mode = strcmp(value, "band") == 0 ? hysteresis_mode::band_hysteresis : hysteresis_mode::timed_hysteresis;
+    else if(strcmp(name, "--hysteresis") == 0) options.hysteresis_time = atoi(value);
+    else if(strcmp(name, "--cut-in") == 0) options.cut_in = atof(value);
+    else if(strcmp(name, "--cut-out") == 0) options.cut_out = atof(value);
+    else if(strcmp(name, "--dead-time") == 0) options.dead_time = atoi(value);
+    else if(strcmp(name, "--min-run") == 0) options.min_run_time = atoi(value);
+    else if(strcmp(name, "--doors") == 0) options.doors_per_day = atof(value);
+    else if(strcmp(name, "--power-cuts") == 0) options.power_cuts_per_year = atof(value);
+    else if(strcmp(name, "--ambient") == 0) options.ambient = atof(value);
+    else if(strcmp(name, "--band") == 0) options.band = atof(value);
+    else
+    {
+      fprintf(stderr, "unknown option %s\n", name);
+      exit(1);
+    }
+  }
+
+  sim.random_state = 0x9E3779B97F4A7C15ULL ^ options.seed;
+  sim.air = sim.contents = sim.evaporator = sim.probe = options.target;
+}
+
+void print_results()
+{
+  const simulation_results& results = sim.results;
+  double days = results.seconds / (double)SECONDS_PER_DAY;
+
+  printf("days:            %.1f\n", days);
+  printf("cycles / day:    %.1f\n", results.starts / days);
+  printf("short runs:      %lu\n", (unsigned long)results.short_runs);
+  printf("duty:            %.1f%%\n", 100.0 * results.on_seconds / results.seconds);
+  printf("energy:          %.2f kWh / day\n", results.watt_hours / 1000 / days);
+  printf("air:             %.2f mean, %.2f min, %.2f max\n", results.air_sum / results.seconds, results.air_min, results.air_max);
+  printf("out of band:     %.2f%% (further than %.1f from %.1f)\n", 100.0 * results.out_of_band_seconds / results.seconds, sim.options.band, sim.options.target);
+  printf("door openings:   %lu\n", (unsigned long)results.door_openings);
+  printf("power cuts:      %lu\n", (unsigned long)results.power_cuts);
+  printf("alarms raised:   %lu\n", (unsigned long)results.alarms);
+}
+
+int main(int argc, char** argv)
+{
+  char state_path[] = "/tmp/freezer-simulation-XXXXXX";
+  bool resumed = argc == 3 && strcmp(argv[1], "--resume") == 0;
+
+  if(resumed)
+  {
+    strcpy(state_path, argv[2]);
+
+    if(!resume(state_path))
+    {
+      fprintf(stderr, "can't resume the simulation from %s\n", state_path);
+      return 1;
+    }
+  }
+  else
+  {
+    parse_options(argc, argv);
+
+    int file = mkstemp(state_path);
+    close(file);
+  }
+
+  hal_native_analog_read = read_model_adc;
+
+  cabinet_adc = temperature_to_adc(sim.probe, CABINET_NTC_R25);
+  compressor_adc = temperature_to_adc(sim.compressor, COMPRESSOR_NTC_R25);
+
+  uint32_t end = sim.options.days * SECONDS_PER_DAY;
+
+  // sitting out the rest of the power cut, the firmware only starts again once it's back
+  while(sim.results.seconds < end && sim.results.seconds < sim.power_back_at)
+  {
+    step_model(sim.results.seconds, false);
+  }
+
+  setup();
+
+  if(!sim.configured)
+  {
+    configure_firmware();
+  }
+
+  while(sim.results.seconds < end)
+  {
+    hal_native_advance(1000);
+    loop();
+
+    if(current_state.alarms_active & ~sim.alarms_active)
+    {
+      sim.results.alarms++;
+    }
+
+    sim.alarms_active = current_state.alarms_active;
+
+    step_model(sim.results.seconds, true);
+
+    if(random_uniform() < sim.options.power_cuts_per_year / (365.0 * SECONDS_PER_DAY))
+    {
+      sim.results.power_cuts++;
+      sim.power_back_at = sim.results.seconds + MIN_POWER_CUT + random_uniform() * (MAX_POWER_CUT - MIN_POWER_CUT);
+      sim.compressor_on = false;
+      sim.alarms_active = 0;
+
+      restart(state_path);
+    }
+  }
+
+  print_results();
+
+  unlink(state_path);
+
+  return 0;
+}
@@ -5,13 +5,38 @@
 
 #include <Arduino.h>
 #include <Adafruit_GC9A01A.h>
-#include <EEPROM.h>
 #include <Encoder.h>
-#include <NTC_Thermistor.h>
 #include <RtcDS1302.h>
 #include <SPI.h>
-#include <Thermistor.h>
-#include <avr/wdt.h>
+
+#include "hal.h"
+
+// --------------------------------------
+// Features
+
+// the micro only has 28 KB for the firmware, and the arduino core & the display, rtc and encoder libraries take
+// a good part of it. the thermostat, the probe checks, the fallback cycling and the compressor protections are
+// always built in, everything else is only built in with its flag. platformio.ini turns them all on for the host
+// builds (but the replay) and the tests, add the ones you want to the micro's build_flags (the README has what each
+// one costs). mostly only the calls are left out, the linker drops the functions once nothing calls them
+//
+// WITH_CALIBRATION      the calibration wizard & screen, without it the probes use their datasheet curves
+// WITH_ESTIMATOR        control on the observer's estimate of the air instead of the cabinet probe
+// WITH_THERMAL_MODEL    learning the coast after a stop & cutting off early in the band mode
+// WITH_STARTUP_JITTER   the random extra startup delay
+// WITH_DEMAND_RESPONSE  deferring starts on the demand response input
+// WITH_STATISTICS       the duty & energy counters and their screen
+// WITH_LOAD_EVENTS      starting early on a door opening or warm stock
+// WITH_BOOST            the long press boost
+// WITH_DEFROST          the timed & adaptive defrost
+// WITH_PROFILES         the three profiles & their screen, without it the standard one is the config
+// WITH_ALARMS           the high & low temperature alarms
+// WITH_HEALTH           the compressor health score on the info screen
+
+// both go by the estimated rate, which is 0 without the estimator
+#if (defined(WITH_THERMAL_MODEL) || defined(WITH_LOAD_EVENTS)) && !defined(WITH_ESTIMATOR)
+#error "WITH_THERMAL_MODEL and WITH_LOAD_EVENTS need WITH_ESTIMATOR"
+#endif
 
 // --------------------------------------
 // Pins
@@ -20,6 +45,11 @@
 const int THERMISTOR_1_PIN = A8;
 const int THERMISTOR_2_PIN = A9;
 
+// spare adc pins, these are shared with the (disabled) rtc
+// they can be used for extra probes like the evaporator or ambient temperature
+const int SPARE_ADC_1_PIN = A6; // RTC_CLK
+const int SPARE_ADC_2_PIN = A7; // RTC_CE
+
 //// RTC
 const int RTC_CLK = 4;
 const int RTC_IO = 5;
@@ -46,10 +76,63 @@ const int MICRO_SD_SCK = 15;
 // Compressor Relay
 const int COMPRESSOR_RELAY = 18;
 
+// Demand Response
+// a dry contact from the site's energy management, pulling it to ground asks us to avoid starting the compressor.
+// this is RTC_IO, which is free while the rtc is disabled, but the ds1302 still pulls it down with 40k & the internal
+// pull up is about as weak, so open reads as whatever it likes. it needs an external pull up (4.7k to vcc) next to
+// the contact, without one leave the allowance at 0 so the pin is never acted on
+const int DEMAND_RESPONSE_PIN = 5;
+
+// Defrost Relay
+// there is no relay driver for it on the board, set this to a pin with an external driver (a transistor & flyback
+// diode, or a relay module) to switch a defrost heater. the only spare one is 6 (SPARE_ADC_2_PIN / RTC_CE), which
+// drives the ds1302's chip enable along with it, so the rtc can't be turned back on & that pin can't take a probe.
+// the timing & the defrost screen work without it, the compressor is just held off for the defrost
+const int DEFROST_RELAY_PIN = -1;
+
 // LEDs
 const int BLUE_LED_PIN = 0;
 const int RED_LED_PIN = 1;
 
+// Buzzer
+// there is no free pin left on the pro micro, set this to a pin to sound a buzzer along with the alarm pattern
+const int BUZZER_PIN = -1;
+
+// --------------------------------------
+// Temperature
+
+// all temperatures are stored as fixed-point hundredths of a degree celsius (-327.68 .. 327.67)
+// the avr has no fpu, so keeping them as floats meant every comparison, log record and
+// dtostrf() call went through the soft-float library which costs both flash and time.
+// the struct is there to stop raw integers (minutes, seconds, etc.) from being mixed in by accident.
+struct temperature
+{
+  int16_t centi_degrees;
+
+  constexpr bool operator==(temperature other) const { return centi_degrees == other.centi_degrees; }
+  constexpr bool operator!=(temperature other) const { return centi_degrees != other.centi_degrees; }
+  constexpr bool operator<(temperature other) const { return centi_degrees < other.centi_degrees; }
+  constexpr bool operator<=(temperature other) const { return centi_degrees <= other.centi_degrees; }
+  constexpr bool operator>(temperature other) const { return centi_degrees > other.centi_degrees; }
+  constexpr bool operator>=(temperature other) const { return centi_degrees >= other.centi_degrees; }
+
+  constexpr temperature operator+(temperature other) const { return temperature{(int16_t)(centi_degrees + other.centi_degrees)}; }
+  constexpr temperature operator-(temperature other) const { return temperature{(int16_t)(centi_degrees - other.centi_degrees)}; }
+};
+
+constexpr temperature centi_degrees(int16_t value)
+{
+  return temperature{value};
+}
+
+constexpr temperature degrees(int16_t value)
+{
+  return temperature{(int16_t)(value * 100)};
+}
+
+constexpr temperature MIN_REPRESENTABLE_TEMPERATURE = centi_degrees(INT16_MIN);
+constexpr temperature MAX_REPRESENTABLE_TEMPERATURE = centi_degrees(INT16_MAX);
+
 // --------------------------------------
 // Constants
 
@@ -57,30 +140,148 @@ const int RED_LED_PIN = 1;
 // but having them as signed makes it easier for me to have them wrap around in the code.
 
 // Config Menu Constants
-const float MIN_TARGET_TEMPERATURE = -22.0;
-const float MAX_TARGET_TEMPERATURE = -10.0;
-const float TARGET_TEMPERATURE_INCREMENT = 1.0;
+constexpr temperature MIN_TARGET_TEMPERATURE = degrees(-22);
+constexpr temperature MAX_TARGET_TEMPERATURE = degrees(-10);
+constexpr temperature TARGET_TEMPERATURE_INCREMENT = degrees(1);
 
 const int16_t MIN_TARGET_TEMPERATURE_HYSTERESIS_TIME = 5;
 const int16_t MAX_TARGET_TEMPERATURE_HYSTERESIS_TIME = 350;
 const int16_t TARGET_TEMPERATURE_HYSTERESIS_TIME_INCREMENT = 10;
 
+// band mode, the compressor starts above target + cut in and stops below target - cut out
+constexpr temperature MIN_CUT_IN_OFFSET = centi_degrees(20);
+constexpr temperature MAX_CUT_IN_OFFSET = degrees(5);
+constexpr temperature CUT_IN_OFFSET_INCREMENT = centi_degrees(10);
+
+constexpr temperature MIN_CUT_OUT_OFFSET = degrees(0);
+constexpr temperature MAX_CUT_OUT_OFFSET = degrees(5);
+constexpr temperature CUT_OUT_OFFSET_INCREMENT = centi_degrees(10);
+
 const int16_t MIN_COMPRESSOR_DEAD_TIME = 2;
 const int16_t MAX_COMPRESSOR_DEAD_TIME = 20;
 const int16_t COMPRESSOR_DEAD_TIME_INCREMENT = 1;
 
+const int16_t MIN_COMPRESSOR_MIN_RUNTIME = 0; // 0 turns it off
+const int16_t MAX_COMPRESSOR_MIN_RUNTIME = 15;
+const int16_t COMPRESSOR_MIN_RUNTIME_INCREMENT = 1;
+
 const int16_t MIN_COMPRESSOR_MAX_RUNTIME = 60;
 const int16_t MAX_COMPRESSOR_MAX_RUNTIME = 600; // 10 hours ?
 const int16_t COMPRESSOR_MAX_RUNTIME_INCREMENT = 10;
 
-const float MIN_COMPRESSOR_MAX_TEMP = 30.0;
-const float MAX_COMPRESSOR_MAX_TEMP = 60.0;
-const float COMPRESSOR_MAX_TEMP_INCREMENT = 1.0;
+constexpr temperature MIN_COMPRESSOR_MAX_TEMP = degrees(30);
+constexpr temperature MAX_COMPRESSOR_MAX_TEMP = degrees(60);
+constexpr temperature COMPRESSOR_MAX_TEMP_INCREMENT = degrees(1);
 
 const int16_t MIN_FREEZER_STARTUP_DELAY = 0;
 const int16_t MAX_FREEZER_STARTUP_DELAY = 20;
 const int16_t FREEZER_STARTUP_DELAY_INCREMENT = 1;
 
+const int16_t MIN_STARTUP_JITTER = 0; // 0 turns it off
+const int16_t MAX_STARTUP_JITTER = 15;
+const int16_t STARTUP_JITTER_INCREMENT = 1;
+
+const int16_t MIN_COMPRESSOR_POWER = 10;
+const int16_t MAX_COMPRESSOR_POWER = 1500;
+const int16_t COMPRESSOR_POWER_INCREMENT = 10;
+
+constexpr temperature MIN_BOOST_TEMPERATURE = degrees(-35);
+constexpr temperature MAX_BOOST_TEMPERATURE = degrees(-15);
+constexpr temperature BOOST_TEMPERATURE_INCREMENT = degrees(1);
+
+const int16_t MIN_BOOST_DURATION = 30;
+const int16_t MAX_BOOST_DURATION = 720; // 12 hours
+const int16_t BOOST_DURATION_INCREMENT = 30;
+
+// Boost Constants
+// holding the button on the home screen for this long toggles boost
+const uint32_t LONG_PRESS_TIME = 2000;
+
+// while boosting a run may go this much past the configured max runtime, never past the highest the menu allows.
+// the user's limit stays the base since boost also keeps the low alarm & the health scoring quiet
+const int16_t BOOST_MAX_RUNTIME_EXTENSION = 60; // minutes
+
+const int16_t MIN_DEFROST_INTERVAL = 4;
+const int16_t MAX_DEFROST_INTERVAL = 72;
+const int16_t DEFROST_INTERVAL_INCREMENT = 1;
+
+const int16_t MIN_DEFROST_TIMEOUT = 5;
+const int16_t MAX_DEFROST_TIMEOUT = 60;
+const int16_t DEFROST_TIMEOUT_INCREMENT = 5;
+
+constexpr temperature MIN_DEFROST_TERMINATION_TEMPERATURE = degrees(-20);
+constexpr temperature MAX_DEFROST_TERMINATION_TEMPERATURE = degrees(15);
+constexpr temperature DEFROST_TERMINATION_TEMPERATURE_INCREMENT = degrees(1);
+
+// Defrost Constants
+// frost on the evaporator insulates it, so every run pulls the cabinet down slower than the ones right after a defrost.
+// the adaptive mode defrosts once a few runs in a row are this much slower than the best run since the last defrost
+const uint8_t DEFROST_RATE_DEGRADATION_PERCENT = 30;
+const uint8_t DEFROST_DEGRADED_RUNS = 3;
+const uint32_t MIN_ADAPTIVE_DEFROST_INTERVAL = 4UL * 60 * 60 * 1000; // a few slow runs after loading stock shouldn't defrost over and over
+const uint32_t MIN_PULL_DOWN_RUN = 5UL * 60 * 1000; // shorter runs are mostly the evaporator cooling itself down
+
+// a defrost warms the cabinet on purpose, so the high alarm is this much above its usual limit while one runs
+constexpr temperature DEFROST_HIGH_ALARM_ALLOWANCE = degrees(5);
+
+constexpr temperature MIN_HIGH_ALARM_TEMPERATURE = degrees(-20);
+constexpr temperature MAX_HIGH_ALARM_TEMPERATURE = degrees(0);
+constexpr temperature HIGH_ALARM_TEMPERATURE_INCREMENT = degrees(1);
+
+constexpr temperature MIN_LOW_ALARM_TEMPERATURE = degrees(-40);
+constexpr temperature MAX_LOW_ALARM_TEMPERATURE = degrees(-15);
+constexpr temperature LOW_ALARM_TEMPERATURE_INCREMENT = degrees(1);
+
+const int16_t MIN_ALARM_DELAY = 0;
+const int16_t MAX_ALARM_DELAY = 120;
+const int16_t ALARM_DELAY_INCREMENT = 5;
+
+// Alarm Constants
+// an alarm nobody acknowledges escalates, one that was acknowledged but is still there reminds again after a while
+const uint32_t ALARM_ESCALATION_TIME = 30UL * 60 * 1000;
+const uint32_t ALARM_REMIND_TIME = 2UL * 60 * 60 * 1000;
+const uint32_t PROBE_FAILURE_ALARM_DELAY = 60UL * 1000;
+
+// Compressor Health Constants
+// the baseline is the plain average of the first runs, then it follows the runs slowly so it still tracks the seasons.
+// the recent average follows them quickly, and how far it drifted from the baseline is what the score comes from
+const uint8_t HEALTH_BASELINE_RUNS = 20; // no score until this many runs were learned
+const uint8_t HEALTH_BASELINE_SHIFT = 8; // 1/256 of every run after that, a few days worth
+const uint8_t HEALTH_RECENT_SHIFT = 3; // 1/8 of every run
+const uint8_t HEALTH_SAVE_INTERVAL = 4; // runs
+const uint32_t MIN_HEALTH_RUN = 60UL * 1000; // from the cabinet peak, anything shorter is all evaporator lag
+constexpr temperature MAX_HEALTH_RUN_START = degrees(3); // above target
+
+const uint8_t HEALTH_PULL_DOWN_DRIFT_PERCENT = 25; // slower than the baseline by this much is flagged
+constexpr temperature HEALTH_COMPRESSOR_TEMPERATURE_DRIFT = degrees(5); // hotter than the baseline by this much is flagged
+const uint8_t HEALTH_RUN_TIME_DRIFT_PERCENT = 50; // longer than the baseline by this much is flagged
+
+const uint8_t HEALTH_SCORE_UNKNOWN = 0xFF;
+
+const uint8_t STARTUP_JITTER_SEED_SAMPLES = 8;
+
+constexpr temperature MIN_DEMAND_RESPONSE_ALLOWANCE = degrees(0); // 0 turns it off
+constexpr temperature MAX_DEMAND_RESPONSE_ALLOWANCE = degrees(5);
+constexpr temperature DEMAND_RESPONSE_ALLOWANCE_INCREMENT = centi_degrees(50);
+
+// Demand Response Constants
+// hard limits no matter what the allowance is set to, frozen food has to stay below -12 and a stuck
+// demand response signal can't keep the compressor off for more than a couple of hours
+constexpr temperature MAX_DEMAND_RESPONSE_TEMPERATURE = degrees(-12);
+const uint32_t MAX_DEMAND_RESPONSE_DEFERRAL = 2UL * 60 * 60 * 1000;
+
+// Overheat Constants
+// after an overheat the compressor has to cool down below the max temp minus the band and rest for a while
+// before it's allowed to start again, otherwise it restarts as soon as it dips under the limit & trips straight away
+constexpr temperature OVERHEAT_RECOVERY_BAND = degrees(5);
+const uint32_t MIN_OVERHEAT_REST_TIME = 15UL * 60 * 1000;
+
+// while running, the compressor temperature is extrapolated this far ahead using its rise rate, the rise slows
+// down as it gets warmer so a straight line is on the safe side. only done close to the limit, where it matters
+const uint32_t COMPRESSOR_RISE_SAMPLE_TIME = 60UL * 1000;
+const int16_t OVERHEAT_LOOKAHEAD_MINUTES = 3;
+constexpr temperature OVERHEAT_PREDICTION_MARGIN = degrees(5);
+
 // NTC Constants
 const int REFERENCE_RESISTANCE = 10000;
 const int NOMINAL_TEMPERATURE = 25;
@@ -92,6 +293,103 @@ const int ANALOG_RESOLUTION = 1023;
 const uint32_t NOMINAL_RESISTANCE_NTC_1 = 10000;
 const uint32_t NOMINAL_RESISTANCE_NTC_2 = 100000;
 
+// each reading is the sum of 16 samples, this gives us 4 extra bits of resolution for the table lookup
+const uint8_t NTC_SAMPLE_COUNT = 16;
+
+// the adc -> temperature table has an entry every 16 adc codes (65 entries covering 0 .. 1024)
+// an entry every 32 codes was tested but the interpolation error was close to a degree at -20
+const uint8_t NTC_TABLE_SHIFT = 8; // (code * 16) >> 8 = code / 16
+const uint8_t NTC_TABLE_SIZE = 65;
+
+// Calibration Constants
+constexpr temperature MIN_CALIBRATION_REFERENCE = degrees(-40);
+constexpr temperature MAX_CALIBRATION_REFERENCE = degrees(100);
+constexpr temperature CALIBRATION_REFERENCE_INCREMENT = centi_degrees(10);
+
+const uint8_t MAX_CALIBRATION_POINTS = 3;
+
+// Plausibility Constants
+// confidence goes from 0 to 100, every failed check takes some away and every clean reading adds 1 back
+const uint8_t MAX_SENSOR_CONFIDENCE = 100;
+const uint8_t SENSOR_WARNING_CONFIDENCE = 80; // below this the red led comes on
+const uint8_t SENSOR_DEGRADED_CONFIDENCE = 50; // below this the controller runs on the last plausible reading
+
+const uint8_t IMPLAUSIBLE_READING_PENALTY = 25; // out of range or jumped too far, a single one is only a warning
+const uint8_t SUSPICIOUS_READING_PENALTY = 1; // stuck or inconsistent with the other probes
+
+// a working probe moves well past the band early in every run (the cabinet drops, the shell heats up), so the reading at
+// the start of a run is compared with the one this far into it. later in a long run both can sit still for hours
+constexpr temperature STUCK_SENSOR_BAND = centi_degrees(10);
+const uint32_t STUCK_SENSOR_TIME = 15UL * 60 * 1000;
+
+const uint32_t CROSS_CHECK_RUNTIME = 10UL * 60 * 1000; // the compressor shell should be warmer than the cabinet by then
+
+// Fallback Constants
+// when the cabinet probe can't be trusted the compressor keeps cycling like it did over the last few cycles
+const uint8_t COMPRESSOR_CYCLE_HISTORY_SIZE = 8;
+const uint8_t MIN_FALLBACK_CYCLES = 2; // below this we use the defaults instead
+
+const uint32_t DEFAULT_FALLBACK_ON_TIME = 15UL * 60 * 1000;
+const uint32_t DEFAULT_FALLBACK_OFF_TIME = 15UL * 60 * 1000;
+
+// Estimator Constants
+// the cabinet estimate is an alpha-beta observer (a steady state kalman filter for temperature & rate)
+// gains are in 1/65536ths, beta ~= alpha^2 / (2 - alpha) keeps it close to critically damped at 1 update per second
+const int32_t ESTIMATOR_ALPHA = 6554; // 0.1
+const int32_t ESTIMATOR_BETA = 346; // 0.0053
+
+// how much of the estimated rate at the end of a phase goes into the learned rate for that phase
+const int32_t ESTIMATOR_RATE_LEARNING_DIVISOR = 4;
+
+// the probe lags the air temperature, this is roughly its time constant in still air
+const int32_t CABINET_PROBE_LAG_SECONDS = 60;
+constexpr temperature MAX_LAG_COMPENSATION = degrees(2);
+
+// starting points for the learned rates, in centi-degrees per second << 8 like the estimator
+const int32_t DEFAULT_COOLING_RATE = -128; // -0.3 degrees a minute
+const int32_t DEFAULT_WARMING_RATE = 43; // 0.1 degrees a minute
+
+// a phase shorter than this ends before the estimated rate settles, so we don't learn a rate from it
+const uint32_t MIN_RATE_LEARNING_PHASE = 5UL * 60 * 1000;
+
+// if the compressor shell hasn't warmed up by this much after a few minutes of running,
+// the compressor probably tripped its own overload and isn't actually cooling
+constexpr temperature COMPRESSOR_WORKING_RISE = degrees(2);
+const uint32_t COMPRESSOR_WORKING_CHECK_TIME = 5UL * 60 * 1000;
+
+// Load Event Constants
+// with the compressor off the cabinet warms up by ~0.1 degrees a minute, an open door or warm stock going in
+// is several times that. the estimated rate is already filtered, it just has to stay up for a bit to count
+const int16_t LOAD_EVENT_RATE = 50; // centi-degrees per minute
+const int16_t LOAD_EVENT_CLEAR_RATE = 25; // the event is over once the rate drops back below this
+const uint32_t LOAD_EVENT_CONFIRM_TIME = 30UL * 1000;
+
+// Thermal Model Constants
+// every off period is recorded as (cooling rate when the compressor stopped, how much further the cabinet dropped after)
+// and a line is fit through the recent ones, so we can stop early & coast into the target
+const uint8_t THERMAL_MODEL_HISTORY_SIZE = 8;
+const uint8_t MIN_THERMAL_MODEL_CYCLES = 3; // below this we don't predict anything
+const uint8_t THERMAL_MODEL_SAVE_INTERVAL = 4; // cycles, the fit doesn't move much from one cycle to the next
+
+constexpr temperature MAX_PREDICTED_COAST = degrees(3);
+
+// Statistics Constants
+// the counters are saved every 15 minutes, each save goes to the next of 16 slots so any one slot
+// is only written ~6 times a day, which is decades before the 100k write endurance runs out
+const uint32_t STATISTICS_SAVE_INTERVAL = 15UL * 60 * 1000;
+const uint8_t STATISTICS_EEPROM_SLOTS = 16;
+
+// EEPROM Layout
+const int EEPROM_SIZE = 1024; // atmega32u4
+const int PROFILE_SELECTION_EEPROM_ADDRESS = 0; // this used to be the only freezer_config, before there were profiles
+const int CALIBRATION_EEPROM_ADDRESS = 64; // up to 8 channels fit before 168
+const int THERMAL_MODEL_EEPROM_ADDRESS = 168;
+const int STATISTICS_EEPROM_ADDRESS = 256;
+const int PROFILES_EEPROM_ADDRESS = 656; // right after the 16 statistics slots
+const int ALARMS_EEPROM_ADDRESS = 848; // leaves room for the profiles to grow to 64 bytes each
+const int HEALTH_EEPROM_ADDRESS = 880;
+const int STARTUP_JITTER_SEED_EEPROM_ADDRESS = 900;
+
 // SD CARD SECTOR SIZE
 const uint16_t SD_BLOCK_SIZE  = 512;
 
@@ -99,27 +397,278 @@ const uint16_t SD_BLOCK_SIZE  = 512;
 // these are mainly here to save a few bytes instead of calling tft.width() & tft.height()
 const int16_t LCD_SIZE = 240; // width is same as height
 const int16_t LCD_CENTER = 120;
+const uint8_t MAX_SCREEN_TEXT_LENGTH = 20; // 12 px a character at the smallest font used (size 2)
+
+// --------------------------------------
+// Sensors
+
+// Steinhart-Hart coefficients, 1/T = a + b*ln(R) + c*ln(R)^3 (T in kelvin, R in ohms)
+// they're floats, but only the table build & the calibration solver touch them, never the hot path.
+// that's about 1.8 KB of flash in main.cpp (1.1 KB of it the solver) on top of log() & the int to float
+// conversions from the avr libraries, the float add, mul & div were already linked in for temperature_from_celsius()
+struct ntc_coefficients
+{
+  float a;
+  float b;
+  float c;
+};
+
+ntc_coefficients default_ntc_coefficients(uint32_t nominal_resistance, int b_value);
+
+temperature lookup_ntc_temperature(const temperature* table, uint16_t adc_sum);
+
+// describes a single ntc, everything is a template parameter so the sensor array is resolved at compile time
+template<uint8_t PIN, uint32_t NOMINAL_RESISTANCE, uint16_t B_VALUE>
+struct ntc_channel
+{
+  static const uint8_t pin = PIN;
+  static const uint32_t nominal_resistance = NOMINAL_RESISTANCE;
+  static const uint16_t b_value = B_VALUE;
+};
+
+// filter policies, they get the previous filtered adc sum and the new one from this sweep
+
+// just the 16x oversampling that every sweep already does
+struct no_filter
+{
+  static uint16_t apply(uint16_t previous, uint16_t sample)
+  {
+    return sample;
+  }
+};
+
+// exponential moving average, the new sample has a weight of 1 / 2^SHIFT
+template<uint8_t SHIFT>
+struct ema_filter
+{
+  static uint16_t apply(uint16_t previous, uint16_t sample)
+  {
+    return previous + ((int32_t)sample - previous) / (1 << SHIFT);
+  }
+};
+
+// all of the ntc channels with their lookup tables, this is meant to be a single global
+// so everything lives in static memory, there is no heap allocation like the old NTC_Thermistor objects
+template<typename FILTER, typename... CHANNELS>
+class sensor_array
+{
+public:
+  static const uint8_t channel_count = sizeof...(CHANNELS);
+
+  // reads every channel once, each channel gets a dummy read after switching the adc mux
+  // and then 16 samples back to back. this runs once per update_state()
+  void sweep()
+  {
+    static const uint8_t pins[] = {CHANNELS::pin...};
+
+    for(uint8_t channel = 0; channel < channel_count; channel++)
+    {
+      hal_analog_read(pins[channel]); // dummy read to stabilize the value
+
+      // 16 * 1023 still fits in a uint16_t
+      uint16_t sum = 0;
+      for(uint8_t i = 0; i < NTC_SAMPLE_COUNT; i++)
+      {
+        sum += hal_analog_read(pins[channel]);
+      }
+
+      // the first sweep has nothing to filter against
+      adc_sums[channel] = primed ? FILTER::apply(adc_sums[channel], sum) : sum;
+    }
+
+    primed = true;
+  }
+
+  uint16_t adc_sum(uint8_t channel) const
+  {
+    return adc_sums[channel];
+  }
+
+  temperature read(uint8_t channel) const
+  {
+    return lookup_ntc_temperature(tables[channel], adc_sums[channel]);
+  }
+
+  temperature* table(uint8_t channel)
+  {
+    return tables[channel];
+  }
+
+  static ntc_coefficients default_coefficients(uint8_t channel)
+  {
+    static const uint32_t nominal_resistances[] = {CHANNELS::nominal_resistance...};
+    static const uint16_t b_values[] = {CHANNELS::b_value...};
+
+    return default_ntc_coefficients(nominal_resistances[channel], b_values[channel]);
+  }
+
+private:
+  temperature tables[channel_count][NTC_TABLE_SIZE];
+  uint16_t adc_sums[channel_count];
+  bool primed = false;
+};
+
+// adding a probe is a matter of adding a line here, the channel index is the position in the list
+typedef sensor_array<
+    no_filter,
+    ntc_channel<THERMISTOR_1_PIN, NOMINAL_RESISTANCE_NTC_1, B_VALUE_NTC_1>, // cabinet
+    ntc_channel<THERMISTOR_2_PIN, NOMINAL_RESISTANCE_NTC_2, B_VALUE_NTC_2>  // compressor
+//    ntc_channel<SPARE_ADC_1_PIN, NOMINAL_RESISTANCE_NTC_1, B_VALUE_NTC_1>, // evaporator
+//    ntc_channel<SPARE_ADC_2_PIN, NOMINAL_RESISTANCE_NTC_1, B_VALUE_NTC_1>  // ambient
+> freezer_sensor_array;
+
+const uint8_t NTC_CHANNEL_COUNT = freezer_sensor_array::channel_count;
+
+const uint8_t CABINET_NTC = 0;
+const uint8_t COMPRESSOR_NTC = 1;
+
+// the channel of the evaporator probe, -1 until one is fitted (see the commented channels above). a defrost ends on
+// the evaporator getting to the termination temperature, the cabinet would only get there once the food has warmed
+// up, so without one it only ends on the defrost timeout
+const int8_t EVAPORATOR_NTC = -1;
+
+// what counts as a plausible reading for each channel
+struct sensor_limits
+{
+  temperature min;
+  temperature max;
+  temperature max_change_per_second;
+  bool reacts_to_compressor; // used for the stuck check, an ambient probe wouldn't
+  bool may_be_disconnected; // a disconnected probe is ignored instead of being treated as a fault
+};
+
+// a disconnected ntc reads close to -273 (really MIN_REPRESENTABLE_TEMPERATURE)
+constexpr temperature DISCONNECTED_NTC_TEMPERATURE = degrees(-100);
+
+const sensor_limits channel_limits[] = {
+    {degrees(-50), degrees(60), degrees(2), true, false}, // cabinet
+    // for the compressor ntc we don't really care if its disconnected, only if its shorted (same as before)
+    {degrees(-50), degrees(100), degrees(5), true, true}, // compressor
+};
+
+static_assert(sizeof(channel_limits) / sizeof(channel_limits[0]) == NTC_CHANNEL_COUNT, "every sensor channel needs limits");
 
 // --------------------------------------
 // Structures & Enums
 
-struct freezer_config
+enum hysteresis_mode
+{
+  // keep running for target_temperature_hysteresis_time after reaching target, start again as soon as we're above it
+  timed_hysteresis = 0,
+  // start above target + cut_in_offset, stop below target - cut_out_offset, fewer & longer cycles
+  band_hysteresis = 1,
+};
+
+// the strings the menu & the screens pick from are fixed width tables in flash (PROGMEM), there's no ram to spare for
+// them. they're read back with strcpy_P() or passed to show_centered_text() as an F() string
+
+// the options of the menu entries that show one of them instead of a number
+const uint8_t OPTION_STRING_SIZE = 9;
+
+const char hysteresis_mode_strings[][OPTION_STRING_SIZE] PROGMEM = {
+    "Timed",
+    "Band",
+};
+
+const char off_on_strings[][OPTION_STRING_SIZE] PROGMEM = {
+    "Off",
+    "On",
+};
+
+enum defrost_mode
+{
+  defrost_off = 0,
+  defrost_timed = 1, // every defrost_interval hours
+  defrost_adaptive = 2, // when the pull down rate degrades, defrost_interval is the longest it waits
+};
+
+const char defrost_mode_strings[][OPTION_STRING_SIZE] PROGMEM = {
+    "Off",
+    "Timed",
+    "Adaptive",
+};
+
+enum config_profile
+{
+  profile_deep_freeze = 0,
+  profile_standard = 1,
+  profile_eco = 2,
+};
+
+const char profile_names[][12] PROGMEM = {
+    "Deep Freeze",
+    "Standard",
+    "Eco",
+};
+
+const uint8_t PROFILE_COUNT = sizeof(profile_names) / sizeof(profile_names[0]);
+
+// packed (like everything is on the avr) so the card records & eeprom profiles have the same layout in the host build
+struct __attribute__((packed)) freezer_config
 {
-  char magic_bytes[4] = {'F', '0', '0', '2'}; // 4
+  char magic_bytes[4] = {'F', '0', '1', '2'}; // 4
 
-  float target_temperature = -18.0;  // Degrees Celsius // 4
+  temperature target_temperature = degrees(-18); // 2
+
+  int16_t hysteresis_mode = hysteresis_mode::timed_hysteresis; // 2
 
   int16_t target_temperature_hysteresis_time = 60;  // 15 seconds // 2
 
+  temperature cut_in_offset = centi_degrees(150); // 2
+  temperature cut_out_offset = centi_degrees(50); // 2
+
   int16_t compressor_dead_time = 5;     // minutes // 2
+  int16_t compressor_min_run_time = 2; // minutes // 2
   int16_t compressor_max_run_time = 300; // 5 hours // in minutes // 2
 
-  float compressor_max_temp = 45.0; // 4
+  temperature compressor_max_temp = degrees(45); // 2
 
   int16_t freezer_startup_delay = 2;  // minutes; // 2
+  int16_t startup_jitter = 0; // minutes, a random extra startup delay so units sharing a supply don't all start at once // 2
+
+  temperature demand_response_allowance = degrees(0); // how far above target we can drift while deferring a start // 2
+
+  int16_t compressor_power = 100; // watts, only used for the energy estimate // 2
+
+  int16_t load_event_start = 0; // start the compressor as soon as a load event (door open, warm stock) is detected // 2
+
+  temperature boost_target_temperature = degrees(-25); // 2
+  int16_t boost_duration = 240; // minutes, boost turns itself off after this // 2
+
+  int16_t defrost_mode = defrost_mode::defrost_off; // 2
+  int16_t defrost_interval = 12; // hours // 2
+  int16_t defrost_timeout = 20; // minutes // 2
+  temperature defrost_termination_temperature = degrees(-10); // measured on EVAPORATOR_NTC, unused without one // 2
+
+  temperature high_alarm_temperature = degrees(-10); // 2
+  int16_t high_alarm_delay = 30; // minutes // 2
+  temperature low_alarm_temperature = degrees(-35); // 2
+  int16_t low_alarm_delay = 30; // minutes // 2
+};
+
+// every profile is a full config, the menu always edits the active one
+struct stored_profile
+{
+  freezer_config config; // 52
+
+  uint8_t crc = 0; // 1
 };
 
-enum freezer_status
+// which of the profiles is active, kept apart so switching doesn't rewrite a whole profile
+struct profile_selection
+{
+  char magic_bytes[4] = {'P', 'S', 'L', '1'}; // 4
+
+  uint8_t active_profile = config_profile::profile_standard; // 1
+
+  uint8_t crc = 0; // 1
+};
+
+static_assert(PROFILE_SELECTION_EEPROM_ADDRESS + sizeof(profile_selection) <= CALIBRATION_EEPROM_ADDRESS, "the profile selection overlaps the calibration");
+static_assert(PROFILES_EEPROM_ADDRESS + PROFILE_COUNT * sizeof(stored_profile) <= ALARMS_EEPROM_ADDRESS, "the profiles overlap the alarms");
+
+// 2 bytes like an int on the avr, it's in the card records
+enum freezer_status : int16_t
 {
   off = 0,
   cooling = 1,
@@ -129,9 +678,16 @@ enum freezer_status
   compressor_max_runtime = 4,
   startup_delay = 5,
   overheat = 6,
+  sensor_degraded = 7,
+  sensor_failure = 8,
+  sensor_fallback = 9,
+  min_runtime = 10,
+  demand_deferred = 11,
+  boost = 12,
+  defrost = 13,
 };
 
-const char* freezer_status_strings[] = {
+const char freezer_status_strings[][14] PROGMEM = {
     "",
     "   Cooling   ",
 //    "",
@@ -140,9 +696,16 @@ const char* freezer_status_strings[] = {
     " Max Runtime ",
     "Startup Delay",
     "  Overheat   ",
+    "Sensor Fault ",
+    "  Safe Stop  ",
+    "  Fallback   ",
+    " Min Runtime ",
+    "  Deferred   ",
+    "    Boost    ",
+    "   Defrost   ",
 };
 
-uint16_t status_colors[][2] = {
+const uint16_t status_colors[][2] PROGMEM = {
     {GC9A01A_WHITE, GC9A01A_WHITE},
     {GC9A01A_BLUE, GC9A01A_PURPLE},
 //    {GC9A01A_WHITE, GC9A01A_WHITE},
@@ -151,603 +714,3074 @@ uint16_t status_colors[][2] = {
     {GC9A01A_ORANGE, GC9A01A_YELLOW},
     {GC9A01A_ORANGE, GC9A01A_YELLOW},
     {GC9A01A_RED, GC9A01A_ORANGE},
+    {GC9A01A_ORANGE, GC9A01A_RED},
+    {GC9A01A_RED, GC9A01A_RED},
+    {GC9A01A_PURPLE, GC9A01A_RED},
+    {GC9A01A_BLUE, GC9A01A_YELLOW},
+    {GC9A01A_YELLOW, GC9A01A_GREEN},
+    {GC9A01A_PURPLE, GC9A01A_BLUE},
+    {GC9A01A_ORANGE, GC9A01A_WHITE},
 };
 
-struct freezer_state
-{
-  double current_ntc1_temperature = 0.0; // 4 bytes
-  double current_ntc2_temperature = 0.0; // 4 bytes
-
-  bool target_compressor_state = LOW;
-  bool actual_compressor_state = LOW;
+const uint8_t FREEZER_STATUS_COUNT = sizeof(freezer_status_strings) / sizeof(freezer_status_strings[0]);
 
-  freezer_status status = freezer_status::off;
+// inputs to the control state machine, sampled once per update so every guard sees the same snapshot
+enum control_input
+{
+  input_startup_delay = 1 << 0, // still within the startup delay
+  input_probe_failed = 1 << 1, // the compressor probe failed, we can't protect the compressor
+  input_probe_degraded = 1 << 2, // running on the last plausible compressor reading
+  input_fallback = 1 << 3, // the cabinet probe is degraded, the demand comes from the recent cycles
+  input_demand = 1 << 4, // the hysteresis mode (or the fallback) wants the compressor running
+  input_overheating = 1 << 5,
+  input_max_runtime = 1 << 6, // the compressor has been running for longer than the max runtime
+  input_dead_time = 1 << 7, // the compressor was stopped less than the dead time ago
+  input_compressor_on = 1 << 8,
+  input_min_runtime = 1 << 9, // the compressor has been running for less than the min runtime
+  input_demand_response = 1 << 10, // asked to avoid starting the compressor and we are still within the allowance
+  input_overheat_recovering = 1 << 11, // not cooled down through the recovery band or rested long enough since stopping
+  input_boost = 1 << 12, // boost is on, the demand is for the boost target
+  input_defrost = 1 << 13, // a defrost is running, the compressor has to stay off
 };
 
-struct freezer_state_data_point
+// things that happened during an update, only set on the data point they happened in
+enum log_event
 {
-  volatile uint8_t start_magic_bytes[4] = {'F', 'Z', 'Z', 'X'}; // 4 bytes
+  event_short_cycle_prevented = 1 << 0, // the min runtime kept the compressor on
+  event_start_deferred = 1 << 1, // the first start deferred by a demand response request
+  event_load_detected = 1 << 2, // the cabinet warmed up too fast for the compressor just being off
+  event_boost_started = 1 << 3,
+  event_boost_ended = 1 << 4, // turned off by hand or expired
+  event_defrost_started = 1 << 5,
+  event_defrost_ended = 1 << 6, // reached the termination temperature or timed out
+  event_profile_changed = 1 << 7, // the active profile is in the state
+  event_alarm_raised = 1 << 8,
+  event_alarm_cleared = 1 << 9, // the duration & peak of the alarm are in the state
+  event_alarm_acknowledged = 1 << 10,
+};
 
-//  volatile uint32_t unix_time = 0; // 8 bytes
-  volatile uint32_t ms_since_startup = 0;
+enum alarm_type
+{
+  alarm_high_temperature = 0,
+  alarm_low_temperature = 1,
+  alarm_probe_failure = 2, // the cabinet probe failed, so nothing is watching the temperature
+};
 
-  freezer_config config; // 24 bytes
+const char alarm_strings[][14] PROGMEM = {
+    "  High Temp  ",
+    "  Low Temp   ",
+    "Probe Failure",
+};
 
-  freezer_state state; // 11 bytes
+const uint8_t ALARM_COUNT = sizeof(alarm_strings) / sizeof(alarm_strings[0]);
 
-  volatile uint8_t crc = 0; // 4 bytes
+// the worst of these across all alarms picks the red led pattern
+enum alarm_level
+{
+  alarm_quiet = 0,
+  alarm_acknowledged = 1, // still there, but someone knows about it
+  alarm_unacknowledged = 2, // it's over, but nobody has seen it yet
+  alarm_raised = 3,
+  alarm_escalated = 4, // raised & not acknowledged for ALARM_ESCALATION_TIME
 };
 
-struct menu_entry
+struct alarm_pattern
 {
-  const char* name;
-  const char* unit;
+  uint16_t period; // ms
+  uint16_t on_time; // ms, from the start of each period
+  bool sound; // the buzzer follows the led
+};
 
-  void* value;
-  bool is_float;
-  float increment;
-  float min;
-  float max;
+const alarm_pattern alarm_patterns[] PROGMEM = {
+    {0, 0, false},
+    {2000, 100, false},
+    {1000, 500, false},
+    {500, 250, true},
+    {200, 100, true},
 };
 
-// --------------------------------------
-// Peripherals
+// latched alarms stay until they are acknowledged, even across resets
+struct alarm_record
+{
+  char magic_bytes[4] = {'A', 'L', 'M', '1'}; // 4
 
-Adafruit_GC9A01A tft(LCD_CS, LCD_DC, LCD_RST);
+  uint8_t latched = 0; // 1, a bit per alarm_type
 
-Encoder input_rotary_encoder(ROTARY_DT, ROTARY_CLK);
+  temperature peak_temperatures[ALARM_COUNT] {}; // 2 each, the furthest the cabinet got during the last one of each alarm
 
-Thermistor *ntc_1;
-Thermistor *ntc_2;
+  uint8_t crc = 0; // 1
+};
 
-ThreeWire rtc_three_wire(RTC_IO,RTC_CLK,RTC_CE);
-RtcDS1302<ThreeWire> rtc_clock(rtc_three_wire);
+static_assert(ALARMS_EEPROM_ADDRESS + sizeof(alarm_record) <= HEALTH_EEPROM_ADDRESS, "the alarms overlap the compressor health");
 
-// --------------------------------------
-// Global Variables
+enum health_flag
+{
+  health_pull_down_drift = 1 << 0, // the cabinet pulls down slower, low on refrigerant or a frosted / blocked evaporator
+  health_compressor_temperature_drift = 1 << 1, // the compressor runs hotter, a dirty condenser or a failing fan
+  health_run_time_drift = 1 << 2, // the runs got longer, losing capacity or a bad door seal
+};
 
-bool logging_enabled = false;
-bool config_is_dirty = false;
-bool edit_mode = false;
-bool screen_should_refresh = false;
-bool showing_new_screen = false;
+// averages over the compressor runs, in << 8 so the slow average doesn't lose the small steps
+struct compressor_health
+{
+  char magic_bytes[4] = {'H', 'L', 'T', '1'}; // 4
 
-freezer_config active_config {};
-freezer_config dirty_config {};
+  int32_t baseline_pull_down_rate = 0; // centi-degrees per minute << 8 // 4
+  int32_t baseline_compressor_temperature = 0; // centi-degrees << 8 // 4
+  int32_t baseline_run_time = 0; // seconds << 8 // 4
 
-freezer_state current_state {};
+  uint8_t learned_runs = 0; // 1, saturates at 255
 
-uint32_t compressor_turned_on_at;
-uint32_t compressor_turned_off_at;
-uint32_t reached_target_temperature_at;
-uint32_t state_updated_at = 0;
-uint32_t edit_mode_toggled_at = 0;
-uint32_t exceeded_max_runtime_at = 0;
+  uint8_t crc = 0; // 1
+};
 
-int8_t screen_index;
+static_assert(HEALTH_EEPROM_ADDRESS + sizeof(compressor_health) <= STARTUP_JITTER_SEED_EEPROM_ADDRESS, "the compressor health overlaps the jitter seed");
+static_assert(STARTUP_JITTER_SEED_EEPROM_ADDRESS + sizeof(uint32_t) <= EEPROM_SIZE, "the jitter seed doesn't fit in the eeprom");
 
-int32_t last_encoder_position = 0;
+const uint8_t ANY_STATUS = 0xFF;
 
-bool startup_delay_over = false;
+struct control_transition
+{
+  uint8_t from; // a freezer_status or ANY_STATUS
+  uint16_t all_of; // the guard, every one of these inputs has to be set
+  uint16_t none_of; // and none of these
+  freezer_status to;
+  void (*action)();
+};
 
-freezer_status previous_status = freezer_status::off;
+enum sensor_stage
+{
+  sensor_ok = 0,
+  sensor_warning = 1,
+  sensor_degraded_stage = 2,
+  sensor_failed = 3,
+};
 
-menu_entry menu_entries[] ={
-    {"Target Temp", "Degrees C", &dirty_config.target_temperature, true, TARGET_TEMPERATURE_INCREMENT, MIN_TARGET_TEMPERATURE, MAX_TARGET_TEMPERATURE},
-    {"Hysteresis", "Seconds", &dirty_config.target_temperature_hysteresis_time, false, TARGET_TEMPERATURE_HYSTERESIS_TIME_INCREMENT, MIN_TARGET_TEMPERATURE_HYSTERESIS_TIME, MAX_TARGET_TEMPERATURE_HYSTERESIS_TIME},
-    {"Dead Time", "Minutes", &dirty_config.compressor_dead_time, false, COMPRESSOR_DEAD_TIME_INCREMENT, MIN_COMPRESSOR_DEAD_TIME, MAX_COMPRESSOR_DEAD_TIME},
-    {"Max Runtime", "Minutes", &dirty_config.compressor_max_run_time, false, COMPRESSOR_MAX_RUNTIME_INCREMENT, MIN_COMPRESSOR_MAX_RUNTIME, MAX_COMPRESSOR_MAX_RUNTIME},
-    {"Max Comp Temp", "Degrees C", &dirty_config.compressor_max_temp, true, COMPRESSOR_MAX_TEMP_INCREMENT, MIN_COMPRESSOR_MAX_TEMP, MAX_COMPRESSOR_MAX_TEMP},
-    {"Startup Delay", "Minutes", &dirty_config.freezer_startup_delay, false, FREEZER_STARTUP_DELAY_INCREMENT, MIN_FREEZER_STARTUP_DELAY, MAX_FREEZER_STARTUP_DELAY},
+struct sensor_health
+{
+  uint8_t confidence = MAX_SENSOR_CONFIDENCE;
+  sensor_stage stage = sensor_stage::sensor_ok;
+
+  bool has_reading = false;
+  temperature last_plausible = degrees(0);
+  uint32_t last_plausible_at = 0;
+
+  // the reading at the start of the current run, then where it got stuck
+  temperature stuck_reference = degrees(0);
+  uint32_t stuck_run_started_at = UINT32_MAX; // compressor_turned_on_at of the run the reference is from
+  bool stuck_checked = false;
+  bool stuck = false;
 };
 
-bool reset_by_watchdog = false;
+struct compressor_cycle
+{
+  uint16_t on_seconds;
+  uint16_t off_seconds;
+};
 
-const uint8_t HOME_SCREEN = 0;
-const uint8_t INFO_SCREEN = 7;
+// values are in centi-degrees << 8 and centi-degrees per second << 8 so small rates don't get lost
+struct cabinet_estimator
+{
+  bool initialized = false;
 
-// --------------------------------------
-// Function Definitions
+  int32_t estimated_temperature = 0;
+  int32_t estimated_rate = 0;
 
-void initialize_thermistors();
+  int32_t cooling_rate = DEFAULT_COOLING_RATE;
+  int32_t warming_rate = DEFAULT_WARMING_RATE;
 
-void initialize_display();
+  temperature compressor_start_temperature = degrees(0);
+  bool was_cooling = false;
+  uint32_t phase_started_at = 0;
+  uint32_t updated_at = 0;
+};
 
-void initialize_status_leds();
+struct coast_record
+{
+  int16_t cut_off_rate; // centi-degrees per minute when the compressor stopped
+  int16_t coast; // centi-degrees, the lowest the cabinet got after that minus where it was
+};
 
-void initialize_logging();
+// coast = slope * rate + offset, the learned rates are the estimator's so it doesn't start from the defaults after a reset
+struct thermal_model
+{
+  char magic_bytes[4] = {'T', 'M', 'D', '1'}; // 4
 
-void initialize_rtc();
+  int32_t cooling_rate = DEFAULT_COOLING_RATE; // 4
+  int32_t warming_rate = DEFAULT_WARMING_RATE; // 4
 
-void initialize_watchdog();
+  int16_t coast_slope = 0; // minutes << 8 // 2
+  int16_t coast_offset = 0; // centi-degrees // 2
 
-void initialize_compressor();
+  uint8_t learned_cycles = 0; // 1, saturates at 255
+};
 
-void initialize_input();
+// the saved part of the statistics, the slot with the highest sequence & a valid crc is the newest
+struct compressor_statistics
+{
+  char magic_bytes[4] = {'S', 'T', 'A', '1'}; // 4
 
-void load_config();
+  uint32_t sequence = 0; // 4
 
-void save_dirty_config();
+  uint32_t on_seconds = 0; // 4
+  uint32_t powered_seconds = 0; // 4
+  uint32_t cycles = 0; // 4
+  uint32_t watt_hours = 0; // 4
 
-void read_sensors();
+  uint8_t crc = 0; // 1
+};
 
-volatile void log_state();
+static_assert(THERMAL_MODEL_EEPROM_ADDRESS + sizeof(thermal_model) <= STATISTICS_EEPROM_ADDRESS, "the thermal model overlaps the statistics");
+static_assert(STATISTICS_EEPROM_ADDRESS + STATISTICS_EEPROM_SLOTS * sizeof(compressor_statistics) <= EEPROM_SIZE, "the statistics slots don't fit in the eeprom");
 
-void update_state();
+// rolling compressor on time over the last BUCKETS * BUCKET_SECONDS, the oldest bucket is dropped as a new one starts
+template<uint8_t BUCKETS, uint32_t BUCKET_SECONDS, typename T>
+struct duty_window
+{
+  T on_seconds[BUCKETS] {};
+  uint8_t index = 0;
+  uint8_t completed_buckets = 0;
+  uint32_t bucket_elapsed = 0; // seconds into the current bucket
 
-void validate_temperatures();
+  void add(uint32_t seconds, bool compressor_on)
+  {
+    while(seconds > 0)
+    {
+      uint32_t step = min(seconds, BUCKET_SECONDS - bucket_elapsed);
 
-void halt(const char* error);
+      if(compressor_on)
+      {
+        on_seconds[index] += step;
+      }
 
-bool is_compressor_overheating();
+      bucket_elapsed += step;
+      seconds -= step;
 
-bool is_startup_delay_over();
+      if(bucket_elapsed >= BUCKET_SECONDS)
+      {
+        index = (index + 1) % BUCKETS;
+        on_seconds[index] = 0;
+        bucket_elapsed = 0;
+
+        if(completed_buckets < BUCKETS - 1)
+        {
+          completed_buckets++;
+        }
+      }
+    }
+  }
 
-bool is_compressor_on();
+  // until the window has been running for its whole length this is the duty over however long it has been
+  uint8_t get_duty_percent() const
+  {
+    uint32_t on_total = 0;
 
-bool is_within_target_temperature();
+    for(uint8_t i = 0; i < BUCKETS; i++)
+    {
+      on_total += on_seconds[i];
+    }
 
-bool has_hysteresis_time_elapsed();
+    uint32_t total = completed_buckets * BUCKET_SECONDS + bucket_elapsed;
+    return total == 0 ? 0 : on_total * 100 / total;
+  }
+};
 
-bool has_compressor_exceeded_max_runtime();
+// packed, see freezer_config
+struct __attribute__((packed)) freezer_state
+{
+  temperature ntc_temperatures[NTC_CHANNEL_COUNT] {}; // 2 bytes each, indexed by CABINET_NTC, COMPRESSOR_NTC, ...
+  uint8_t ntc_confidence[NTC_CHANNEL_COUNT] {}; // 1 byte each
 
-bool has_dead_time_elapsed();
+  temperature estimated_cabinet_temperature = degrees(0); // 2 bytes, this is what the control decisions use
+  int16_t estimated_cabinet_rate = 0; // 2 bytes, centi-degrees per minute
 
-void set_compressor(bool state);
+  temperature predicted_coast_minimum = degrees(0); // 2 bytes, where the model thinks the cabinet bottoms out if we stopped now
+  temperature actual_coast_minimum = degrees(0); // 2 bytes, where it actually bottomed out after the last stop
 
-void handle_input();
+  bool target_compressor_state = LOW;
+  bool actual_compressor_state = LOW;
 
-void on_button_pressed();
+  uint16_t prevented_short_cycles = 0; // 2 bytes, since startup
+  uint16_t events = 0; // 2 bytes, log_event flags
 
-void show_centered_text(const char *text, uint8_t font_size, int16_t x_offset = 0, int16_t y_offset = 0, uint16_t color = GC9A01A_WHITE);
+  uint16_t deferred_minutes = 0; // 2 bytes, compressor starts held back by demand response since startup
 
-void refresh_display();
+  int16_t compressor_temperature_rate = 0; // 2 bytes, centi-degrees per minute while running
 
-void display_home_screen();
+  bool load_event_active = false; // 1 byte
+  uint16_t load_events = 0; // 2 bytes, since startup
 
-void display_info_screen();
+  bool defrost_active = false; // 1 byte
+  int16_t pull_down_rate = 0; // 2 bytes, centi-degrees per minute over the last compressor run, positive is cooling
 
-bool init_sd_card();
+  uint8_t active_profile = config_profile::profile_standard; // 1 byte, config_profile
 
-bool save_data_point(const freezer_state_data_point* data);
+  uint8_t alarms_active = 0; // 1 byte, a bit per alarm_type
+  uint8_t alarms_latched = 0; // 1 byte, raised & not acknowledged yet
+  temperature alarm_peak_temperature = degrees(0); // 2 bytes, of the last alarm raised
+  uint16_t alarm_duration = 0; // 2 bytes, minutes the last alarm raised has been active for
 
-bool wait_card_busy();
+  uint8_t health_score = HEALTH_SCORE_UNKNOWN; // 1 byte, 0 - 100, HEALTH_SCORE_UNKNOWN until the baseline is learned
+  uint8_t health_flags = 0; // 1 byte, health_flag
 
-void send_card_command(uint8_t cmd, uint32_t arg, uint8_t crc);
+  freezer_status status = freezer_status::off;
+};
 
-uint8_t read_card_response();
+struct __attribute__((packed)) freezer_state_data_point
+{
+  // bumped whenever the layout changes, 'FZZX' records used float/double temperatures
+  volatile uint8_t start_magic_bytes[4] = {'F', 'Z', 'X', 'E'}; // 4 bytes
 
-bool read_card_block(uint32_t block_addr, uint8_t* buffer, uint16_t buffer_size);
+//  volatile uint32_t unix_time = 0; // 4 bytes
+  volatile uint32_t ms_since_startup = 0; // 4 bytes
 
-bool write_card_block(uint32_t block_addr, const void* buffer, uint16_t buffer_size);
+  freezer_config config; // 52 bytes
 
-uint8_t calculate_crc8(const uint8_t *data, uint8_t len);
+  freezer_state state; // 41 bytes
 
-// --------------------------------------
+  volatile uint8_t crc = 0; // 1 byte
+};
 
-void setup()
+// native/replay.cpp decodes card images with this struct, the crc covers it all with the crc byte at 0.
+// a layout change has to come with a new magic, these catch the ones that don't
+static_assert(sizeof(freezer_config) == 52, "freezer_config changed size, bump the 'FZXE' magic so old cards aren't misread");
+static_assert(sizeof(freezer_state) == 41, "freezer_state changed size, bump the 'FZXE' magic so old cards aren't misread");
+static_assert(sizeof(freezer_state_data_point) == 102, "freezer_state_data_point changed size, bump the 'FZXE' magic so old cards aren't misread");
+static_assert(sizeof(freezer_state_data_point) <= SD_BLOCK_SIZE, "a data point has to fit in a card block");
+
+// the whole table is in flash, get_menu_entry() copies one out
+struct menu_entry
 {
-  initialize_watchdog();
-  initialize_status_leds();
+  char name[14];
+  char unit[13];
 
-  load_config();
+  void* value;
+  bool is_temperature; // value is a temperature, increment/min/max are in centi-degrees
+  int16_t increment;
+  int16_t min;
+  int16_t max;
+  const char (*value_strings)[OPTION_STRING_SIZE]; // if set the value is shown as one of these instead of a number
+};
 
-  initialize_logging();
+struct ntc_calibration
+{
+  char magic_bytes[4] = {'C', 'A', 'L', '2'}; // 4
+
+  // a calibration saved with a different set of probes isn't used
+  uint8_t channel_count = NTC_CHANNEL_COUNT; // 1
+
+  ntc_coefficients channels[NTC_CHANNEL_COUNT]; // 12 each
+};
+
+enum calibration_step
+{
+  calibration_inactive = 0,
+  calibration_select = 1,
+  calibration_capture = 2,
+  calibration_confirm = 3,
+};
+
+struct calibration_point
+{
+  uint16_t adc_sum;
+  temperature reference;
+};
+
+struct calibration_wizard
+{
+  calibration_step step = calibration_step::calibration_inactive;
+
+  uint8_t option = 0; // the highlighted entry on the select & confirm steps
+
+  uint8_t channel = 0;
+  uint8_t point_count = 0;
+  uint8_t points_captured = 0;
+
+  temperature reference = degrees(0);
+  calibration_point points[MAX_CALIBRATION_POINTS];
+
+  ntc_coefficients result;
+  bool result_valid = false;
+};
+
+// the options go NTC1 2 point, NTC1 3 point, NTC2 2 point, ... followed by these two
+const uint8_t CALIBRATION_OPTION_RESET = NTC_CHANNEL_COUNT * 2;
+const uint8_t CALIBRATION_OPTION_CANCEL = CALIBRATION_OPTION_RESET + 1;
+const uint8_t CALIBRATION_OPTION_COUNT = CALIBRATION_OPTION_CANCEL + 1;
+
+// ice bath, room temperature and a reference probe inside the running freezer
+const char calibration_point_strings[][9] PROGMEM = {"Ice Bath", "Ambient", "Probe"};
+const temperature calibration_point_defaults[] = {degrees(0), degrees(25), degrees(-18)};
+
+// --------------------------------------
+// Peripherals
+
+Adafruit_GC9A01A tft(LCD_CS, LCD_DC, LCD_RST);
+
+Encoder input_rotary_encoder(ROTARY_DT, ROTARY_CLK);
+
+freezer_sensor_array sensors;
+
+ThreeWire rtc_three_wire(RTC_IO,RTC_CLK,RTC_CE);
+RtcDS1302<ThreeWire> rtc_clock(rtc_three_wire);
+
+// --------------------------------------
+// Global Variables
+
+bool logging_enabled = false;
+bool config_is_dirty = false;
+bool edit_mode = false;
+bool screen_should_refresh = false;
+bool showing_new_screen = false;
+
+freezer_config active_config {};
+freezer_config dirty_config {};
+
+freezer_state current_state {};
+
+sensor_health sensor_health_states[NTC_CHANNEL_COUNT];
+
+cabinet_estimator estimator {};
+
+thermal_model active_thermal_model {};
+
+compressor_statistics active_statistics {};
+uint8_t statistics_slot = STATISTICS_EEPROM_SLOTS - 1; // the slot the active statistics were loaded from / last saved to
+
+duty_window<12, 5UL * 60, uint16_t> hour_duty; // 5 minute buckets
+duty_window<24, 60UL * 60, uint16_t> day_duty; // hourly buckets
+duty_window<7, 24UL * 60 * 60, uint32_t> week_duty; // daily buckets
+
+// when the cabinet started warming up faster than LOAD_EVENT_RATE, 0 while it isn't
+uint32_t load_event_rising_since = 0;
+
+#ifdef WITH_BOOST
+// boost isn't saved, a reset ends it like the timer would
+bool boost_active = false;
+uint32_t boost_started_at = 0;
+#else
+const bool boost_active = false; // so the checks for it fold away
+#endif
+
+alarm_record active_alarms {};
+uint32_t alarm_condition_since[ALARM_COUNT] {}; // 0 if the condition isn't there
+uint32_t alarm_raised_at[ALARM_COUNT] {}; // or when it was acknowledged, once it has been
+uint8_t last_alarm = 0; // the alarm_type of the last alarm raised
+bool high_alarm_armed = false; // not until the cabinet first got below the high alarm, so the first pull down doesn't alarm
+alarm_level current_alarm_level = alarm_level::alarm_quiet;
+bool sensor_warning_active = false; // the red led is on for this when there is no alarm
+volatile bool alarm_ack_pending = false;
+
+uint32_t defrost_started_at = 0;
+uint32_t last_defrost_at = 0; // when the last defrost ended, 0 (the reset) if there hasn't been one
+
+// the pull down of the current compressor run, and the best one since the last defrost
+bool pull_down_measuring = false;
+uint32_t pull_down_started_at = 0;
+temperature pull_down_start_temperature = degrees(0);
+int16_t best_pull_down_rate = 0;
+uint8_t degraded_pull_down_runs = 0;
+
+compressor_health active_health {};
+
+// the recent averages aren't saved, they start over from the baseline after a reset
+int32_t recent_pull_down_rate = 0;
+int32_t recent_compressor_temperature = 0;
+int32_t recent_run_time = 0;
+
+temperature run_peak_compressor_temperature = degrees(0);
+
+// when the button was pressed down, 0 while it's up. handled is set once the long press did its thing
+uint32_t button_pressed_at = 0;
+bool long_press_handled = false;
+
+uint32_t statistics_updated_at = 0;
+uint32_t statistics_saved_at = 0;
+uint16_t statistics_remainder_ms = 0; // carried over so the counters don't drift from dropping the milliseconds
+uint16_t statistics_remainder_watt_seconds = 0;
+
+coast_record coast_history[THERMAL_MODEL_HISTORY_SIZE];
+uint8_t coast_history_index = 0;
+uint8_t coast_history_count = 0;
+
+// the off period currently being watched, cleared if it isn't something we want to learn from
+bool coast_learnable = false;
+int16_t coast_cut_off_rate = 0;
+temperature coast_cut_off_temperature = degrees(0);
+bool thermal_model_compressor_was_on = false;
+
+// the sensor tables are rebuilt from this whenever it changes, so a reading is just a lookup & interpolation
+ntc_calibration active_calibration {};
+
+calibration_wizard calibration {};
+volatile bool calibration_button_pending = false;
+volatile bool profile_button_pending = false;
+
+uint32_t compressor_turned_on_at;
+uint32_t compressor_turned_off_at;
+uint32_t reached_target_temperature_at;
+uint32_t state_updated_at = 0;
+uint32_t edit_mode_toggled_at = 0;
+
+int8_t screen_index;
+
+int32_t last_encoder_position = 0;
+
+bool startup_delay_over = false;
+
+// picked once at boot out of 0 .. startup_jitter minutes
+uint32_t startup_jitter_ms = 0;
+
+// when the current demand response request started, 0 while there is none
+uint32_t demand_response_requested_at = 0;
+bool compressor_start_deferred = false; // set on the first start deferred by the current request
+uint32_t deferred_ms = 0;
+
+// the compressor temperature at the start of the current rise rate sample, sampled_at is 0 while not sampling
+uint32_t compressor_temperature_sampled_at = 0;
+temperature compressor_temperature_sample = degrees(0);
+
+freezer_status previous_status = freezer_status::off;
+
+// completed cycles (an on period followed by an off period) recorded by set_compressor()
+compressor_cycle compressor_cycle_history[COMPRESSOR_CYCLE_HISTORY_SIZE];
+uint8_t compressor_cycle_history_index = 0;
+uint8_t compressor_cycle_history_count = 0;
+
+uint32_t last_compressor_on_duration = 0;
+
+// cleared if any part of the current cycle ran in fallback mode, we only want to learn from normal cycles
+bool compressor_cycle_learnable = false;
+
+const menu_entry menu_entries[] PROGMEM = {
+    {"Target Temp", "Degrees C", &dirty_config.target_temperature, true, TARGET_TEMPERATURE_INCREMENT.centi_degrees, MIN_TARGET_TEMPERATURE.centi_degrees, MAX_TARGET_TEMPERATURE.centi_degrees, nullptr},
+    {"Hyst. Mode", "Timed / Band", &dirty_config.hysteresis_mode, false, 1, hysteresis_mode::timed_hysteresis, hysteresis_mode::band_hysteresis, hysteresis_mode_strings},
+    {"Hysteresis", "Seconds", &dirty_config.target_temperature_hysteresis_time, false, TARGET_TEMPERATURE_HYSTERESIS_TIME_INCREMENT, MIN_TARGET_TEMPERATURE_HYSTERESIS_TIME, MAX_TARGET_TEMPERATURE_HYSTERESIS_TIME, nullptr},
+    {"Cut In", "Above Target", &dirty_config.cut_in_offset, true, CUT_IN_OFFSET_INCREMENT.centi_degrees, MIN_CUT_IN_OFFSET.centi_degrees, MAX_CUT_IN_OFFSET.centi_degrees, nullptr},
+    {"Cut Out", "Below Target", &dirty_config.cut_out_offset, true, CUT_OUT_OFFSET_INCREMENT.centi_degrees, MIN_CUT_OUT_OFFSET.centi_degrees, MAX_CUT_OUT_OFFSET.centi_degrees, nullptr},
+    {"Dead Time", "Minutes", &dirty_config.compressor_dead_time, false, COMPRESSOR_DEAD_TIME_INCREMENT, MIN_COMPRESSOR_DEAD_TIME, MAX_COMPRESSOR_DEAD_TIME, nullptr},
+    {"Min Runtime", "Minutes", &dirty_config.compressor_min_run_time, false, COMPRESSOR_MIN_RUNTIME_INCREMENT, MIN_COMPRESSOR_MIN_RUNTIME, MAX_COMPRESSOR_MIN_RUNTIME, nullptr},
+    {"Max Runtime", "Minutes", &dirty_config.compressor_max_run_time, false, COMPRESSOR_MAX_RUNTIME_INCREMENT, MIN_COMPRESSOR_MAX_RUNTIME, MAX_COMPRESSOR_MAX_RUNTIME, nullptr},
+    {"Max Comp Temp", "Degrees C", &dirty_config.compressor_max_temp, true, COMPRESSOR_MAX_TEMP_INCREMENT.centi_degrees, MIN_COMPRESSOR_MAX_TEMP.centi_degrees, MAX_COMPRESSOR_MAX_TEMP.centi_degrees, nullptr},
+    {"Startup Delay", "Minutes", &dirty_config.freezer_startup_delay, false, FREEZER_STARTUP_DELAY_INCREMENT, MIN_FREEZER_STARTUP_DELAY, MAX_FREEZER_STARTUP_DELAY, nullptr},
+#ifdef WITH_DEMAND_RESPONSE
+    {"DR Allowance", "Above Target", &dirty_config.demand_response_allowance, true, DEMAND_RESPONSE_ALLOWANCE_INCREMENT.centi_degrees, MIN_DEMAND_RESPONSE_ALLOWANCE.centi_degrees, MAX_DEMAND_RESPONSE_ALLOWANCE.centi_degrees, nullptr},
+#endif
+#ifdef WITH_BOOST
+    {"Boost Temp", "Degrees C", &dirty_config.boost_target_temperature, true, BOOST_TEMPERATURE_INCREMENT.centi_degrees, MIN_BOOST_TEMPERATURE.centi_degrees, MAX_BOOST_TEMPERATURE.centi_degrees, nullptr},
+    {"Boost Time", "Minutes", &dirty_config.boost_duration, false, BOOST_DURATION_INCREMENT, MIN_BOOST_DURATION, MAX_BOOST_DURATION, nullptr},
+#endif
+#ifdef WITH_DEFROST
+    {"Defrost", "Mode", &dirty_config.defrost_mode, false, 1, defrost_mode::defrost_off, defrost_mode::defrost_adaptive, defrost_mode_strings},
+    {"Defrost Every", "Hours", &dirty_config.defrost_interval, false, DEFROST_INTERVAL_INCREMENT, MIN_DEFROST_INTERVAL, MAX_DEFROST_INTERVAL, nullptr},
+    {"Defrost Time", "Max Minutes", &dirty_config.defrost_timeout, false, DEFROST_TIMEOUT_INCREMENT, MIN_DEFROST_TIMEOUT, MAX_DEFROST_TIMEOUT, nullptr},
+    {"Defrost End", "Degrees C", &dirty_config.defrost_termination_temperature, true, DEFROST_TERMINATION_TEMPERATURE_INCREMENT.centi_degrees, MIN_DEFROST_TERMINATION_TEMPERATURE.centi_degrees, MAX_DEFROST_TERMINATION_TEMPERATURE.centi_degrees, nullptr},
+#endif
+#ifdef WITH_ALARMS
+    {"High Alarm", "Degrees C", &dirty_config.high_alarm_temperature, true, HIGH_ALARM_TEMPERATURE_INCREMENT.centi_degrees, MIN_HIGH_ALARM_TEMPERATURE.centi_degrees, MAX_HIGH_ALARM_TEMPERATURE.centi_degrees, nullptr},
+    {"High Delay", "Minutes", &dirty_config.high_alarm_delay, false, ALARM_DELAY_INCREMENT, MIN_ALARM_DELAY, MAX_ALARM_DELAY, nullptr},
+    {"Low Alarm", "Degrees C", &dirty_config.low_alarm_temperature, true, LOW_ALARM_TEMPERATURE_INCREMENT.centi_degrees, MIN_LOW_ALARM_TEMPERATURE.centi_degrees, MAX_LOW_ALARM_TEMPERATURE.centi_degrees, nullptr},
+    {"Low Delay", "Minutes", &dirty_config.low_alarm_delay, false, ALARM_DELAY_INCREMENT, MIN_ALARM_DELAY, MAX_ALARM_DELAY, nullptr},
+#endif
+#ifdef WITH_LOAD_EVENTS
+    {"Load Start", "Door / Stock", &dirty_config.load_event_start, false, 1, 0, 1, off_on_strings},
+#endif
+#ifdef WITH_STATISTICS
+    {"Comp Power", "Watts", &dirty_config.compressor_power, false, COMPRESSOR_POWER_INCREMENT, MIN_COMPRESSOR_POWER, MAX_COMPRESSOR_POWER, nullptr},
+#endif
+#ifdef WITH_STARTUP_JITTER
+    {"Start Jitter", "Max Minutes", &dirty_config.startup_jitter, false, STARTUP_JITTER_INCREMENT, MIN_STARTUP_JITTER, MAX_STARTUP_JITTER, nullptr},
+#endif
+};
+
+bool reset_by_watchdog = false;
+
+// set once the min runtime had to keep the current run going, so each run is only counted once
+bool short_cycle_prevented = false;
+
+// a screen that isn't built in takes the number of the one before it, its branch in refresh_display() is left out with it
+const uint8_t HOME_SCREEN = 0;
+const uint8_t INFO_SCREEN = sizeof(menu_entries) / sizeof(menu_entries[0]) + 1; // the config screens are in between
+
+#ifdef WITH_STATISTICS
+const uint8_t STATISTICS_SCREEN = INFO_SCREEN + 1;
+#else
+const uint8_t STATISTICS_SCREEN = INFO_SCREEN;
+#endif
+
+#ifdef WITH_CALIBRATION
+const uint8_t CALIBRATION_SCREEN = STATISTICS_SCREEN + 1;
+#else
+const uint8_t CALIBRATION_SCREEN = STATISTICS_SCREEN;
+#endif
+
+#ifdef WITH_PROFILES
+const uint8_t PROFILE_SCREEN = CALIBRATION_SCREEN + 1; // last, so it's one step back from the home screen
+#else
+const uint8_t PROFILE_SCREEN = CALIBRATION_SCREEN;
+#endif
+
+const uint8_t LAST_SCREEN = PROFILE_SCREEN;
+
+// --------------------------------------
+// Function Definitions
+
+void initialize_thermistors();
+
+void load_calibration();
+
+void save_calibration();
+
+void load_thermal_model();
+
+void load_statistics();
+
+void save_statistics();
+
+void save_thermal_model();
+
+void reset_calibration();
+
+void rebuild_ntc_tables();
+
+bool build_ntc_table(const ntc_coefficients& coefficients, temperature* table);
+
+temperature ntc_coefficients_to_temperature(const ntc_coefficients& coefficients, uint16_t adc_sum);
+
+bool solve_ntc_coefficients(const calibration_point* points, uint8_t count, ntc_coefficients* result);
+
+
+void initialize_display();
+
+void initialize_status_leds();
+
+void initialize_logging();
+
+void initialize_rtc();
+
+void initialize_watchdog();
+
+void initialize_compressor();
+
+void initialize_startup_jitter();
+
+void initialize_input();
+
+void load_config();
+
+void save_dirty_config();
+
+freezer_config get_default_profile_config(uint8_t profile);
+
+int get_profile_address(uint8_t profile);
+
+bool load_profile(uint8_t profile, freezer_config& config);
+
+void save_profile(uint8_t profile, const freezer_config& config);
+
+void select_profile(uint8_t profile);
+
+void read_sensors();
+
+volatile void log_state();
+
+void update_state();
+
+uint16_t sample_control_inputs();
+
+uint8_t find_control_transition(uint8_t status, uint16_t inputs);
+
+control_transition get_control_transition(uint8_t row);
+
+void run_compressor();
+
+void hold_compressor();
+
+void stop_compressor();
+
+void enforce_min_runtime();
+
+void defer_compressor_start();
+
+void check_sensor_plausibility();
+
+void update_cabinet_estimate();
+
+bool is_compressor_cooling();
+
+void update_thermal_model();
+
+void update_compressor_temperature_rate();
+
+void update_load_event_detector();
+
+void update_statistics();
+
+void fit_thermal_model();
+
+bool is_thermal_model_ready();
+
+temperature get_cut_off_temperature();
+
+sensor_stage get_sensor_stage(uint8_t channel);
+
+bool is_sensor_disconnected(uint8_t channel);
+
+temperature temperature_from_celsius(double celsius);
+
+char* format_temperature(temperature value, int8_t width, uint8_t decimals, char* buffer);
+
+bool is_compressor_overheating();
+
+bool is_compressor_recovering_from_overheat();
+
+bool is_startup_delay_over();
+
+bool is_compressor_on();
+
+bool is_within_target_temperature();
+
+temperature get_target_temperature();
+
+void set_boost(bool active);
+
+void update_boost();
+
+void update_defrost();
+
+void measure_pull_down_rate();
+
+bool is_defrost_due();
+
+void set_defrost(bool active);
+
+void load_alarms();
+
+void save_alarms();
+
+void update_alarms();
+
+void raise_alarm(uint8_t alarm);
+
+void clear_alarm(uint8_t alarm);
+
+void acknowledge_alarms();
+
+void update_alarm_indicator();
+
+void load_compressor_health();
+
+void save_compressor_health();
+
+void update_compressor_health(int32_t pull_down_rate, uint32_t run_time);
+
+uint8_t get_health_score(uint8_t* flags);
+
+bool should_band_compressor_run();
+
+bool has_hysteresis_time_elapsed();
+
+bool has_compressor_exceeded_max_runtime();
+
+bool is_within_min_runtime();
+
+bool can_defer_compressor_start();
+
+bool has_dead_time_elapsed();
+
+void set_compressor(bool state);
+
+void record_compressor_cycle(uint32_t on_duration, uint32_t off_duration);
+
+bool get_average_compressor_cycle(uint32_t* on_duration, uint32_t* off_duration);
+
+bool is_in_fallback_mode();
+
+bool should_fallback_compressor_run();
+
+void handle_input();
+
+void on_button_pressed();
+
+void show_centered_text(const char *text, uint8_t font_size, int16_t x_offset = 0, int16_t y_offset = 0, uint16_t color = GC9A01A_WHITE);
+
+void show_centered_text_P(const char *text, uint8_t font_size, int16_t x_offset = 0, int16_t y_offset = 0, uint16_t color = GC9A01A_WHITE);
+
+menu_entry get_menu_entry(uint8_t index);
+
+void refresh_display();
+
+void display_home_screen();
+
+void display_info_screen();
+
+void display_statistics_screen();
+
+void display_profile_screen();
+
+void display_calibration_screen();
+
+void on_calibration_rotated(bool direction);
+
+void on_calibration_button_pressed();
+
+bool init_sd_card();
+
+bool save_data_point(const freezer_state_data_point* data);
+
+bool wait_card_busy();
+
+void send_card_command(uint8_t cmd, uint32_t arg, uint8_t crc);
+
+uint8_t read_card_response();
+
+bool read_card_block(uint32_t block_addr, uint8_t* buffer, uint16_t buffer_size);
+
+bool write_card_block(uint32_t block_addr, const void* buffer, uint16_t buffer_size);
+
+uint8_t calculate_crc8(const uint8_t *data, uint8_t len);
+
+// --------------------------------------
+// Control Transitions
+
+// checked top to bottom every update, the first row that matches the current status and whose guard holds wins.
+// the order is the priority, protecting the compressor comes before anything the cabinet wants.
+// it's in flash, the compile time checks below still see it but at run time it's read with get_control_transition()
+constexpr control_transition control_transitions[] PROGMEM = {
+    {ANY_STATUS, input_startup_delay, 0, freezer_status::startup_delay, stop_compressor},
+    {ANY_STATUS, input_probe_failed, 0, freezer_status::sensor_failure, stop_compressor},
+    {ANY_STATUS, input_defrost, 0, freezer_status::defrost, stop_compressor},
+    // once the max runtime is hit we stay stopped for the whole dead time, even if the demand goes away & comes back
+    {freezer_status::compressor_max_runtime, input_dead_time, input_compressor_on, freezer_status::compressor_max_runtime, stop_compressor},
+    // same for an overheat, until it cooled down through the recovery band and rested
+    {freezer_status::overheat, input_overheat_recovering, 0, freezer_status::overheat, stop_compressor},
+    {ANY_STATUS, input_demand | input_overheating, 0, freezer_status::overheat, hold_compressor},
+    // without the demand too, or an overheat that comes with reaching the target is just a normal stop & skips the recovery
+    {ANY_STATUS, input_overheating, 0, freezer_status::overheat, stop_compressor},
+    {ANY_STATUS, input_demand | input_max_runtime, 0, freezer_status::compressor_max_runtime, hold_compressor},
+    {ANY_STATUS, input_demand | input_dead_time, input_compressor_on, freezer_status::dead_time, hold_compressor},
+    // only new starts are deferred, a running compressor finishes its cycle
+    {ANY_STATUS, input_demand | input_demand_response, input_compressor_on, freezer_status::demand_deferred, defer_compressor_start},
+    // stopping a compressor that only just started is the worst case for wear, unless it's overheating
+    {ANY_STATUS, input_min_runtime, input_demand | input_overheating, freezer_status::min_runtime, enforce_min_runtime},
+    {ANY_STATUS, input_fallback | input_demand, 0, freezer_status::sensor_fallback, run_compressor},
+    {ANY_STATUS, input_fallback, 0, freezer_status::sensor_fallback, stop_compressor},
+    // the overheat check is using the last plausible reading, so make that visible
+    {ANY_STATUS, input_probe_degraded | input_demand, 0, freezer_status::sensor_degraded, run_compressor},
+    {ANY_STATUS, input_probe_degraded, 0, freezer_status::sensor_degraded, stop_compressor},
+    {ANY_STATUS, input_boost | input_demand, 0, freezer_status::boost, run_compressor},
+    {ANY_STATUS, input_boost, 0, freezer_status::boost, stop_compressor},
+    {ANY_STATUS, input_demand, 0, freezer_status::cooling, run_compressor},
+    {ANY_STATUS, 0, 0, freezer_status::reached_target, stop_compressor},
+};
+
+const uint8_t CONTROL_TRANSITION_COUNT = sizeof(control_transitions) / sizeof(control_transitions[0]);
+
+// the checks below are written as single-return recursion since that's all a c++11 constexpr function can do
+
+constexpr bool does_transition_apply(uint8_t row, uint8_t status)
+{
+  return control_transitions[row].from == ANY_STATUS || control_transitions[row].from == status;
+}
+
+// a row whose guard is at least as loose as a later row's, for the same statuses, always matches first
+constexpr bool does_transition_cover(uint8_t row, uint8_t later_row)
+{
+  return (control_transitions[row].from == ANY_STATUS || control_transitions[row].from == control_transitions[later_row].from)
+      && (control_transitions[row].all_of & ~control_transitions[later_row].all_of) == 0
+      && (control_transitions[row].none_of & ~control_transitions[later_row].none_of) == 0;
+}
+
+constexpr bool is_transition_shadowed(uint8_t row, uint8_t earlier_row = 0)
+{
+  return earlier_row < row && (does_transition_cover(earlier_row, row) || is_transition_shadowed(row, earlier_row + 1));
+}
+
+constexpr bool can_every_transition_fire(uint8_t row = 0)
+{
+  return row >= CONTROL_TRANSITION_COUNT
+      || ((control_transitions[row].all_of & control_transitions[row].none_of) == 0
+          && control_transitions[row].to < FREEZER_STATUS_COUNT
+          && !is_transition_shadowed(row)
+          && can_every_transition_fire(row + 1));
+}
+
+constexpr bool has_unconditional_transition(uint8_t status, uint8_t row = 0)
+{
+  return row < CONTROL_TRANSITION_COUNT
+      && ((does_transition_apply(row, status) && control_transitions[row].all_of == 0 && control_transitions[row].none_of == 0)
+          || has_unconditional_transition(status, row + 1));
+}
+
+constexpr bool does_every_status_have_a_way_out(uint8_t status = 0)
+{
+  return status >= FREEZER_STATUS_COUNT || (has_unconditional_transition(status) && does_every_status_have_a_way_out(status + 1));
+}
+
+constexpr uint16_t add_reachable_statuses(uint16_t reachable, uint8_t row = 0)
+{
+  return row >= CONTROL_TRANSITION_COUNT ? reachable :
+         add_reachable_statuses(control_transitions[row].from == ANY_STATUS || (reachable & (1 << control_transitions[row].from))
+                                ? reachable | (1 << control_transitions[row].to) : reachable, row + 1);
+}
+
+constexpr uint16_t find_reachable_statuses(uint16_t reachable, uint8_t iterations = FREEZER_STATUS_COUNT)
+{
+  return iterations == 0 ? reachable : find_reachable_statuses(add_reachable_statuses(reachable), iterations - 1);
+}
+
+static_assert(can_every_transition_fire(), "a control transition can never fire, its guard contradicts itself or an earlier row always matches first");
+static_assert(does_every_status_have_a_way_out(), "every status needs an unconditional transition, otherwise an update could leave the compressor undecided");
+static_assert(find_reachable_statuses(1 << freezer_status::off) == (1 << FREEZER_STATUS_COUNT) - 1, "every status has to be reachable from off");
+
+// --------------------------------------
+
+void setup()
+{
+  initialize_watchdog();
+  initialize_status_leds();
+
+  load_config();
+#ifdef WITH_THERMAL_MODEL
+  load_thermal_model();
+#endif
+#ifdef WITH_STATISTICS
+  load_statistics();
+#endif
+#ifdef WITH_ALARMS
+  load_alarms();
+#endif
+#ifdef WITH_HEALTH
+  load_compressor_health();
+#endif
+
+  initialize_logging();
   initialize_display();
   initialize_thermistors();
   initialize_compressor();
+#ifdef WITH_STARTUP_JITTER
+  initialize_startup_jitter();
+#endif
 //  initialize_rtc();
   initialize_input();
 
 
-  showing_new_screen = true;
-  screen_should_refresh = true;
-}
+  showing_new_screen = true;
+  screen_should_refresh = true;
+}
+
+void loop()
+{
+  if(hal_millis() - state_updated_at >= 1000) // we refresh once a second, which is more than needed
+  {
+    if(config_is_dirty)
+    {
+      active_config = dirty_config;
+      config_is_dirty = false;
+    }
+
+    hal_profile_begin(hal_profile_section::profile_update_state);
+    update_state();
+    hal_profile_end(hal_profile_section::profile_update_state);
+
+    state_updated_at = hal_millis();
+  }
+
+  handle_input();
+  update_alarm_indicator();
+
+  hal_profile_begin(hal_profile_section::profile_refresh_display);
+  refresh_display();
+  hal_profile_end(hal_profile_section::profile_refresh_display);
+
+  hal_reset_watchdog();
+}
+
+// --------------------------------------
+
+void initialize_thermistors()
+{
+  // Serial.println("initialize_thermistors()");
+
+#ifdef WITH_CALIBRATION
+  load_calibration();
+#else
+  reset_calibration(); // the datasheet curve
+#endif
+  rebuild_ntc_tables();
+}
+
+void initialize_display()
+{
+  // Serial.println("initialize_display()");
+
+  tft.begin();
+  tft.setRotation(1);
+  tft.fillScreen(GC9A01A_BLACK);
+  tft.setTextWrap(false);
+}
+
+void initialize_status_leds()
+{
+  hal_pin_mode(BLUE_LED_PIN, OUTPUT);
+  hal_pin_mode(RED_LED_PIN, OUTPUT);
+
+  if(BUZZER_PIN >= 0)
+  {
+    hal_pin_mode(BUZZER_PIN, OUTPUT);
+  }
+}
+
+void initialize_logging()
+{
+  // Serial.println("initialize_logging()");
+
+  if(init_sd_card())
+  {
+    // Serial.println("initialize_logging(): successfully initialized sd card, enabling logging");
+    logging_enabled = true;
+  }
+  else
+  {
+    // Serial.println("initialize_logging(): could not initialize sd card, logging is disabled");
+  }
+}
+
+void initialize_compressor()
+{
+  // Serial.println("initialize_compressor()");
+
+  hal_pin_mode(COMPRESSOR_RELAY, OUTPUT);
+  hal_digital_write(COMPRESSOR_RELAY, LOW);
+}
+
+void initialize_startup_jitter()
+{
+  // Serial.println("initialize_startup_jitter()");
+
+  // every unit on the site boots at the same moment with the same config & the same firmware, so hal_micros() is no
+  // help either. what is different is the probes, no two cabinets or compressors sit at the exact same temperature, so
+  // their raw readings get folded into a seed that's kept in the eeprom & moved on every boot. a new chip starts at
+  // 0xFFFFFFFF like every other one, the readings are what sets it apart from then on
+  uint32_t seed = 0;
+  hal_storage_get(STARTUP_JITTER_SEED_EEPROM_ADDRESS, seed);
+
+  for(uint8_t i = 0; i < STARTUP_JITTER_SEED_SAMPLES; i++)
+  {
+    seed = (seed << 5 | seed >> 27) ^ hal_analog_read(THERMISTOR_1_PIN) ^ ((uint32_t)hal_analog_read(THERMISTOR_2_PIN) << 16);
+  }
+
+  seed = (seed ^ hal_micros()) * 1103515245UL + 12345;
+
+  // only the bytes that changed are written, 4 at most per boot
+  hal_storage_put(STARTUP_JITTER_SEED_EEPROM_ADDRESS, seed);
+
+  randomSeed(seed);
+
+  // a change to the jitter from the menu is only picked up on the next boot, which is the only time it matters
+  startup_jitter_ms = random((int32_t)active_config.startup_jitter * 60 * 1000 + 1);
+}
+
+void initialize_input()
+{
+  // Serial.println("initialize_input()");
+
+  hal_pin_mode(ROTARY_SW, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(ROTARY_SW), on_button_pressed, RISING);
+
+#ifdef WITH_DEMAND_RESPONSE
+  hal_pin_mode(DEMAND_RESPONSE_PIN, INPUT_PULLUP);
+#endif
+}
+
+void initialize_watchdog()
+{
+  reset_by_watchdog = hal_start_watchdog();
+}
+
+//void initialize_rtc()
+//{
+// // Serial.println("initialize_rtc()");
+//
+// rtc_clock.Begin();
+//
+// RtcDateTime compiled = RtcDateTime(__DATE__, __TIME__);
+//
+// if (!rtc_clock.IsDateTimeValid())
+// {
+//   // Serial.println("initialize_rtc(): RTC lost confidence in the DateTime!");
+//   rtc_clock.SetDateTime(compiled);
+// }
+//
+// if (rtc_clock.GetIsWriteProtected())
+// {
+//     // Serial.println("initialize_rtc(): RTC was write protected, enabling writing now");
+//     rtc_clock.SetIsWriteProtected(false);
+// }
+//
+// if (!rtc_clock.GetIsRunning())
+// {
+//     // Serial.println("initialize_rtc(): RTC was not actively running, starting now");
+//     rtc_clock.SetIsRunning(true);
+// }
+//
+// RtcDateTime now = rtc_clock.GetDateTime();
+// if (now < compiled)
+// {
+//     // Serial.println("initialize_rtc(): RTC is older than compile time!  (Updating DateTime)");
+//     rtc_clock.SetDateTime(compiled);
+// }
+//}
+
+// --------------------------------------
+
+void load_config()
+{
+  // Serial.println("load_config()");
+
+  // make sure every profile is valid, any that isn't is reset to its default
+  bool profile_was_reset = false;
+
+#ifdef WITH_PROFILES
+  freezer_config config;
+
+  for(uint8_t i = 0; i < PROFILE_COUNT; i++)
+  {
+    if(!load_profile(i, config))
+    {
+      // Serial.println("load_config(): profile in eeprom is invalid, resetting back to default values");
+
+      save_profile(i, get_default_profile_config(i));
+      profile_was_reset = true;
+    }
+  }
+#else
+  // without the profile screen only the standard one is used, the others are left alone for a build that has it
+  if(!load_profile(config_profile::profile_standard, dirty_config))
+  {
+    // Serial.println("load_config(): profile in eeprom is invalid, resetting back to default values");
+
+    dirty_config = freezer_config();
+    save_profile(config_profile::profile_standard, dirty_config);
+    profile_was_reset = true;
+  }
+#endif
+
+  if(profile_was_reset)
+  {
+    // we flash the LEDs just to indicate that we are resetting the config
+
+    hal_digital_write(BLUE_LED_PIN, HIGH);
+    hal_digital_write(RED_LED_PIN, HIGH);
+
+    hal_delay(1000);
+
+    hal_digital_write(BLUE_LED_PIN, LOW);
+    hal_digital_write(RED_LED_PIN, LOW);
+  }
+
+#ifdef WITH_PROFILES
+  profile_selection selection;
+  hal_storage_get(PROFILE_SELECTION_EEPROM_ADDRESS, selection);
+
+  if(memcmp(selection.magic_bytes, "PSL1", 4) != 0
+      || selection.crc != calculate_crc8((uint8_t*)&selection, offsetof(profile_selection, crc))
+      || selection.active_profile >= PROFILE_COUNT)
+  {
+    // Serial.println("load_config(): profile selection is invalid, using the standard profile");
+
+    select_profile(config_profile::profile_standard);
+  }
+  else
+  {
+    // restoring the selection after a reset isn't a change
+    current_state.active_profile = selection.active_profile;
+    select_profile(selection.active_profile);
+  }
+#endif
+
+  // nothing has run yet, so the config can be applied right away
+  active_config = dirty_config;
+  config_is_dirty = false;
+}
+
+void save_dirty_config()
+{
+  // Serial.println("save_dirty_config()");
+
+  save_profile(current_state.active_profile, dirty_config);
+}
+
+freezer_config get_default_profile_config(uint8_t profile)
+{
+  freezer_config config;
+
+  if(profile == config_profile::profile_deep_freeze)
+  {
+    config.target_temperature = MIN_TARGET_TEMPERATURE;
+    config.boost_target_temperature = degrees(-30);
+  }
+  else if(profile == config_profile::profile_eco)
+  {
+    // a wider band means fewer, longer runs
+    config.target_temperature = degrees(-15);
+    config.hysteresis_mode = hysteresis_mode::band_hysteresis;
+    config.cut_in_offset = degrees(2);
+    config.cut_out_offset = degrees(1);
+  }
+
+  return config;
+}
+
+int get_profile_address(uint8_t profile)
+{
+  return PROFILES_EEPROM_ADDRESS + profile * sizeof(stored_profile);
+}
+
+bool load_profile(uint8_t profile, freezer_config& config)
+{
+  stored_profile profile_data;
+  hal_storage_get(get_profile_address(profile), profile_data);
+
+  if(memcmp(profile_data.config.magic_bytes, "F012", 4) != 0 || profile_data.crc != calculate_crc8((uint8_t*)&profile_data.config, sizeof(freezer_config)))
+  {
+    return false;
+  }
+
+  config = profile_data.config;
+
+  return true;
+}
+
+void save_profile(uint8_t profile, const freezer_config& config)
+{
+  stored_profile profile_data;
+
+  profile_data.config = config;
+  profile_data.crc = calculate_crc8((uint8_t*)&profile_data.config, sizeof(freezer_config));
+
+  hal_storage_put(get_profile_address(profile), profile_data);
+}
+
+void select_profile(uint8_t profile)
+{
+  // Serial.println("select_profile()");
+
+  // load_config() already made sure every profile is valid, this is just in case the eeprom went bad since
+  if(!load_profile(profile, dirty_config))
+  {
+    dirty_config = get_default_profile_config(profile);
+    save_profile(profile, dirty_config);
+  }
+
+  config_is_dirty = true;
+
+  if(current_state.active_profile != profile)
+  {
+    current_state.active_profile = profile;
+    current_state.events |= event_profile_changed;
+  }
+
+  profile_selection selection;
+  selection.active_profile = profile;
+  selection.crc = calculate_crc8((uint8_t*)&selection, offsetof(profile_selection, crc));
+
+  hal_storage_put(PROFILE_SELECTION_EEPROM_ADDRESS, selection);
+}
+
+void load_calibration()
+{
+  // Serial.println("load_calibration()");
+
+  ntc_calibration calibration_data;
+  hal_storage_get(CALIBRATION_EEPROM_ADDRESS, calibration_data);
+
+  if(memcmp(calibration_data.magic_bytes, "CAL2", 4) != 0 || calibration_data.channel_count != NTC_CHANNEL_COUNT)
+  {
+    // Serial.println("load_calibration(): no calibration in eeprom, using the datasheet b values");
+
+    // nothing is written back here since the defaults are derived from the constants anyway
+    reset_calibration();
+  }
+  else
+  {
+    active_calibration = calibration_data;
+  }
+}
+
+void save_calibration()
+{
+  // Serial.println("save_calibration()");
+
+  hal_storage_put(CALIBRATION_EEPROM_ADDRESS, active_calibration);
+}
+
+void load_thermal_model()
+{
+  // Serial.println("load_thermal_model()");
+
+  thermal_model model_data;
+  hal_storage_get(THERMAL_MODEL_EEPROM_ADDRESS, model_data);
+
+  if(memcmp(model_data.magic_bytes, "TMD1", 4) != 0)
+  {
+    // Serial.println("load_thermal_model(): no thermal model in eeprom, starting from scratch");
+
+    active_thermal_model = thermal_model();
+  }
+  else
+  {
+    active_thermal_model = model_data;
+  }
+
+  estimator.cooling_rate = active_thermal_model.cooling_rate;
+  estimator.warming_rate = active_thermal_model.warming_rate;
+}
+
+void save_thermal_model()
+{
+  // Serial.println("save_thermal_model()");
+
+  active_thermal_model.cooling_rate = estimator.cooling_rate;
+  active_thermal_model.warming_rate = estimator.warming_rate;
+
+  hal_storage_put(THERMAL_MODEL_EEPROM_ADDRESS, active_thermal_model);
+}
+
+void load_statistics()
+{
+  // Serial.println("load_statistics()");
+
+  bool found = false;
+
+  for(uint8_t i = 0; i < STATISTICS_EEPROM_SLOTS; i++)
+  {
+    compressor_statistics slot_data;
+    hal_storage_get(STATISTICS_EEPROM_ADDRESS + i * sizeof(compressor_statistics), slot_data);
+
+    // a slot that was being written when the power went out fails the crc, we just use the one before it
+    if(memcmp(slot_data.magic_bytes, "STA1", 4) != 0 || slot_data.crc != calculate_crc8((uint8_t*)&slot_data, offsetof(compressor_statistics, crc)))
+    {
+      continue;
+    }
+
+    if(!found || slot_data.sequence > active_statistics.sequence)
+    {
+      active_statistics = slot_data;
+      statistics_slot = i;
+      found = true;
+    }
+  }
+
+  if(!found)
+  {
+    // Serial.println("load_statistics(): no statistics in eeprom, starting from zero");
+
+    active_statistics = compressor_statistics();
+  }
+}
+
+void save_statistics()
+{
+  // Serial.println("save_statistics()");
+
+  statistics_slot = (statistics_slot + 1) % STATISTICS_EEPROM_SLOTS;
+
+  active_statistics.sequence++;
+  active_statistics.crc = calculate_crc8((uint8_t*)&active_statistics, offsetof(compressor_statistics, crc));
+
+  hal_storage_put(STATISTICS_EEPROM_ADDRESS + statistics_slot * sizeof(compressor_statistics), active_statistics);
+}
+
+void reset_calibration()
+{
+  active_calibration = ntc_calibration();
+
+  for(uint8_t i = 0; i < NTC_CHANNEL_COUNT; i++)
+  {
+    active_calibration.channels[i] = freezer_sensor_array::default_coefficients(i);
+  }
+}
+
+// --------------------------------------
+
+bool is_compressor_overheating()
+{
+  temperature compressor_temperature = current_state.ntc_temperatures[COMPRESSOR_NTC];
+
+  if(compressor_temperature >= active_config.compressor_max_temp)
+  {
+    return true;
+  }
+
+  // stop before the limit if it's going to get there soon anyway
+  if(is_compressor_on() && compressor_temperature >= active_config.compressor_max_temp - OVERHEAT_PREDICTION_MARGIN)
+  {
+    int32_t predicted_peak = (int32_t)compressor_temperature.centi_degrees + (int32_t)current_state.compressor_temperature_rate * OVERHEAT_LOOKAHEAD_MINUTES;
+    return predicted_peak >= active_config.compressor_max_temp.centi_degrees;
+  }
+
+  return false;
+}
+
+bool is_compressor_recovering_from_overheat()
+{
+  if(current_state.ntc_temperatures[COMPRESSOR_NTC] > active_config.compressor_max_temp - OVERHEAT_RECOVERY_BAND)
+  {
+    return true;
+  }
+
+  // compressor_turned_off_at is 0 until the first stop, so after a reset the rest counts from the reset
+  return !is_compressor_on() && hal_millis() - compressor_turned_off_at < MIN_OVERHEAT_REST_TIME;
+}
+
+bool is_startup_delay_over()
+{
+  return hal_millis() >= ((uint32_t)active_config.freezer_startup_delay * 60 * 1000) + startup_jitter_ms;
+}
+
+bool is_compressor_on()
+{
+  return current_state.actual_compressor_state;
+}
+
+bool is_within_target_temperature()
+{
+  return current_state.estimated_cabinet_temperature <= get_target_temperature();
+}
+
+temperature get_target_temperature()
+{
+  return boost_active ? active_config.boost_target_temperature : active_config.target_temperature;
+}
+
+#ifdef WITH_BOOST
+void set_boost(bool active)
+{
+  if(active == boost_active)
+  {
+    return;
+  }
+
+  boost_active = active;
+  boost_started_at = hal_millis();
+
+  current_state.events |= active ? event_boost_started : event_boost_ended;
+  screen_should_refresh = true;
+}
+
+void update_boost()
+{
+  if(boost_active && hal_millis() - boost_started_at >= (uint32_t)active_config.boost_duration * 60 * 1000)
+  {
+    set_boost(false);
+  }
+}
+#endif
+
+bool should_band_compressor_run()
+{
+  if(current_state.estimated_cabinet_temperature >= get_target_temperature() + active_config.cut_in_offset)
+  {
+    return true;
+  }
+
+  // the timed mode deliberately runs past the target, so the predictive cut off is only used here
+  if(get_cut_off_temperature() <= get_target_temperature() - active_config.cut_out_offset)
+  {
+    return false;
+  }
+
+  // inside the band we keep doing whatever we were doing
+  return is_compressor_on();
+}
+
+bool has_hysteresis_time_elapsed()
+{
+  return hal_millis() - reached_target_temperature_at >= ((uint32_t)active_config.target_temperature_hysteresis_time * 1000);
+}
+
+bool has_compressor_exceeded_max_runtime()
+{
+  // staying stopped for the dead time afterwards is handled by the compressor_max_runtime transition
+  uint32_t max_run_time = active_config.compressor_max_run_time;
+
+  if(boost_active)
+  {
+    max_run_time = min(max_run_time + BOOST_MAX_RUNTIME_EXTENSION, (uint32_t)MAX_COMPRESSOR_MAX_RUNTIME);
+  }
+
+  return is_compressor_on() && hal_millis() - compressor_turned_on_at >= max_run_time * 1000 * 60;
+}
+
+bool is_within_min_runtime()
+{
+  return is_compressor_on() && hal_millis() - compressor_turned_on_at < ((uint32_t)active_config.compressor_min_run_time * 1000 * 60);
+}
+
+bool can_defer_compressor_start()
+{
+  if(hal_digital_read(DEMAND_RESPONSE_PIN) == HIGH)
+  {
+    demand_response_requested_at = 0;
+    compressor_start_deferred = false;
+    return false;
+  }
+
+  if(demand_response_requested_at == 0)
+  {
+    demand_response_requested_at = hal_millis();
+  }
+
+  // without a cabinet reading we don't know how much of the allowance is left
+  if(active_config.demand_response_allowance == degrees(0) || is_in_fallback_mode())
+  {
+    return false;
+  }
+
+  // once the request has gone on for too long we stop deferring until it's lifted and asked for again
+  if(hal_millis() - demand_response_requested_at >= MAX_DEMAND_RESPONSE_DEFERRAL)
+  {
+    return false;
+  }
+
+  temperature limit = min(get_target_temperature() + active_config.demand_response_allowance, MAX_DEMAND_RESPONSE_TEMPERATURE);
+  return current_state.estimated_cabinet_temperature < limit;
+}
+
+bool has_dead_time_elapsed()
+{
+  // the compressor hasn't been turned off since the last reset, but it might have been running right before it
+  // (a power cut or the watchdog), so the dead time counts from the reset instead of being skipped
+  if(compressor_turned_off_at == 0)
+  {
+    return hal_millis() >= ((uint32_t)active_config.compressor_dead_time * 1000 * 60);
+  }
+
+  return hal_millis() - compressor_turned_off_at >= ((uint32_t)active_config.compressor_dead_time * 1000 * 60);
+}
+
+void update_state()
+{
+#ifdef WITH_STATISTICS
+  // accounts for the time since the last update, so it has to run before the compressor is switched
+  update_statistics();
+#endif
+
+  read_sensors();
+  check_sensor_plausibility();
+  update_cabinet_estimate();
+#ifdef WITH_THERMAL_MODEL
+  update_thermal_model();
+#endif
+  update_compressor_temperature_rate();
+#ifdef WITH_LOAD_EVENTS
+  update_load_event_detector();
+#endif
+#ifdef WITH_BOOST
+  update_boost();
+#endif
+#if defined(WITH_DEFROST) || defined(WITH_HEALTH)
+  // the adaptive defrost & the health both go by it, so it's ahead of the defrost
+  measure_pull_down_rate();
+#endif
+#ifdef WITH_DEFROST
+  update_defrost();
+#endif
+#ifdef WITH_ALARMS
+  update_alarms();
+#endif
+
+  control_transition transition = get_control_transition(find_control_transition(current_state.status, sample_control_inputs()));
+
+  current_state.status = transition.to;
+  transition.action();
+
+  log_state();
+  current_state.events = 0;
+
+  // the config screens aren't redrawn during the startup delay, it only changes the home & info screens
+  if(current_state.status != freezer_status::startup_delay || screen_index == HOME_SCREEN || screen_index == INFO_SCREEN || screen_index == STATISTICS_SCREEN)
+  {
+    screen_should_refresh = true;
+  }
+}
+
+uint16_t sample_control_inputs()
+{
+  uint16_t inputs = 0;
+
+  // we are saving startup_delay_over into a variable to make we dont get affected by millis() rolling over after 50 days or so
+  if(!startup_delay_over)
+  {
+    startup_delay_over = is_startup_delay_over();
+  }
+
+  if(!startup_delay_over)
+  {
+    inputs |= input_startup_delay;
+  }
+
+  if(get_sensor_stage(COMPRESSOR_NTC) == sensor_stage::sensor_failed)
+  {
+    inputs |= input_probe_failed;
+  }
+  else if(get_sensor_stage(COMPRESSOR_NTC) == sensor_stage::sensor_degraded_stage)
+  {
+    inputs |= input_probe_degraded;
+  }
+
+  // the demand is the only part that keeps any bookkeeping, it's done here once so the guards are plain bit tests
+  if(is_in_fallback_mode())
+  {
+    // we can't see the cabinet temperature, so we keep cycling the compressor the way it has been recently
+    compressor_cycle_learnable = false;
+    reached_target_temperature_at = 0;
+
+    inputs |= input_fallback;
+
+    if(should_fallback_compressor_run())
+    {
+      inputs |= input_demand;
+    }
+  }
+#ifdef WITH_LOAD_EVENTS
+  else if(current_state.load_event_active && active_config.load_event_start)
+  {
+    // the door was opened or warm stock went in, there's no point waiting for it to reach the cut in / target
+    reached_target_temperature_at = 0;
+
+    inputs |= input_demand;
+  }
+#endif
+  else if(active_config.hysteresis_mode == hysteresis_mode::band_hysteresis)
+  {
+    reached_target_temperature_at = 0;
+
+    if(should_band_compressor_run())
+    {
+      inputs |= input_demand;
+    }
+  }
+  else if(is_within_target_temperature())
+  {
+    if(reached_target_temperature_at == 0)
+    {
+      reached_target_temperature_at = hal_millis();
+    }
+
+    if(!has_hysteresis_time_elapsed())
+    {
+      inputs |= input_demand;
+    }
+  }
+  else
+  {
+    reached_target_temperature_at = 0;
+
+    inputs |= input_demand;
+  }
+
+  if(is_compressor_overheating())
+  {
+    inputs |= input_overheating;
+  }
+
+  if(is_compressor_recovering_from_overheat())
+  {
+    inputs |= input_overheat_recovering;
+  }
+
+  if(has_compressor_exceeded_max_runtime())
+  {
+    inputs |= input_max_runtime;
+  }
+
+  if(!has_dead_time_elapsed())
+  {
+    inputs |= input_dead_time;
+  }
+
+  if(is_compressor_on())
+  {
+    inputs |= input_compressor_on;
+  }
+
+  if(is_within_min_runtime())
+  {
+    inputs |= input_min_runtime;
+  }
+
+#ifdef WITH_DEMAND_RESPONSE
+  if(can_defer_compressor_start())
+  {
+    inputs |= input_demand_response;
+  }
+#endif
+
+  if(boost_active)
+  {
+    inputs |= input_boost;
+  }
+
+#ifdef WITH_DEFROST
+  if(current_state.defrost_active)
+  {
+    inputs |= input_defrost;
+  }
+#endif
+
+  return inputs;
+}
+
+uint8_t find_control_transition(uint8_t status, uint16_t inputs)
+{
+  // the table always ends in an unconditional row (checked at compile time), so this can't fall through
+  for(uint8_t i = 0; i < CONTROL_TRANSITION_COUNT; i++)
+  {
+    control_transition transition = get_control_transition(i);
+
+    if((transition.from == ANY_STATUS || transition.from == status)
+        && (inputs & transition.all_of) == transition.all_of
+        && (inputs & transition.none_of) == 0)
+    {
+      return i;
+    }
+  }
+
+  return CONTROL_TRANSITION_COUNT - 1;
+}
+
+control_transition get_control_transition(uint8_t row)
+{
+  control_transition transition;
+  memcpy_P(&transition, &control_transitions[row], sizeof(transition));
+
+  return transition;
+}
+
+void run_compressor()
+{
+  current_state.target_compressor_state = HIGH;
+  set_compressor(HIGH);
+}
+
+// we want the compressor running but something is keeping it off
+void hold_compressor()
+{
+  current_state.target_compressor_state = HIGH;
+  set_compressor(LOW);
+}
+
+void stop_compressor()
+{
+  current_state.target_compressor_state = LOW;
+  set_compressor(LOW);
+}
+
+// the cabinet wants cooling but we were asked not to start, once the request is lifted (or we run out of allowance)
+// the demand is still there so the compressor starts & catches up on its own
+void defer_compressor_start()
+{
+  if(!compressor_start_deferred)
+  {
+    compressor_start_deferred = true;
+    current_state.events |= event_start_deferred;
+  }
+
+  // state_updated_at is still the time of the previous update at this point
+  deferred_ms += hal_millis() - state_updated_at;
+  current_state.deferred_minutes = deferred_ms / 60000;
+
+  current_state.target_compressor_state = HIGH;
+  set_compressor(LOW);
+}
+
+// nothing wants the compressor anymore but it hasn't been running for long enough
+void enforce_min_runtime()
+{
+  if(!short_cycle_prevented)
+  {
+    short_cycle_prevented = true;
+
+    current_state.prevented_short_cycles++;
+    current_state.events |= event_short_cycle_prevented;
+  }
+
+  current_state.target_compressor_state = LOW;
+  set_compressor(HIGH);
+}
+
+void read_sensors()
+{
+  sensors.sweep();
+
+  for(uint8_t i = 0; i < NTC_CHANNEL_COUNT; i++)
+  {
+    current_state.ntc_temperatures[i] = sensors.read(i);
+  }
+}
+
+temperature lookup_ntc_temperature(const temperature* table, uint16_t adc_sum)
+{
+  uint8_t index = adc_sum >> NTC_TABLE_SHIFT;
+  uint16_t fraction = adc_sum & ((1 << NTC_TABLE_SHIFT) - 1);
+
+  // the end entries are the representable min/max, so the difference needs 32 bits
+  int32_t start = table[index].centi_degrees;
+  int32_t end = table[index + 1].centi_degrees;
+
+  return centi_degrees(start + (end - start) * (int32_t)fraction / (1 << NTC_TABLE_SHIFT));
+}
+
+// --------------------------------------
+
+void rebuild_ntc_tables()
+{
+  for(uint8_t i = 0; i < NTC_CHANNEL_COUNT; i++)
+  {
+    if(!build_ntc_table(active_calibration.channels[i], sensors.table(i)))
+    {
+      // a stored calibration that doesn't produce a sane curve is worse than none at all
+      active_calibration.channels[i] = freezer_sensor_array::default_coefficients(i);
+
+      build_ntc_table(active_calibration.channels[i], sensors.table(i));
+    }
+  }
+}
+
+ntc_coefficients default_ntc_coefficients(uint32_t nominal_resistance, int b_value)
+{
+  // the b value equation is just steinhart-hart with c = 0
+  // 1/T = 1/T0 + ln(R/R0)/B = (1/T0 - ln(R0)/B) + ln(R)/B
+  ntc_coefficients coefficients;
+  coefficients.a = 1.0 / (NOMINAL_TEMPERATURE + 273.15) - log(nominal_resistance) / b_value;
+  coefficients.b = 1.0 / b_value;
+  coefficients.c = 0;
+
+  return coefficients;
+}
+
+float adc_sum_to_log_resistance(uint16_t adc_sum)
+{
+  // the ntc is on the low side of the divider: R = R_ref * code / (1023 - code)
+  const uint16_t full_scale = (uint16_t)ANALOG_RESOLUTION * NTC_SAMPLE_COUNT;
+
+  return log((float)REFERENCE_RESISTANCE * adc_sum / (full_scale - adc_sum));
+}
+
+temperature ntc_coefficients_to_temperature(const ntc_coefficients& coefficients, uint16_t adc_sum)
+{
+  const uint16_t full_scale = (uint16_t)ANALOG_RESOLUTION * NTC_SAMPLE_COUNT;
+
+  // shorted
+  if(adc_sum == 0)
+  {
+    return MAX_REPRESENTABLE_TEMPERATURE;
+  }
+
+  // disconnected
+  if(adc_sum >= full_scale)
+  {
+    return MIN_REPRESENTABLE_TEMPERATURE;
+  }
+
+  float log_resistance = adc_sum_to_log_resistance(adc_sum);
+  float inverse_kelvin = coefficients.a + coefficients.b * log_resistance + coefficients.c * log_resistance * log_resistance * log_resistance;
+
+  if(inverse_kelvin <= 0)
+  {
+    return MAX_REPRESENTABLE_TEMPERATURE;
+  }
+
+  return temperature_from_celsius(1.0 / inverse_kelvin - 273.15);
+}
+
+bool build_ntc_table(const ntc_coefficients& coefficients, temperature* table)
+{
+  // this is the only place the float math happens, it runs at startup and after a calibration
+  for(uint8_t i = 0; i < NTC_TABLE_SIZE; i++)
+  {
+    table[i] = ntc_coefficients_to_temperature(coefficients, (uint16_t)i << NTC_TABLE_SHIFT);
+
+    // the temperature has to keep falling as the resistance rises, otherwise the coefficients are garbage
+    if(i > 0 && table[i] > table[i - 1])
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool solve_ntc_coefficients(const calibration_point* points, uint8_t count, ntc_coefficients* result)
+{
+  const uint16_t full_scale = (uint16_t)ANALOG_RESOLUTION * NTC_SAMPLE_COUNT;
+
+  // the wizard only ever captures 2 or 3, anything else would read past what was filled in below
+  if(count < 2 || count > MAX_CALIBRATION_POINTS)
+  {
+    return false;
+  }
+
+  float l[MAX_CALIBRATION_POINTS] {};
+  float y[MAX_CALIBRATION_POINTS] {};
+
+  for(uint8_t i = 0; i < count; i++)
+  {
+    if(points[i].adc_sum == 0 || points[i].adc_sum >= full_scale)
+    {
+      return false;
+    }
+
+    l[i] = adc_sum_to_log_resistance(points[i].adc_sum);
+    y[i] = 1.0 / (points[i].reference.centi_degrees / 100.0 + 273.15);
+  }
+
+  if(l[0] == l[1])
+  {
+    return false;
+  }
+
+  if(count == 2)
+  {
+    // two points only give us the b value equation, so c stays at 0
+    result->c = 0;
+    result->b = (y[1] - y[0]) / (l[1] - l[0]);
+    result->a = y[0] - result->b * l[0];
+  }
+  else
+  {
+    if(l[0] == l[2] || l[1] == l[2])
+    {
+      return false;
+    }
+
+    float gamma_2 = (y[1] - y[0]) / (l[1] - l[0]);
+    float gamma_3 = (y[2] - y[0]) / (l[2] - l[0]);
+
+    result->c = (gamma_3 - gamma_2) / (l[2] - l[1]) / (l[0] + l[1] + l[2]);
+    result->b = gamma_2 - result->c * (l[0] * l[0] + l[0] * l[1] + l[1] * l[1]);
+    result->a = y[0] - (result->b + l[0] * l[0] * result->c) * l[0];
+  }
+
+  // make sure the whole curve is usable and not just the points we measured
+  temperature table[NTC_TABLE_SIZE];
+
+  return result->b > 0 && build_ntc_table(*result, table);
+}
+
+void check_sensor_plausibility()
+{
+  uint32_t now = hal_millis();
+  bool any_warning = false;
+
+  for(uint8_t i = 0; i < NTC_CHANNEL_COUNT; i++)
+  {
+    sensor_health& health = sensor_health_states[i];
+    const sensor_limits& limits = channel_limits[i];
+    temperature reading = current_state.ntc_temperatures[i];
+
+    if(is_sensor_disconnected(i))
+    {
+      health.has_reading = false;
+      continue;
+    }
+
+    bool implausible = reading < limits.min || reading > limits.max;
+
+    // the allowed change grows with the time since the last good reading, otherwise a real
+    // change that happened while we were rejecting readings would be rejected forever
+    if(!implausible && health.has_reading)
+    {
+      int32_t change = (int32_t)reading.centi_degrees - health.last_plausible.centi_degrees;
+      int32_t allowed_change = (int32_t)limits.max_change_per_second.centi_degrees * ((now - health.last_plausible_at) / 1000 + 1);
+
+      implausible = change > allowed_change || change < -allowed_change;
+    }
+
+    bool suspicious = false;
+
+    // a probe that reads the same at the start of a run and STUCK_SENSOR_TIME into it is probably stuck
+    if(limits.reacts_to_compressor && !implausible)
+    {
+      int16_t drift = reading.centi_degrees - health.stuck_reference.centi_degrees;
+      bool moved = drift > STUCK_SENSOR_BAND.centi_degrees || drift < -STUCK_SENSOR_BAND.centi_degrees;
+
+      if(health.stuck)
+      {
+        // until it moves away from where it got stuck
+        health.stuck = !moved;
+      }
+      else if(is_compressor_on() && health.stuck_run_started_at != compressor_turned_on_at)
+      {
+        health.stuck_reference = reading;
+        health.stuck_run_started_at = compressor_turned_on_at;
+        health.stuck_checked = false;
+      }
+      else if(is_compressor_on() && !health.stuck_checked && now - compressor_turned_on_at >= STUCK_SENSOR_TIME)
+      {
+        health.stuck = !moved;
+        health.stuck_checked = true;
+      }
+
+      suspicious = health.stuck;
+    }
+
+    // once the compressor has been running for a while, the compressor shell can't be colder than the cabinet
+    // we can't tell which one is wrong so both of them lose some confidence
+    if((i == CABINET_NTC || i == COMPRESSOR_NTC) && !is_sensor_disconnected(COMPRESSOR_NTC) && is_compressor_on() && now - compressor_turned_on_at >= CROSS_CHECK_RUNTIME)
+    {
+      if(current_state.ntc_temperatures[CABINET_NTC] > current_state.ntc_temperatures[COMPRESSOR_NTC])
+      {
+        suspicious = true;
+      }
+    }
+
+    if(implausible)
+    {
+      health.confidence = health.confidence > IMPLAUSIBLE_READING_PENALTY ? health.confidence - IMPLAUSIBLE_READING_PENALTY : 0;
+
+      // the bad reading never reaches the control logic, it keeps working with the last plausible one
+      current_state.ntc_temperatures[i] = health.has_reading ? health.last_plausible : reading;
+    }
+    else
+    {
+      if(suspicious)
+      {
+        health.confidence = health.confidence > SUSPICIOUS_READING_PENALTY ? health.confidence - SUSPICIOUS_READING_PENALTY : 0;
+      }
+      else if(health.confidence < MAX_SENSOR_CONFIDENCE)
+      {
+        health.confidence++;
+      }
+
+      health.has_reading = true;
+      health.last_plausible = reading;
+      health.last_plausible_at = now;
+    }
+
+    // once failed, a probe has to get back to the warning level before we trust it again
+    if(health.confidence == 0 || (health.stage == sensor_stage::sensor_failed && health.confidence < SENSOR_WARNING_CONFIDENCE))
+    {
+      health.stage = sensor_stage::sensor_failed;
+    }
+    else if(health.confidence < SENSOR_DEGRADED_CONFIDENCE)
+    {
+      health.stage = sensor_stage::sensor_degraded_stage;
+    }
+    else if(health.confidence < SENSOR_WARNING_CONFIDENCE)
+    {
+      health.stage = sensor_stage::sensor_warning;
+    }
+    else
+    {
+      health.stage = sensor_stage::sensor_ok;
+    }
+
+    current_state.ntc_confidence[i] = health.confidence;
+
+    any_warning |= health.stage != sensor_stage::sensor_ok;
+  }
+
+  // update_alarm_indicator() shows this on the red led when there is no alarm
+  sensor_warning_active = any_warning;
+}
+
+void update_cabinet_estimate()
+{
+#ifdef WITH_ESTIMATOR
+  uint32_t now = hal_millis();
+  int32_t measured = (int32_t)current_state.ntc_temperatures[CABINET_NTC].centi_degrees * 256;
+
+  bool cooling = is_compressor_cooling();
+
+  // until the probe has given a plausible reading, the one in the state is whatever it read raw (a shorted or open
+  // probe reads at the end of the range), so there's nothing to start from yet & the estimate stays invalid
+  if(!estimator.initialized && !sensor_health_states[CABINET_NTC].has_reading)
+  {
+    return;
+  }
+
+  if(!estimator.initialized)
+  {
+    estimator.initialized = true;
+    estimator.estimated_temperature = measured;
+    estimator.estimated_rate = 0;
+  }
+  else
+  {
+    // when the compressor starts or stops, the rate is going to change by about the difference between
+    // the two learned rates, applying that straight away is what gets us ahead of the measurement.
+    // the learned rates are the estimated rate at the end of each phase, by then it had time to settle
+    if(cooling != estimator.was_cooling)
+    {
+      bool settled = now - estimator.phase_started_at >= MIN_RATE_LEARNING_PHASE;
+
+      if(cooling)
+      {
+        if(settled)
+        {
+          estimator.warming_rate += (estimator.estimated_rate - estimator.warming_rate) / ESTIMATOR_RATE_LEARNING_DIVISOR;
+        }
+
+        estimator.estimated_rate += estimator.cooling_rate - estimator.warming_rate;
+      }
+      else
+      {
+        if(settled)
+        {
+          estimator.cooling_rate += (estimator.estimated_rate - estimator.cooling_rate) / ESTIMATOR_RATE_LEARNING_DIVISOR;
+        }
+
+        estimator.estimated_rate += estimator.warming_rate - estimator.cooling_rate;
+      }
+
+      estimator.phase_started_at = now;
+    }
+
+    int32_t elapsed = now - estimator.updated_at; // ms, normally ~1000
+
+    // predict
+    estimator.estimated_temperature += estimator.estimated_rate * elapsed / 1000;
+
+    // correct, the residual is clamped to 10 degrees so the gain multiplication can't overflow
+    int32_t residual = constrain(measured - estimator.estimated_temperature, -1000L * 256, 1000L * 256);
+
+    estimator.estimated_temperature += residual * ESTIMATOR_ALPHA / 65536;
+    estimator.estimated_rate += residual * ESTIMATOR_BETA / 65536;
+  }
+
+  estimator.was_cooling = cooling;
+  estimator.updated_at = now;
+
+  // the probe trails the air by roughly its time constant, so the air is about where the probe will be in that time.
+  // this is only applied while cooling since that's where the overshoot comes from, on the way up
+  // the lag just acts as a bit of extra band and keeps the compressor from starting early
+  int32_t lag_compensation = 0;
+
+  if(estimator.estimated_rate < 0)
+  {
+    lag_compensation = max(estimator.estimated_rate * CABINET_PROBE_LAG_SECONDS / 256, (int32_t)-MAX_LAG_COMPENSATION.centi_degrees);
+  }
+
+  current_state.estimated_cabinet_temperature = centi_degrees(estimator.estimated_temperature / 256 + lag_compensation);
+  current_state.estimated_cabinet_rate = estimator.estimated_rate * 60 / 256;
+#else
+  // without the observer the control works off of the probe, once it has given a plausible reading
+  if(sensor_health_states[CABINET_NTC].has_reading)
+  {
+    estimator.initialized = true;
+    current_state.estimated_cabinet_temperature = current_state.ntc_temperatures[CABINET_NTC];
+  }
+#endif
+}
+
+bool is_compressor_cooling()
+{
+  if(!is_compressor_on())
+  {
+    return false;
+  }
+
+  // the compressor probe tells us whether the compressor is actually running, the relay being on isn't enough
+  if(is_sensor_disconnected(COMPRESSOR_NTC) || get_sensor_stage(COMPRESSOR_NTC) != sensor_stage::sensor_ok)
+  {
+    return true;
+  }
+
+  if(hal_millis() - compressor_turned_on_at < COMPRESSOR_WORKING_CHECK_TIME)
+  {
+    return true;
+  }
+
+  return current_state.ntc_temperatures[COMPRESSOR_NTC] >= estimator.compressor_start_temperature + COMPRESSOR_WORKING_RISE;
+}
+
+void update_thermal_model()
+{
+  bool compressor_on = is_compressor_on();
+
+  if(compressor_on)
+  {
+    if(!thermal_model_compressor_was_on && coast_learnable && last_compressor_on_duration >= MIN_RATE_LEARNING_PHASE)
+    {
+      coast_record& record = coast_history[coast_history_index];
+      record.cut_off_rate = coast_cut_off_rate;
+      record.coast = (current_state.actual_coast_minimum - coast_cut_off_temperature).centi_degrees;
+
+      coast_history_index = (coast_history_index + 1) % THERMAL_MODEL_HISTORY_SIZE;
+
+      if(coast_history_count < THERMAL_MODEL_HISTORY_SIZE)
+      {
+        coast_history_count++;
+      }
+
+      fit_thermal_model();
+    }
+
+    // the compressor stops at the end of an update, so by the time we see it off the estimator already
+    // moved on to the warming rate, we keep where it was on the last update instead
+    coast_cut_off_rate = current_state.estimated_cabinet_rate;
+    coast_cut_off_temperature = current_state.estimated_cabinet_temperature;
+
+    if(is_thermal_model_ready())
+    {
+      int32_t coast = (int32_t)active_thermal_model.coast_slope * coast_cut_off_rate / 256 + active_thermal_model.coast_offset;
+      coast = constrain(coast, -MAX_PREDICTED_COAST.centi_degrees, 0);
+
+      current_state.predicted_coast_minimum = coast_cut_off_temperature + centi_degrees(coast);
+    }
+    else
+    {
+      current_state.predicted_coast_minimum = coast_cut_off_temperature;
+    }
+  }
+  else
+  {
+    if(thermal_model_compressor_was_on)
+    {
+      // only stops while the cabinet was cooling down tell us anything about coasting
+      coast_learnable = coast_cut_off_rate < 0;
+      current_state.actual_coast_minimum = coast_cut_off_temperature;
+    }
+
+    if(is_in_fallback_mode())
+    {
+      coast_learnable = false;
+    }
+
+    current_state.actual_coast_minimum = min(current_state.actual_coast_minimum, current_state.estimated_cabinet_temperature);
+  }
+
+  thermal_model_compressor_was_on = compressor_on;
+}
+
+void fit_thermal_model()
+{
+  if(active_thermal_model.learned_cycles < 255)
+  {
+    active_thermal_model.learned_cycles++;
+  }
+
+  if(coast_history_count < MIN_THERMAL_MODEL_CYCLES)
+  {
+    // until we have enough of our own we keep whatever was loaded from eeprom
+    return;
+  }
+
+  // plain least squares, rates and coasts are a few hundred at most so the sums fit easily
+  int32_t sum_x = 0;
+  int32_t sum_y = 0;
+  int32_t sum_xx = 0;
+  int32_t sum_xy = 0;
+
+  for(uint8_t i = 0; i < coast_history_count; i++)
+  {
+    int32_t x = coast_history[i].cut_off_rate;
+    int32_t y = coast_history[i].coast;
+
+    sum_x += x;
+    sum_y += y;
+    sum_xx += x * x;
+    sum_xy += x * y;
+  }
+
+  int32_t n = coast_history_count;
+  int32_t denominator = n * sum_xx - sum_x * sum_x;
+
+  // if every cycle stopped at about the same rate there is no slope to fit, the offset is just the average
+  int32_t slope = 0; // minutes << 8, like the stored one
+
+  if(denominator > n * n)
+  {
+    // shifting the numerator up by 8 first could overflow 32 bits & a 64 bit division is a lot of flash on the
+    // avr, so the fraction is long divided a bit at a time instead. the remainder is below the denominator,
+    // which is far enough below 2^31 that doubling it is fine
+    int32_t numerator = n * sum_xy - sum_x * sum_y;
+    uint32_t remainder = numerator < 0 ? -numerator : numerator;
+    uint32_t quotient = remainder / denominator;
+    remainder %= denominator;
+
+    if(quotient > 127)
+    {
+      quotient = 32767; // past what coast_slope holds anyway
+    }
+    else
+    {
+      for(uint8_t i = 0; i < 8; i++)
+      {
+        quotient <<= 1;
+        remainder <<= 1;
+
+        if(remainder >= (uint32_t)denominator)
+        {
+          remainder -= denominator;
+          quotient |= 1;
+        }
+      }
+    }
+
+    slope = numerator < 0 ? -(int32_t)min(quotient, 32767UL) : min(quotient, 32767UL);
+  }
+
+  int32_t offset = (sum_y * 256 - slope * sum_x) / (n * 256);
+
+  active_thermal_model.coast_slope = slope;
+  active_thermal_model.coast_offset = constrain(offset, -32767, 32767);
+
+  if(active_thermal_model.learned_cycles % THERMAL_MODEL_SAVE_INTERVAL == 0)
+  {
+    save_thermal_model();
+  }
+}
+
+bool is_thermal_model_ready()
+{
+  return active_thermal_model.learned_cycles >= MIN_THERMAL_MODEL_CYCLES;
+}
+
+temperature get_cut_off_temperature()
+{
+#ifdef WITH_THERMAL_MODEL
+  // while running we decide on where the cabinet will end up once we stop, not where it is now.
+  // early in a run the estimated rate is still the learned guess, so we don't predict off of it
+  if(is_compressor_on() && hal_millis() - compressor_turned_on_at >= MIN_RATE_LEARNING_PHASE)
+  {
+    return current_state.predicted_coast_minimum;
+  }
+#endif
+
+  return current_state.estimated_cabinet_temperature;
+}
+
+void update_compressor_temperature_rate()
+{
+  // the rate is only meaningful while running, and only from a probe we trust
+  if(!is_compressor_on() || get_sensor_stage(COMPRESSOR_NTC) != sensor_stage::sensor_ok || is_sensor_disconnected(COMPRESSOR_NTC))
+  {
+    compressor_temperature_sampled_at = 0;
+    current_state.compressor_temperature_rate = 0;
+    return;
+  }
+
+  temperature compressor_temperature = current_state.ntc_temperatures[COMPRESSOR_NTC];
+
+  if(compressor_temperature_sampled_at == 0)
+  {
+    compressor_temperature_sampled_at = hal_millis();
+    compressor_temperature_sample = compressor_temperature;
+    return;
+  }
+
+  uint32_t elapsed = hal_millis() - compressor_temperature_sampled_at;
+
+  // a single update's difference is mostly adc noise, so the rate is taken over a minute and averaged with the last one
+  if(elapsed >= COMPRESSOR_RISE_SAMPLE_TIME)
+  {
+    int32_t rate = (int32_t)(compressor_temperature - compressor_temperature_sample).centi_degrees * 60000 / (int32_t)elapsed;
+    // the rate is reset to 0 when the compressor stops, so the first sample of a run is used as is
+    current_state.compressor_temperature_rate = current_state.compressor_temperature_rate == 0 ? rate : (current_state.compressor_temperature_rate + rate) / 2;
+
+    compressor_temperature_sampled_at = hal_millis();
+    compressor_temperature_sample = compressor_temperature;
+  }
+}
+
+void update_defrost()
+{
+  if(current_state.defrost_active)
+  {
+    // without an evaporator probe or a trusted reading from it, only the timeout can end it
+    bool terminated = EVAPORATOR_NTC >= 0 && get_sensor_stage(EVAPORATOR_NTC) == sensor_stage::sensor_ok
+        && current_state.ntc_temperatures[EVAPORATOR_NTC] >= active_config.defrost_termination_temperature;
+
+    bool timed_out = hal_millis() - defrost_started_at >= (uint32_t)active_config.defrost_timeout * 60 * 1000;
+
+    if(terminated || timed_out || active_config.defrost_mode == defrost_mode::defrost_off)
+    {
+      set_defrost(false);
+    }
+
+    return;
+  }
+
+  // a running compressor finishes its run first, the defrost starts once it stops
+  if(active_config.defrost_mode == defrost_mode::defrost_off || !startup_delay_over || is_compressor_on())
+  {
+    return;
+  }
+
+  if(is_defrost_due())
+  {
+    set_defrost(true);
+  }
+}
+
+void measure_pull_down_rate()
+{
+  if(is_compressor_on())
+  {
+    // the hottest the compressor got during this run, for the health baseline
+    if(!pull_down_measuring || current_state.ntc_temperatures[COMPRESSOR_NTC] > run_peak_compressor_temperature)
+    {
+      run_peak_compressor_temperature = current_state.ntc_temperatures[COMPRESSOR_NTC];
+    }
+
+    // the cabinet keeps warming for a bit after the compressor starts, so the pull down counts from the peak
+    if(!pull_down_measuring || current_state.estimated_cabinet_temperature >= pull_down_start_temperature)
+    {
+      pull_down_measuring = true;
+      pull_down_started_at = hal_millis();
+      pull_down_start_temperature = current_state.estimated_cabinet_temperature;
+    }
+
+    return;
+  }
+
+  if(!pull_down_measuring)
+  {
+    return;
+  }
+
+  pull_down_measuring = false;
+
+  uint32_t run_time = hal_millis() - pull_down_started_at;
+
+  // in fallback the cabinet reading can't be trusted, so neither can the rate
+  if(run_time < MIN_HEALTH_RUN || is_in_fallback_mode())
+  {
+    return;
+  }
+
+  int32_t drop = (pull_down_start_temperature - current_state.estimated_cabinet_temperature).centi_degrees;
+  current_state.pull_down_rate = drop * 60000 / (int32_t)run_time;
+
+#ifdef WITH_HEALTH
+  // the health only compares runs with the recent ones, so the short runs are still useful there.
+  // the rate in the state is too coarse for the slow averages, so it gets the fractions as well
+  update_compressor_health(drop * 256 * 60 / (int32_t)(run_time / 1000), last_compressor_on_duration);
+#endif
+
+#ifdef WITH_DEFROST
+  if(run_time < MIN_PULL_DOWN_RUN)
+  {
+    return;
+  }
+
+  if(current_state.pull_down_rate > best_pull_down_rate)
+  {
+    best_pull_down_rate = current_state.pull_down_rate;
+    degraded_pull_down_runs = 0;
+  }
+  else if((int32_t)current_state.pull_down_rate * 100 < (int32_t)best_pull_down_rate * (100 - DEFROST_RATE_DEGRADATION_PERCENT))
+  {
+    degraded_pull_down_runs++;
+  }
+  else
+  {
+    degraded_pull_down_runs = 0;
+  }
+#endif
+}
+
+bool is_defrost_due()
+{
+  uint32_t since_last_defrost = hal_millis() - last_defrost_at;
+
+  // the interval is the longest the adaptive mode will wait as well
+  if(since_last_defrost >= (uint32_t)active_config.defrost_interval * 60 * 60 * 1000)
+  {
+    return true;
+  }
+
+  return active_config.defrost_mode == defrost_mode::defrost_adaptive
+      && degraded_pull_down_runs >= DEFROST_DEGRADED_RUNS
+      && since_last_defrost >= MIN_ADAPTIVE_DEFROST_INTERVAL;
+}
+
+void set_defrost(bool active)
+{
+  current_state.defrost_active = active;
+
+  if(active)
+  {
+    defrost_started_at = hal_millis();
+    current_state.events |= event_defrost_started;
+  }
+  else
+  {
+    last_defrost_at = hal_millis();
+    current_state.events |= event_defrost_ended;
+
+    // the evaporator is clean again, so the next runs set the new best rate
+    best_pull_down_rate = 0;
+    degraded_pull_down_runs = 0;
+  }
+
+  // the pin is left alone until the first defrost
+  if(DEFROST_RELAY_PIN >= 0)
+  {
+    hal_pin_mode(DEFROST_RELAY_PIN, OUTPUT);
+    hal_digital_write(DEFROST_RELAY_PIN, active);
+  }
+}
+
+void load_alarms()
+{
+  // Serial.println("load_alarms()");
+
+  alarm_record alarm_data;
+  hal_storage_get(ALARMS_EEPROM_ADDRESS, alarm_data);
+
+  if(memcmp(alarm_data.magic_bytes, "ALM1", 4) != 0 || alarm_data.crc != calculate_crc8((uint8_t*)&alarm_data, offsetof(alarm_record, crc)))
+  {
+    // Serial.println("load_alarms(): no valid alarms in eeprom, starting with none latched");
+
+    active_alarms = alarm_record();
+    save_alarms();
+  }
+  else
+  {
+    active_alarms = alarm_data;
+  }
+
+  current_state.alarms_latched = active_alarms.latched;
+}
+
+void save_alarms()
+{
+  // Serial.println("save_alarms()");
+
+  // only written when an alarm is raised, cleared or acknowledged, so there is no need to wear level this
+  active_alarms.crc = calculate_crc8((uint8_t*)&active_alarms, offsetof(alarm_record, crc));
+  hal_storage_put(ALARMS_EEPROM_ADDRESS, active_alarms);
+}
+
+void update_alarms()
+{
+  uint32_t now = hal_millis();
+
+  temperature cabinet_temperature = current_state.estimated_cabinet_temperature;
+  bool cabinet_trusted = get_sensor_stage(CABINET_NTC) != sensor_stage::sensor_failed;
+  bool cabinet_known = cabinet_trusted && estimator.initialized;
+
+  if(cabinet_known && cabinet_temperature < active_config.high_alarm_temperature)
+  {
+    high_alarm_armed = true;
+  }
+
+  bool conditions[ALARM_COUNT];
+
+  // a defrost warms the cabinet on purpose, so the high alarm has a limit of its own while one runs.
+  // a boost cools it on purpose, so the low alarm is off for it
+  temperature high_alarm_temperature = active_config.high_alarm_temperature;
+
+  if(current_state.defrost_active)
+  {
+    high_alarm_temperature = high_alarm_temperature + DEFROST_HIGH_ALARM_ALLOWANCE;
+  }
+
+  conditions[alarm_type::alarm_high_temperature] = cabinet_known && high_alarm_armed
+      && cabinet_temperature >= high_alarm_temperature;
+  conditions[alarm_type::alarm_low_temperature] = cabinet_known && !boost_active
+      && cabinet_temperature <= active_config.low_alarm_temperature;
+  conditions[alarm_type::alarm_probe_failure] = !cabinet_trusted;
+
+  const uint32_t delays[ALARM_COUNT] = {
+      (uint32_t)active_config.high_alarm_delay * 60 * 1000,
+      (uint32_t)active_config.low_alarm_delay * 60 * 1000,
+      PROBE_FAILURE_ALARM_DELAY,
+  };
 
-void loop()
-{
-  if(millis() - state_updated_at >= 1000) // we refresh once a second, which is more than needed
+  current_alarm_level = alarm_level::alarm_quiet;
+
+  for(uint8_t i = 0; i < ALARM_COUNT; i++)
   {
-    if(config_is_dirty)
+    uint8_t alarm_bit = 1 << i;
+    bool is_active = current_state.alarms_active & alarm_bit;
+
+    if(!conditions[i])
     {
-      active_config = dirty_config;
-      config_is_dirty = false;
+      if(is_active)
+      {
+        clear_alarm(i);
+      }
+
+      alarm_condition_since[i] = 0;
+    }
+    else
+    {
+      if(alarm_condition_since[i] == 0)
+      {
+        alarm_condition_since[i] = now;
+      }
+
+      if(!is_active && now - alarm_condition_since[i] >= delays[i])
+      {
+        raise_alarm(i);
+      }
+      else if(is_active)
+      {
+        // the peak is how far past the threshold it got, so upwards for the high alarm & downwards otherwise
+        temperature& peak = active_alarms.peak_temperatures[i];
+        peak = i == alarm_type::alarm_high_temperature ? max(peak, cabinet_temperature) : min(peak, cabinet_temperature);
+
+        // acknowledged but still there, so it is raised again
+        if(!(active_alarms.latched & alarm_bit) && now - alarm_raised_at[i] >= ALARM_REMIND_TIME)
+        {
+          active_alarms.latched |= alarm_bit;
+          alarm_raised_at[i] = now;
+          save_alarms();
+        }
+      }
     }
 
-    update_state();
+    alarm_level level = alarm_level::alarm_quiet;
+
+    if(current_state.alarms_active & alarm_bit)
+    {
+      if(!(active_alarms.latched & alarm_bit))
+      {
+        level = alarm_level::alarm_acknowledged;
+      }
+      else
+      {
+        level = now - alarm_raised_at[i] >= ALARM_ESCALATION_TIME ? alarm_level::alarm_escalated : alarm_level::alarm_raised;
+      }
+    }
+    else if(active_alarms.latched & alarm_bit)
+    {
+      level = alarm_level::alarm_unacknowledged;
+    }
 
-    state_updated_at = millis();
+    current_alarm_level = max(current_alarm_level, level);
   }
 
-  handle_input();
-  refresh_display();
+  if(current_state.alarms_active & (1 << last_alarm))
+  {
+    current_state.alarm_peak_temperature = active_alarms.peak_temperatures[last_alarm];
+    current_state.alarm_duration = (now - alarm_condition_since[last_alarm]) / 60000;
+  }
 
-  wdt_reset();
+  current_state.alarms_latched = active_alarms.latched;
 }
 
-// --------------------------------------
-
-void initialize_thermistors()
+void raise_alarm(uint8_t alarm)
 {
-  // Serial.println("initialize_thermistors()");
+  current_state.alarms_active |= 1 << alarm;
+  current_state.events |= event_alarm_raised;
 
-  ntc_1 = new NTC_Thermistor(
-      THERMISTOR_1_PIN,
-      REFERENCE_RESISTANCE,
-      NOMINAL_RESISTANCE_NTC_1,
-      NOMINAL_TEMPERATURE,
-      B_VALUE_NTC_1,
-      ANALOG_RESOLUTION);
+  active_alarms.latched |= 1 << alarm;
+  active_alarms.peak_temperatures[alarm] = current_state.estimated_cabinet_temperature;
 
-  ntc_2 = new NTC_Thermistor(
-      THERMISTOR_2_PIN,
-      REFERENCE_RESISTANCE,
-      NOMINAL_RESISTANCE_NTC_2,
-      NOMINAL_TEMPERATURE,
-      B_VALUE_NTC_2,
-      ANALOG_RESOLUTION);
+  alarm_raised_at[alarm] = hal_millis();
+  last_alarm = alarm;
+
+  save_alarms();
 }
 
-void initialize_display()
+void clear_alarm(uint8_t alarm)
 {
-  // Serial.println("initialize_display()");
+  current_state.alarms_active &= ~(1 << alarm);
+  current_state.events |= event_alarm_cleared;
 
-  tft.begin();
-  tft.setRotation(1);
-  tft.fillScreen(GC9A01A_BLACK);
-  tft.setTextWrap(false);
-}
+  // the duration counts from when the condition started, the delay is part of it
+  current_state.alarm_peak_temperature = active_alarms.peak_temperatures[alarm];
+  current_state.alarm_duration = (hal_millis() - alarm_condition_since[alarm]) / 60000;
 
-void initialize_status_leds()
-{
-  pinMode(BLUE_LED_PIN, OUTPUT);
-  pinMode(RED_LED_PIN, OUTPUT);
+  // the peak is only final now, it stays latched until someone acknowledges it
+  save_alarms();
 }
 
-void initialize_logging()
+void acknowledge_alarms()
 {
-  // Serial.println("initialize_logging()");
-
-  if(init_sd_card())
+  if(active_alarms.latched == 0)
   {
-    // Serial.println("initialize_logging(): successfully initialized sd card, enabling logging");
-    logging_enabled = true;
+    return;
   }
-  else
+
+  active_alarms.latched = 0;
+  current_state.alarms_latched = 0;
+  current_state.events |= event_alarm_acknowledged;
+
+  // the reminder counts from the acknowledgement
+  for(uint8_t i = 0; i < ALARM_COUNT; i++)
   {
-    // Serial.println("initialize_logging(): could not initialize sd card, logging is disabled");
+    alarm_raised_at[i] = hal_millis();
   }
-}
 
-void initialize_compressor()
-{
-  // Serial.println("initialize_compressor()");
+  current_alarm_level = current_state.alarms_active ? alarm_level::alarm_acknowledged : alarm_level::alarm_quiet;
 
-  pinMode(COMPRESSOR_RELAY, OUTPUT);
-  digitalWrite(COMPRESSOR_RELAY, LOW);
+  save_alarms();
 }
 
-void initialize_input()
+void update_alarm_indicator()
 {
-  // Serial.println("initialize_input()");
+#ifdef WITH_ALARMS
+  alarm_pattern pattern;
+  memcpy_P(&pattern, &alarm_patterns[current_alarm_level], sizeof(pattern));
 
-  pinMode(ROTARY_SW, INPUT_PULLUP);
-  attachInterrupt(digitalPinToInterrupt(ROTARY_SW), on_button_pressed, RISING);
+  bool on = current_alarm_level == alarm_level::alarm_quiet ? sensor_warning_active : hal_millis() % pattern.period < pattern.on_time;
+
+  hal_digital_write(RED_LED_PIN, on);
+
+  if(BUZZER_PIN >= 0)
+  {
+    hal_digital_write(BUZZER_PIN, on && pattern.sound);
+  }
+#else
+  hal_digital_write(RED_LED_PIN, sensor_warning_active);
+#endif
 }
 
-void initialize_watchdog()
+void load_compressor_health()
 {
-  reset_by_watchdog = (MCUSR & (1 << WDRF));
+  // Serial.println("load_compressor_health()");
 
-  MCUSR = 0;
+  compressor_health health_data;
+  hal_storage_get(HEALTH_EEPROM_ADDRESS, health_data);
 
-  wdt_enable(WDTO_2S);
-}
+  if(memcmp(health_data.magic_bytes, "HLT1", 4) != 0 || health_data.crc != calculate_crc8((uint8_t*)&health_data, offsetof(compressor_health, crc)))
+  {
+    // Serial.println("load_compressor_health(): no baseline in eeprom, starting from scratch");
 
-//void initialize_rtc()
-//{
-// // Serial.println("initialize_rtc()");
-//
-// rtc_clock.Begin();
-//
-// RtcDateTime compiled = RtcDateTime(__DATE__, __TIME__);
-//
-// if (!rtc_clock.IsDateTimeValid())
-// {
-//   // Serial.println("initialize_rtc(): RTC lost confidence in the DateTime!");
-//   rtc_clock.SetDateTime(compiled);
-// }
-//
-// if (rtc_clock.GetIsWriteProtected())
-// {
-//     // Serial.println("initialize_rtc(): RTC was write protected, enabling writing now");
-//     rtc_clock.SetIsWriteProtected(false);
-// }
-//
-// if (!rtc_clock.GetIsRunning())
-// {
-//     // Serial.println("initialize_rtc(): RTC was not actively running, starting now");
-//     rtc_clock.SetIsRunning(true);
-// }
-//
-// RtcDateTime now = rtc_clock.GetDateTime();
-// if (now < compiled)
-// {
-//     // Serial.println("initialize_rtc(): RTC is older than compile time!  (Updating DateTime)");
-//     rtc_clock.SetDateTime(compiled);
-// }
-//}
+    active_health = compressor_health();
+  }
+  else
+  {
+    active_health = health_data;
+  }
 
-// --------------------------------------
+  recent_pull_down_rate = active_health.baseline_pull_down_rate;
+  recent_compressor_temperature = active_health.baseline_compressor_temperature;
+  recent_run_time = active_health.baseline_run_time;
 
-void load_config()
+  current_state.health_score = get_health_score(&current_state.health_flags);
+}
+
+void save_compressor_health()
 {
-  // Serial.println("load_config()");
+  // Serial.println("save_compressor_health()");
 
-  freezer_config config;
-  EEPROM.get(0, config);
+  active_health.crc = calculate_crc8((uint8_t*)&active_health, offsetof(compressor_health, crc));
+  hal_storage_put(HEALTH_EEPROM_ADDRESS, active_health);
+}
 
-  // make sure we have a valid config by comparing the magic bytes, otherwise reset to the default state
-  if(memcmp(config.magic_bytes, "F002", 4) != 0)
+// called at the end of every run measure_pull_down_rate() could measure, the rate is in centi-degrees per minute << 8
+void update_compressor_health(int32_t pull_down_rate, uint32_t run_time)
+{
+  // a run with a bad compressor probe would drag the baseline off, and so would the long runs after a warm up.
+  // only the normal runs around the target are compared, so boost, the first pull down, defrosts and loads are left out
+  if(get_sensor_stage(COMPRESSOR_NTC) != sensor_stage::sensor_ok || boost_active
+      || pull_down_start_temperature > active_config.target_temperature + MAX_HEALTH_RUN_START)
   {
-    // we flash the LEDs just to indicate that we are resetting the config
-
-    digitalWrite(BLUE_LED_PIN, HIGH);
-    digitalWrite(RED_LED_PIN, HIGH);
-
-    delay(1000);
+    return;
+  }
 
-    digitalWrite(BLUE_LED_PIN, LOW);
-    digitalWrite(RED_LED_PIN, LOW);
+  int32_t compressor_temperature = (int32_t)run_peak_compressor_temperature.centi_degrees << 8;
+  int32_t run_seconds = (int32_t)min(run_time / 1000, (uint32_t)UINT16_MAX) << 8;
 
-    // Serial.println("load_config(): config in eeprom is invalid, resetting back to default values");
+  if(active_health.learned_runs < 255)
+  {
+    active_health.learned_runs++;
+  }
 
-    active_config = freezer_config();
-    dirty_config = freezer_config();
+  if(active_health.learned_runs == 1)
+  {
+    active_health.baseline_pull_down_rate = pull_down_rate;
+    active_health.baseline_compressor_temperature = compressor_temperature;
+    active_health.baseline_run_time = run_seconds;
 
-    save_dirty_config();
+    recent_pull_down_rate = pull_down_rate;
+    recent_compressor_temperature = compressor_temperature;
+    recent_run_time = run_seconds;
   }
   else
   {
-    // Serial.println("load_config(): successfully loaded config from eeprom");
+    // a running average while learning, so every one of the first runs counts the same
+    int32_t baseline_divisor = active_health.learned_runs <= HEALTH_BASELINE_RUNS ? active_health.learned_runs : 1 << HEALTH_BASELINE_SHIFT;
+
+    active_health.baseline_pull_down_rate += (pull_down_rate - active_health.baseline_pull_down_rate) / baseline_divisor;
+    active_health.baseline_compressor_temperature += (compressor_temperature - active_health.baseline_compressor_temperature) / baseline_divisor;
+    active_health.baseline_run_time += (run_seconds - active_health.baseline_run_time) / baseline_divisor;
+
+    recent_pull_down_rate += (pull_down_rate - recent_pull_down_rate) >> HEALTH_RECENT_SHIFT;
+    recent_compressor_temperature += (compressor_temperature - recent_compressor_temperature) >> HEALTH_RECENT_SHIFT;
+    recent_run_time += (run_seconds - recent_run_time) >> HEALTH_RECENT_SHIFT;
+  }
 
-    active_config = config;
-    dirty_config = config;
+  current_state.health_score = get_health_score(&current_state.health_flags);
+
+  if(active_health.learned_runs % HEALTH_SAVE_INTERVAL == 0)
+  {
+    save_compressor_health();
   }
 }
 
-void save_dirty_config()
+// 100 minus a penalty for each drift, the pull down counts the most since it's the one that's felt first
+uint8_t get_health_score(uint8_t* flags)
 {
-  // Serial.println("save_dirty_config()");
+  *flags = 0;
 
-  EEPROM.put(0, dirty_config);
-}
+  if(active_health.learned_runs < HEALTH_BASELINE_RUNS || active_health.baseline_pull_down_rate <= 0 || active_health.baseline_run_time <= 0)
+  {
+    return HEALTH_SCORE_UNKNOWN;
+  }
 
-// --------------------------------------
+  int32_t pull_down_drop_percent = max((active_health.baseline_pull_down_rate - recent_pull_down_rate) * 100 / active_health.baseline_pull_down_rate, (int32_t)0);
+  int32_t compressor_temperature_rise = max((recent_compressor_temperature - active_health.baseline_compressor_temperature) >> 8, (int32_t)0);
+  int32_t run_time_rise_percent = max((recent_run_time - active_health.baseline_run_time) * 100 / active_health.baseline_run_time, (int32_t)0);
 
-bool is_compressor_overheating()
-{
-  return current_state.current_ntc2_temperature >= active_config.compressor_max_temp;
-}
+  if(pull_down_drop_percent >= HEALTH_PULL_DOWN_DRIFT_PERCENT)
+  {
+    *flags |= health_pull_down_drift;
+  }
 
-bool is_startup_delay_over()
-{
-  return millis() >= ((uint32_t)active_config.freezer_startup_delay * 60 * 1000);
-}
+  if(compressor_temperature_rise >= HEALTH_COMPRESSOR_TEMPERATURE_DRIFT.centi_degrees)
+  {
+    *flags |= health_compressor_temperature_drift;
+  }
 
-bool is_compressor_on()
-{
-  return current_state.actual_compressor_state;
-}
+  if(run_time_rise_percent >= HEALTH_RUN_TIME_DRIFT_PERCENT)
+  {
+    *flags |= health_run_time_drift;
+  }
 
-bool is_within_target_temperature()
-{
-  // todo: add a 'range'
-  return current_state.current_ntc1_temperature <= active_config.target_temperature;
-}
+  // 4 points per degree hotter, so the 5 degree drift alone costs 20
+  int32_t penalty = pull_down_drop_percent + compressor_temperature_rise * 4 / 100 + run_time_rise_percent / 2;
 
-bool has_hysteresis_time_elapsed()
-{
-  return millis() - reached_target_temperature_at >= ((uint32_t)active_config.target_temperature_hysteresis_time * 1000);
+  return max((int32_t)100 - penalty, (int32_t)0);
 }
 
-bool has_compressor_exceeded_max_runtime()
+void update_load_event_detector()
 {
-  if(exceeded_max_runtime_at > 0)
+  // a running compressor is the response to the event, so it's over once the compressor is on.
+  // a load event only starts the compressor early once, the band stays as it is after that
+  if(is_compressor_on() || is_in_fallback_mode())
   {
-    // we already exceeded the max runtime, we need to make sure we have stopped for enough time
-    if(has_dead_time_elapsed())
-    {
-      exceeded_max_runtime_at = 0;
-      return false;
-    }
-
-    return true;
+    load_event_rising_since = 0;
+    current_state.load_event_active = false;
+    return;
   }
-  else
+
+  if(current_state.load_event_active)
   {
-    if(is_compressor_on())
+    if(current_state.estimated_cabinet_rate < LOAD_EVENT_CLEAR_RATE)
     {
-      if(millis() - compressor_turned_on_at >= ((uint32_t)active_config.compressor_max_run_time * 1000 * 60))  // 28612 bytes ( THIS IS SMALLER )
-      {
-        exceeded_max_runtime_at = millis();
-        return true;
-      }
+      current_state.load_event_active = false;
     }
+
+    return;
   }
 
-  exceeded_max_runtime_at = 0;
-  return false;
-}
+  if(current_state.estimated_cabinet_rate < LOAD_EVENT_RATE)
+  {
+    load_event_rising_since = 0;
+    return;
+  }
 
-bool has_dead_time_elapsed()
-{
-  if(compressor_turned_off_at == 0)
+  if(load_event_rising_since == 0)
   {
-    return true;
+    load_event_rising_since = hal_millis();
   }
+  else if(hal_millis() - load_event_rising_since >= LOAD_EVENT_CONFIRM_TIME)
+  {
+    load_event_rising_since = 0;
 
-  return millis() - compressor_turned_off_at >= ((uint32_t)active_config.compressor_dead_time * 1000 * 60);
+    current_state.load_event_active = true;
+    current_state.load_events++;
+    current_state.events |= event_load_detected;
+  }
 }
 
-void update_state()
+void update_statistics()
 {
-  read_sensors();
-  validate_temperatures();
-
-  // we are saving startup_delay_over into a variable to make we dont get affected by millis() rolling over after 50 days or so
-  if(!startup_delay_over)
-  {
-    startup_delay_over = is_startup_delay_over();
+  uint32_t now = hal_millis();
 
-    if(screen_index == HOME_SCREEN || screen_index == INFO_SCREEN)
-    {
-      screen_should_refresh = true;
-    }
+  uint32_t elapsed_ms = now - statistics_updated_at + statistics_remainder_ms;
+  statistics_updated_at = now;
 
-    current_state.status = freezer_status::startup_delay;
-    log_state();
+  uint32_t seconds = elapsed_ms / 1000;
+  statistics_remainder_ms = elapsed_ms % 1000;
 
-    return;
-  }
+  bool compressor_on = is_compressor_on();
 
-  // base decision-making -----
+  active_statistics.powered_seconds += seconds;
 
-  if(is_within_target_temperature())
+  if(compressor_on)
   {
-    if(reached_target_temperature_at == 0)
-    {
-      reached_target_temperature_at = millis();
-    }
+    active_statistics.on_seconds += seconds;
 
-    if(has_hysteresis_time_elapsed())
-    {
-      current_state.target_compressor_state = LOW;
-      current_state.status = freezer_status::reached_target;
-    }
-    else
-    {
-      current_state.target_compressor_state = HIGH;
-      current_state.status = freezer_status::cooling;
-    }
+    uint32_t watt_seconds = seconds * active_config.compressor_power + statistics_remainder_watt_seconds;
+    active_statistics.watt_hours += watt_seconds / 3600;
+    statistics_remainder_watt_seconds = watt_seconds % 3600;
   }
-  else
-  {
-    reached_target_temperature_at = 0;
 
-    current_state.target_compressor_state = HIGH;
-    current_state.status = freezer_status::cooling;
+  hour_duty.add(seconds, compressor_on);
+  day_duty.add(seconds, compressor_on);
+  week_duty.add(seconds, compressor_on);
+
+  if(now - statistics_saved_at >= STATISTICS_SAVE_INTERVAL)
+  {
+    save_statistics();
+    statistics_saved_at = now;
   }
+}
+
+sensor_stage get_sensor_stage(uint8_t channel)
+{
+  return sensor_health_states[channel].stage;
+}
 
-  // overrides -------
+bool is_sensor_disconnected(uint8_t channel)
+{
+  return channel_limits[channel].may_be_disconnected && current_state.ntc_temperatures[channel] < DISCONNECTED_NTC_TEMPERATURE;
+}
 
-  bool override = false;
+temperature temperature_from_celsius(double celsius)
+{
+  // this is the only place a float should be turned into a temperature,
+  // everything after the sensor read stays in fixed-point
+  double centi = celsius * 100;
 
-  // we only need to override if we are planning on turning on the compressor
-  if(current_state.target_compressor_state == HIGH)
+  if(centi <= INT16_MIN)
   {
-    if(is_compressor_overheating())
-    {
-      current_state.status = freezer_status::overheat;
-      override = true;
-    }
-    else if(has_compressor_exceeded_max_runtime())
-    {
-      current_state.status = freezer_status::compressor_max_runtime;
-      override = true;
-    }
-    else if(!is_compressor_on() && !has_dead_time_elapsed())
-    {
-      current_state.status = freezer_status::dead_time;
-      override = true;
-    }
+    return MIN_REPRESENTABLE_TEMPERATURE;
   }
 
-  set_compressor(current_state.target_compressor_state && !override);
-  log_state();
+  if(centi >= INT16_MAX)
+  {
+    return MAX_REPRESENTABLE_TEMPERATURE;
+  }
 
-  screen_should_refresh = true;
+  return centi_degrees((int16_t)(centi < 0 ? centi - 0.5 : centi + 0.5));
 }
 
-void read_sensors()
+char* format_temperature(temperature value, int8_t width, uint8_t decimals, char* buffer)
 {
-//  delay(10);
+  // replacement for dtostrf() that doesn't need the float library, only 1 or 2 decimals are supported
+  // a uint16_t is used for the magnitude so that -327.68 doesn't overflow when negated
+  uint16_t magnitude = value.centi_degrees < 0 ? -(int32_t)value.centi_degrees : value.centi_degrees;
+  const char* sign = value.centi_degrees < 0 ? "-" : "";
 
-  analogRead(THERMISTOR_1_PIN); // dummy read to stabilize the value
+  char digits[10];
 
-  double ntc_1_avg = 0;
-  for(int i = 0; i < 10; i++)
+  if(decimals == 1)
+  {
+    magnitude = (magnitude + 5) / 10;
+    sprintf_P(digits, PSTR("%s%u.%u"), sign, magnitude / 10, magnitude % 10);
+  }
+  else
   {
-    ntc_1_avg += ntc_1->readCelsius();
+    sprintf_P(digits, PSTR("%s%u.%02u"), sign, magnitude / 100, magnitude % 100);
   }
 
-  current_state.current_ntc1_temperature = ntc_1_avg / 10;
+  sprintf_P(buffer, PSTR("%*s"), width, digits);
+
+  return buffer;
+}
+
+// --------------------------------------
+
+void set_compressor(bool state)
+{
+  if(state != current_state.actual_compressor_state)
+  {
+    // if we off and going on
+    if(state == HIGH)
+    {
+      // starting again completes the previous cycle
+      if(compressor_cycle_learnable && compressor_turned_off_at != 0)
+      {
+        record_compressor_cycle(last_compressor_on_duration, hal_millis() - compressor_turned_off_at);
+      }
+
+      compressor_cycle_learnable = !is_in_fallback_mode();
+      short_cycle_prevented = false;
+
+#ifdef WITH_STATISTICS
+      active_statistics.cycles++;
+#endif
+
+      // is_compressor_cooling() looks for the compressor probe warming up from here
+      estimator.compressor_start_temperature = current_state.ntc_temperatures[COMPRESSOR_NTC];
+
+      compressor_turned_on_at = hal_millis();
+      compressor_turned_off_at = 0;
+    }
+    else
+    {
+      last_compressor_on_duration = hal_millis() - compressor_turned_on_at;
 
-//  delay(10);
+      compressor_turned_off_at = hal_millis();
+      compressor_turned_on_at = 0;
+    }
 
-  analogRead(THERMISTOR_2_PIN); // dummy read to stabilize the value
+    hal_digital_write(COMPRESSOR_RELAY, state);
+    hal_digital_write(BLUE_LED_PIN, state);
 
-  double ntc_2_avg = 0;
-  for(int i = 0; i < 10; i++)
-  {
-    ntc_2_avg += ntc_2->readCelsius();
+    current_state.actual_compressor_state = state;
   }
-
-  current_state.current_ntc2_temperature = ntc_2_avg / 10;
 }
 
-void halt(const char* error)
+void record_compressor_cycle(uint32_t on_duration, uint32_t off_duration)
 {
-  set_compressor(false);
-
-  digitalWrite(RED_LED_PIN, HIGH);
+  // stored in seconds to keep the history small, anything over ~18 hours is clamped
+  compressor_cycle& cycle = compressor_cycle_history[compressor_cycle_history_index];
+  cycle.on_seconds = min(on_duration / 1000, (uint32_t)UINT16_MAX);
+  cycle.off_seconds = min(off_duration / 1000, (uint32_t)UINT16_MAX);
 
-  tft.fillScreen(GC9A01A_RED);
+  compressor_cycle_history_index = (compressor_cycle_history_index + 1) % COMPRESSOR_CYCLE_HISTORY_SIZE;
 
-  show_centered_text("ERROR", 4, 0, -30);
-  show_centered_text(error, 3, 0, 20);
-
-  for(;;);
+  if(compressor_cycle_history_count < COMPRESSOR_CYCLE_HISTORY_SIZE)
+  {
+    compressor_cycle_history_count++;
+  }
 }
 
-void validate_temperatures()
+bool get_average_compressor_cycle(uint32_t* on_duration, uint32_t* off_duration)
 {
-  if(current_state.current_ntc1_temperature < -100 || current_state.current_ntc1_temperature > 100)
+  if(compressor_cycle_history_count < MIN_FALLBACK_CYCLES)
   {
-    halt("N1");
+    *on_duration = DEFAULT_FALLBACK_ON_TIME;
+    *off_duration = DEFAULT_FALLBACK_OFF_TIME;
+    return false;
   }
 
-  // for the compressor ntc, we don't really care if its disconnected since it'll return -273.15
-  // we do care if its shorted though which would return MAX_TEMP
-  if(current_state.current_ntc2_temperature > 100)
+  uint32_t on_sum = 0;
+  uint32_t off_sum = 0;
+
+  for(uint8_t i = 0; i < compressor_cycle_history_count; i++)
   {
-    halt("N2");
+    on_sum += compressor_cycle_history[i].on_seconds;
+    off_sum += compressor_cycle_history[i].off_seconds;
   }
-}
 
-// --------------------------------------
+  *on_duration = on_sum / compressor_cycle_history_count * 1000;
+  *off_duration = off_sum / compressor_cycle_history_count * 1000;
 
-void set_compressor(bool state)
+  return true;
+}
+
+bool is_in_fallback_mode()
 {
-  if(state != current_state.actual_compressor_state)
-  {
-    // if we off and going on
-    if(state == HIGH)
-    {
-      compressor_turned_on_at = millis();
-      compressor_turned_off_at = 0;
-    }
-    else
-    {
-      compressor_turned_off_at = millis();
-      compressor_turned_on_at = 0;
-    }
+  // without an estimate yet it's the same as without a probe, there's no cabinet temperature to go by
+  return get_sensor_stage(CABINET_NTC) >= sensor_stage::sensor_degraded_stage || !estimator.initialized;
+}
 
-    digitalWrite(COMPRESSOR_RELAY, state);
-    digitalWrite(BLUE_LED_PIN, state);
+bool should_fallback_compressor_run()
+{
+  uint32_t on_duration;
+  uint32_t off_duration;
+  get_average_compressor_cycle(&on_duration, &off_duration);
 
-    current_state.actual_compressor_state = state;
+  if(is_compressor_on())
+  {
+    return hal_millis() - compressor_turned_on_at < on_duration;
   }
+
+  return compressor_turned_off_at == 0 || hal_millis() - compressor_turned_off_at >= off_duration;
 }
 
 // --------------------------------------
@@ -767,8 +3801,8 @@ void show_centered_text(const char *text, uint8_t font_size, int16_t x_offset, i
   int16_t cursor_y = LCD_CENTER;
 
   // shift by the offset, so a +100 means on the positive edge
-  cursor_x += cursor_x * ((float)x_offset / 100);
-  cursor_y += cursor_y * ((float)y_offset / 100);
+  cursor_x += (int32_t)cursor_x * x_offset / 100;
+  cursor_y += (int32_t)cursor_y * y_offset / 100;
 
   // shift back by half of the text size
   cursor_x -= text_width / 2;
@@ -778,6 +3812,24 @@ void show_centered_text(const char *text, uint8_t font_size, int16_t x_offset, i
   tft.print(text);
 }
 
+// the same for a string in flash, nothing on the screen is wider than this
+void show_centered_text_P(const char *text, uint8_t font_size, int16_t x_offset, int16_t y_offset, uint16_t color)
+{
+  char buffer[MAX_SCREEN_TEXT_LENGTH + 1];
+  strncpy_P(buffer, text, MAX_SCREEN_TEXT_LENGTH);
+  buffer[MAX_SCREEN_TEXT_LENGTH] = '\0';
+
+  show_centered_text(buffer, font_size, x_offset, y_offset, color);
+}
+
+menu_entry get_menu_entry(uint8_t index)
+{
+  menu_entry entry;
+  memcpy_P(&entry, &menu_entries[index], sizeof(entry));
+
+  return entry;
+}
+
 void draw_outer_ring(int16_t start_color, int16_t end_color)
 {
   int16_t start_r = (start_color >> 11) & 0x1F;
@@ -790,11 +3842,10 @@ void draw_outer_ring(int16_t start_color, int16_t end_color)
 
   for (int i = 0; i < 8; i++)
   {
-    float progress = (float)i / 7;
-
-    int16_t r = start_r + (end_r - start_r) * progress;
-    int16_t g = start_g + (end_g - start_g) * progress;
-    int16_t b = start_b + (end_b - start_b) * progress;
+    // progress goes from 0/7 to 7/7
+    int16_t r = start_r + (end_r - start_r) * i / 7;
+    int16_t g = start_g + (end_g - start_g) * i / 7;
+    int16_t b = start_b + (end_b - start_b) * i / 7;
 
     // Convert RGB to 16-bit color
     uint16_t color = (r << 11) | (g << 5) | b;
@@ -811,24 +3862,40 @@ void display_home_screen()
   {
     previous_status = current_state.status;
     showing_new_screen = false;
-    draw_outer_ring(status_colors[current_state.status][0], status_colors[current_state.status][1]);
+    draw_outer_ring(pgm_read_word(&status_colors[current_state.status][0]), pgm_read_word(&status_colors[current_state.status][1]));
   }
 
   if(screen_should_refresh)
   {
     char target_str[16];
-    dtostrf(active_config.target_temperature, 4, 1, target_str);
+    format_temperature(get_target_temperature(), 4, 1, target_str);
 
     char target_text[32];
-    sprintf(target_text, "Target: %s", target_str);
+    sprintf_P(target_text, PSTR("Target: %s"), target_str);
+
+#ifdef WITH_ALARMS
+    // an alarm nobody has acknowledged yet takes the place of the target
+    if(current_state.alarms_latched)
+    {
+      uint8_t alarm = 0;
+      while(!(current_state.alarms_latched & (1 << alarm)))
+      {
+        alarm++;
+      }
 
-    show_centered_text(target_text, 2, 0, -50);
+      show_centered_text_P(alarm_strings[alarm], 2, 0, -50, GC9A01A_RED);
+    }
+    else
+#endif
+    {
+      show_centered_text(target_text, 2, 0, -50);
+    }
 
     char current_temp_str[16];
-    dtostrf(current_state.current_ntc1_temperature, 5, 2, current_temp_str);
+    format_temperature(current_state.ntc_temperatures[CABINET_NTC], 5, 2, current_temp_str);
 
     show_centered_text(current_temp_str, 5, 0, 0);
-    show_centered_text(freezer_status_strings[current_state.status], 2, 0, 50, status_colors[current_state.status][0]);
+    show_centered_text_P(freezer_status_strings[current_state.status], 2, 0, 50, pgm_read_word(&status_colors[current_state.status][0]));
 
     screen_should_refresh = false;
   }
@@ -843,16 +3910,19 @@ void display_info_screen()
 
   if(screen_should_refresh)
   {
-    char display_str[16];
+    char display_str[24];
     char ntc_str[16];
 
-    dtostrf(current_state.current_ntc1_temperature, 4, 1, ntc_str);
-    sprintf(display_str, "NTC1: %s", ntc_str);
-    show_centered_text(display_str, 2, 0, -55);
+    // white, yellow, orange and red for ok, warning, degraded and failed
+    static const uint16_t stage_colors[] PROGMEM = {GC9A01A_WHITE, GC9A01A_YELLOW, GC9A01A_ORANGE, GC9A01A_RED};
 
-    dtostrf(current_state.current_ntc2_temperature, 4, 1, ntc_str);
-    sprintf(display_str, "NTC2: %s", ntc_str);
-    show_centered_text(display_str, 2, 0, -30);
+    format_temperature(current_state.ntc_temperatures[CABINET_NTC], 4, 1, ntc_str);
+    sprintf_P(display_str, PSTR("NTC1: %s"), ntc_str);
+    show_centered_text(display_str, 2, 0, -55, pgm_read_word(&stage_colors[get_sensor_stage(CABINET_NTC)]));
+
+    format_temperature(current_state.ntc_temperatures[COMPRESSOR_NTC], 4, 1, ntc_str);
+    sprintf_P(display_str, PSTR("NTC2: %s"), ntc_str);
+    show_centered_text(display_str, 2, 0, -30, pgm_read_word(&stage_colors[get_sensor_stage(COMPRESSOR_NTC)]));
 
 //    RtcDateTime now = rtc_clock.GetDateTime();
 //
@@ -867,13 +3937,31 @@ void display_info_screen()
 //
 
     char millis_str[16];
-    sprintf(millis_str, "MS: %lu", millis());
+    sprintf_P(millis_str, PSTR("MS: %lu"), (unsigned long)hal_millis());
 
-    show_centered_text(reset_by_watchdog ? "W RESET: YES" : "W-RESET: NO", 2, 0, 0, reset_by_watchdog ? GC9A01A_RED : GC9A01A_GREEN);
+    show_centered_text_P(reset_by_watchdog ? PSTR("W RESET: YES") : PSTR("W-RESET: NO"), 2, 0, 0, reset_by_watchdog ? GC9A01A_RED : GC9A01A_GREEN);
 
     show_centered_text(millis_str, 2, 0, 20);
 
-    show_centered_text(logging_enabled ? "LOG (TRUE)" : "LOG (FALSE)", 2, 0, 50, logging_enabled ? GC9A01A_GREEN : GC9A01A_RED);
+    show_centered_text_P(logging_enabled ? PSTR("LOG (TRUE)") : PSTR("LOG (FALSE)"), 2, 0, 50, logging_enabled ? GC9A01A_GREEN : GC9A01A_RED);
+
+#ifdef WITH_HEALTH
+    // green while nothing drifted, yellow for one drift and red for more
+    if(current_state.health_score == HEALTH_SCORE_UNKNOWN)
+    {
+      strcpy_P(display_str, PSTR("HEALTH: --"));
+    }
+    else
+    {
+      sprintf_P(display_str, PSTR("HEALTH: %u%%"), current_state.health_score);
+    }
+
+    uint8_t drifts = ((current_state.health_flags & health_pull_down_drift) != 0) + ((current_state.health_flags & health_compressor_temperature_drift) != 0)
+        + ((current_state.health_flags & health_run_time_drift) != 0);
+    static const uint16_t health_colors[] PROGMEM = {GC9A01A_GREEN, GC9A01A_YELLOW, GC9A01A_RED, GC9A01A_RED};
+
+    show_centered_text(display_str, 2, 0, 75, pgm_read_word(&health_colors[drifts]));
+#endif
 
     screen_should_refresh = false;
   }
@@ -889,16 +3977,18 @@ void display_config_screen(int32_t config_index)
   if(screen_should_refresh)
   {
     // clear
-    menu_entry entry = menu_entries[config_index];
+    menu_entry entry = get_menu_entry(config_index);
 
     show_centered_text(entry.name, 2, 0, -50);
     show_centered_text(entry.unit, 2, 0, 50);
 
     char value_str[32];
 
-    if (entry.is_float)
+    if (entry.is_temperature)
     {
-      dtostrf(*(float*)entry.value, 5, 2, value_str);
+      format_temperature(*(temperature*)entry.value, 5, 2, value_str);
+    } else if (entry.value_strings) {
+      strcpy_P(value_str, entry.value_strings[*(int16_t*)entry.value]);
     } else {
       itoa(*(uint32_t*)entry.value, value_str, 10);
     }
@@ -911,6 +4001,137 @@ void display_config_screen(int32_t config_index)
   }
 }
 
+void display_statistics_screen()
+{
+  if(showing_new_screen)
+  {
+    showing_new_screen = false;
+  }
+
+  if(screen_should_refresh)
+  {
+    char display_str[24];
+
+    sprintf_P(display_str, PSTR("1H: %u%%"), hour_duty.get_duty_percent());
+    show_centered_text(display_str, 2, 0, -55);
+
+    sprintf_P(display_str, PSTR("24H: %u%% 7D: %u%%"), day_duty.get_duty_percent(), week_duty.get_duty_percent());
+    show_centered_text(display_str, 2, 0, -30);
+
+    sprintf_P(display_str, PSTR("ON: %luH"), (unsigned long)(active_statistics.on_seconds / 3600));
+    show_centered_text(display_str, 2, 0, 0);
+
+    sprintf_P(display_str, PSTR("CYCLES: %lu"), (unsigned long)active_statistics.cycles);
+    show_centered_text(display_str, 2, 0, 20);
+
+    // no %f on the avr, so the kwh are printed as a whole & a tenth
+    sprintf_P(display_str, PSTR("%lu.%lu KWH"), (unsigned long)(active_statistics.watt_hours / 1000),
+        (unsigned long)(active_statistics.watt_hours % 1000 / 100));
+    show_centered_text(display_str, 2, 0, 50, GC9A01A_GREEN);
+
+    screen_should_refresh = false;
+  }
+}
+
+void display_calibration_screen()
+{
+  if(showing_new_screen)
+  {
+    showing_new_screen = false;
+  }
+
+  if(screen_should_refresh)
+  {
+    char title_str[24];
+    char value_str[16];
+    char reading_str[24];
+
+    if(calibration.step == calibration_step::calibration_inactive)
+    {
+      show_centered_text_P(PSTR(" Calibration "), 2, 0, -50);
+      show_centered_text_P(PSTR("Press To Start"), 2, 0, 0);
+    }
+    else if(calibration.step == calibration_step::calibration_select)
+    {
+      show_centered_text_P(PSTR(" Calibration "), 2, 0, -50);
+      if(calibration.option == CALIBRATION_OPTION_RESET)
+      {
+        strcpy_P(value_str, PSTR("Reset Default"));
+      }
+      else if(calibration.option == CALIBRATION_OPTION_CANCEL)
+      {
+        strcpy_P(value_str, PSTR("   Cancel    "));
+      }
+      else
+      {
+        sprintf_P(value_str, PSTR("NTC%d  %d Point"), calibration.option / 2 + 1, 2 + calibration.option % 2);
+      }
+
+      show_centered_text(value_str, 2, 0, 0, GC9A01A_YELLOW);
+    }
+    else if(calibration.step == calibration_step::calibration_capture)
+    {
+      // %S would take the flash string directly, but the host printf reads that as a wide string
+      char point_str[sizeof(calibration_point_strings[0])];
+      strcpy_P(point_str, calibration_point_strings[calibration.points_captured]);
+      sprintf_P(title_str, PSTR("N%d %s %d/%d"), calibration.channel + 1, point_str, calibration.points_captured + 1, calibration.point_count);
+      show_centered_text(title_str, 2, 0, -50);
+
+      format_temperature(calibration.reference, 6, 1, value_str);
+      show_centered_text(value_str, 4, 0, 0, GC9A01A_YELLOW);
+
+      // what the probe reads with the current calibration, so it can be compared to the reference
+      format_temperature(sensors.read(calibration.channel), 6, 2, value_str);
+      sprintf_P(reading_str, PSTR("Now: %s"), value_str);
+      show_centered_text(reading_str, 2, 0, 50);
+    }
+    else if(calibration.step == calibration_step::calibration_confirm)
+    {
+      sprintf_P(title_str, PSTR("NTC%d Result"), calibration.channel + 1);
+      show_centered_text(title_str, 2, 0, -50);
+
+      if(!calibration.result_valid)
+      {
+        show_centered_text_P(PSTR(" Failed  "), 3, 0, 0, GC9A01A_RED);
+      }
+      else
+      {
+        show_centered_text_P(calibration.option == 0 ? PSTR("  Save   ") : PSTR(" Discard "), 3, 0, 0, GC9A01A_YELLOW);
+
+        // preview of the reading with the new coefficients
+        format_temperature(ntc_coefficients_to_temperature(calibration.result, sensors.adc_sum(calibration.channel)), 6, 2, value_str);
+        sprintf_P(reading_str, PSTR("New: %s"), value_str);
+        show_centered_text(reading_str, 2, 0, 50);
+      }
+    }
+
+    screen_should_refresh = false;
+  }
+}
+
+void display_profile_screen()
+{
+  if(showing_new_screen)
+  {
+    showing_new_screen = false;
+  }
+
+  if(screen_should_refresh)
+  {
+    char profile_str[16];
+    sprintf_P(profile_str, PSTR("Profile %d/%d"), current_state.active_profile + 1, PROFILE_COUNT);
+
+    show_centered_text(profile_str, 2, 0, -50);
+
+    tft.fillRect(0, 80, 400, 70, GC9A01A_BLACK);
+
+    show_centered_text_P(profile_names[current_state.active_profile], 3, 0, 0, GC9A01A_YELLOW);
+    show_centered_text_P(PSTR("Push For Next"), 2, 0, 50);
+
+    screen_should_refresh = false;
+  }
+}
+
 void refresh_display()
 {
   if(showing_new_screen)
@@ -926,6 +4147,24 @@ void refresh_display()
   {
     display_info_screen();
   }
+#ifdef WITH_STATISTICS
+  else if(screen_index == STATISTICS_SCREEN)
+  {
+    display_statistics_screen();
+  }
+#endif
+#ifdef WITH_CALIBRATION
+  else if(screen_index == CALIBRATION_SCREEN)
+  {
+    display_calibration_screen();
+  }
+#endif
+#ifdef WITH_PROFILES
+  else if(screen_index == PROFILE_SCREEN)
+  {
+    display_profile_screen();
+  }
+#endif
   else
   {
     display_config_screen(screen_index - 1);
@@ -936,6 +4175,55 @@ void refresh_display()
 
 void handle_input()
 {
+#ifdef WITH_CALIBRATION
+  if(calibration_button_pending)
+  {
+    calibration_button_pending = false;
+    on_calibration_button_pressed();
+  }
+#endif
+
+#ifdef WITH_ALARMS
+  if(alarm_ack_pending)
+  {
+    alarm_ack_pending = false;
+    acknowledge_alarms();
+    screen_should_refresh = true;
+  }
+#endif
+
+#ifdef WITH_PROFILES
+  if(profile_button_pending)
+  {
+    profile_button_pending = false;
+
+    // one push goes to the next profile, there are only a few so there is no need to pick one
+    select_profile((current_state.active_profile + 1) % PROFILE_COUNT);
+    screen_should_refresh = true;
+  }
+#endif
+
+#ifdef WITH_BOOST
+  // the button interrupt only fires on release, so a long press is polled for here instead
+  if(screen_index == HOME_SCREEN && hal_digital_read(ROTARY_SW) == LOW)
+  {
+    if(button_pressed_at == 0)
+    {
+      button_pressed_at = hal_millis();
+    }
+    else if(!long_press_handled && hal_millis() - button_pressed_at >= LONG_PRESS_TIME)
+    {
+      long_press_handled = true;
+      set_boost(!boost_active);
+    }
+  }
+  else
+  {
+    button_pressed_at = 0;
+    long_press_handled = false;
+  }
+#endif
+
   int32_t current_position = input_rotary_encoder.read();
 
   if(current_position == last_encoder_position)
@@ -950,15 +4238,22 @@ void handle_input()
 
   bool direction = current_position - last_encoder_position < 0;
 
+#ifdef WITH_CALIBRATION
+  if(screen_index == CALIBRATION_SCREEN && calibration.step != calibration_step::calibration_inactive)
+  {
+    on_calibration_rotated(direction);
+  }
+  else
+#endif
   if(!edit_mode)
   {
     screen_index += direction ? 1 : -1;
 
     if(screen_index < 0)
     {
-      screen_index = 7;
+      screen_index = LAST_SCREEN;
     }
-    else if(screen_index > 7)
+    else if(screen_index > LAST_SCREEN)
     {
       screen_index = 0;
     }
@@ -968,47 +4263,27 @@ void handle_input()
   }
   else
   {
-    menu_entry entry = menu_entries[screen_index -1];
+    menu_entry entry = get_menu_entry(screen_index - 1);
 
-    if(entry.is_float)
-    {
-      if(direction)
-      {
-        *(float*)entry.value += entry.increment;
-      }
-      else
-      {
-        *(float*)entry.value -= entry.increment;
-      }
+    // temperatures are stored as centi-degrees, so they can be stepped exactly like the int16_t entries
+    int16_t* value = (int16_t*)entry.value;
 
-      if(*(float*)entry.value < entry.min)
-      {
-        *(float*)entry.value = entry.max;
-      }
-      else if(*(float*)entry.value > entry.max)
-      {
-        *(float*)entry.value = entry.min;
-      }
+    if(direction)
+    {
+      *value += entry.increment;
     }
     else
     {
-      if(direction)
-      {
-        *(int16_t*)entry.value += (int16_t)entry.increment;
-      }
-      else
-      {
-        *(int16_t*)entry.value -= (int16_t)entry.increment;
-      }
+      *value -= entry.increment;
+    }
 
-      if(*(int16_t*)entry.value < (int16_t)entry.min)
-      {
-        *(int16_t*)entry.value = (int16_t)entry.max;
-      }
-      else if(*(int16_t*)entry.value > (int16_t)entry.max)
-      {
-        *(int16_t*)entry.value = (int16_t)entry.min;
-      }
+    if(*value < entry.min)
+    {
+      *value = entry.max;
+    }
+    else if(*value > entry.max)
+    {
+      *value = entry.min;
     }
 
     screen_should_refresh = true;
@@ -1019,12 +4294,41 @@ void handle_input()
 
 void on_button_pressed()
 {
-  if(screen_index != HOME_SCREEN && screen_index != INFO_SCREEN)
+#ifdef WITH_ALARMS
+  // a short push on the home screen acknowledges the alarms, the release after a long press is the boost toggle
+  if(screen_index == HOME_SCREEN && !long_press_handled && current_state.alarms_latched)
+  {
+    alarm_ack_pending = true;
+    return;
+  }
+#endif
+
+  if(screen_index != HOME_SCREEN && screen_index != INFO_SCREEN && screen_index != STATISTICS_SCREEN)
   {
-    if(millis() - edit_mode_toggled_at < 500)
+    if(hal_millis() - edit_mode_toggled_at < 500)
+    {
+      return;
+    }
+
+#ifdef WITH_CALIBRATION
+    // the calibration steps do float math and eeprom writes, so they are handled in handle_input() instead
+    if(screen_index == CALIBRATION_SCREEN)
+    {
+      calibration_button_pending = true;
+      edit_mode_toggled_at = hal_millis();
+      return;
+    }
+#endif
+
+#ifdef WITH_PROFILES
+    // switching profiles writes to the eeprom as well
+    if(screen_index == PROFILE_SCREEN)
     {
+      profile_button_pending = true;
+      edit_mode_toggled_at = hal_millis();
       return;
     }
+#endif
 
     // if we are just leaving edit mode then save teh config and mark it as dirty
     if(edit_mode)
@@ -1034,12 +4338,114 @@ void on_button_pressed()
     }
 
     edit_mode = !edit_mode;
-    edit_mode_toggled_at = millis();
+    edit_mode_toggled_at = hal_millis();
 
     screen_should_refresh = true;
   }
 }
 
+void on_calibration_rotated(bool direction)
+{
+  if(calibration.step == calibration_step::calibration_select)
+  {
+    if(direction)
+    {
+      calibration.option = calibration.option + 1 >= CALIBRATION_OPTION_COUNT ? 0 : calibration.option + 1;
+    }
+    else
+    {
+      calibration.option = calibration.option == 0 ? CALIBRATION_OPTION_COUNT - 1 : calibration.option - 1;
+    }
+  }
+  else if(calibration.step == calibration_step::calibration_capture)
+  {
+    calibration.reference = direction ? calibration.reference + CALIBRATION_REFERENCE_INCREMENT : calibration.reference - CALIBRATION_REFERENCE_INCREMENT;
+
+    if(calibration.reference < MIN_CALIBRATION_REFERENCE)
+    {
+      calibration.reference = MAX_CALIBRATION_REFERENCE;
+    }
+    else if(calibration.reference > MAX_CALIBRATION_REFERENCE)
+    {
+      calibration.reference = MIN_CALIBRATION_REFERENCE;
+    }
+  }
+  else if(calibration.step == calibration_step::calibration_confirm)
+  {
+    calibration.option = !calibration.option;
+  }
+
+  screen_should_refresh = true;
+}
+
+void on_calibration_button_pressed()
+{
+  if(calibration.step == calibration_step::calibration_inactive)
+  {
+    calibration.option = 0;
+    calibration.step = calibration_step::calibration_select;
+  }
+  else if(calibration.step == calibration_step::calibration_select)
+  {
+    if(calibration.option == CALIBRATION_OPTION_RESET)
+    {
+      reset_calibration();
+      save_calibration();
+      rebuild_ntc_tables();
+
+      calibration.step = calibration_step::calibration_inactive;
+    }
+    else if(calibration.option == CALIBRATION_OPTION_CANCEL)
+    {
+      calibration.step = calibration_step::calibration_inactive;
+    }
+    else
+    {
+      calibration.channel = calibration.option / 2;
+      calibration.point_count = 2 + calibration.option % 2;
+      calibration.points_captured = 0;
+      calibration.reference = calibration_point_defaults[0];
+      calibration.step = calibration_step::calibration_capture;
+    }
+  }
+  else if(calibration.step == calibration_step::calibration_capture)
+  {
+    // this uses the last reading from update_state(), so the probe should be left to settle before pressing
+    calibration_point& point = calibration.points[calibration.points_captured];
+    point.adc_sum = sensors.adc_sum(calibration.channel);
+    point.reference = calibration.reference;
+
+    calibration.points_captured++;
+
+    if(calibration.points_captured < calibration.point_count)
+    {
+      calibration.reference = calibration_point_defaults[calibration.points_captured];
+    }
+    else
+    {
+      calibration.result_valid = solve_ntc_coefficients(calibration.points, calibration.point_count, &calibration.result);
+      calibration.option = 0;
+      calibration.step = calibration_step::calibration_confirm;
+    }
+  }
+  else if(calibration.step == calibration_step::calibration_confirm)
+  {
+    if(calibration.result_valid && calibration.option == 0)
+    {
+      active_calibration.channels[calibration.channel] = calibration.result;
+
+      save_calibration();
+      rebuild_ntc_tables();
+    }
+
+    calibration.step = calibration_step::calibration_inactive;
+  }
+
+  // the layout changes with every press, so we need a full clear
+  showing_new_screen = true;
+  screen_should_refresh = true;
+}
+
 // --------------------------------------
 
 uint8_t calculate_crc8(const uint8_t *data, uint8_t len)
@@ -1080,14 +4486,16 @@ volatile void log_state()
 //    data_point.unix_time = rtc_clock.GetDateTime().Unix32Time();
 //  }
 
-  data_point.ms_since_startup = millis();
+  data_point.ms_since_startup = hal_millis();
   data_point.state = current_state;
 
   data_point.config = active_config;
 
   data_point.crc = calculate_crc8((uint8_t*)&data_point, sizeof(freezer_state_data_point));
 
+  hal_profile_begin(hal_profile_section::profile_save_data_point);
   save_data_point(&data_point);
+  hal_profile_end(hal_profile_section::profile_save_data_point);
 }
 
 struct sd_count_sector
@@ -1193,10 +4601,10 @@ bool init_sd_card()
   SPI.begin();
   SPISettings sdSpiSettings(250000, MSBFIRST, SPI_MODE0);
 
-  pinMode(MICRO_SD_CS, OUTPUT);
-  digitalWrite(MICRO_SD_CS, HIGH);
+  hal_pin_mode(MICRO_SD_CS, OUTPUT);
+  hal_digital_write(MICRO_SD_CS, HIGH);
 
-  delay(300);
+  hal_delay(300);
 
   // at least 74 clock cycles after power up
   SPI.beginTransaction(sdSpiSettings);
@@ -1206,13 +4614,13 @@ bool init_sd_card()
   }
   SPI.endTransaction();
 
-  digitalWrite(MICRO_SD_CS, LOW);
+  hal_digital_write(MICRO_SD_CS, LOW);
 
   // Reset the card ( CMD0 )
   send_card_command(0, 0, 0x95); // 0x95 is the pre-calculated crc
   if (read_card_response() != 0x01)
   {
-    digitalWrite(MICRO_SD_CS, HIGH);
+    hal_digital_write(MICRO_SD_CS, HIGH);
 
     // Serial.println("init_sd_card() : invalid response after sending CMD0");
     return false;
@@ -1224,7 +4632,7 @@ bool init_sd_card()
   send_card_command(8, 0x01AA, 0x87);
   if (read_card_response() != 0x01)
   {
-    digitalWrite(MICRO_SD_CS, HIGH);
+    hal_digital_write(MICRO_SD_CS, HIGH);
 
     // Serial.println("init_sd_card() : invalid response after sending CMD0");
 
@@ -1238,7 +4646,7 @@ bool init_sd_card()
     send_card_command(55, 0, 0x01);
     if (read_card_response() != 0x01)
     {
-      digitalWrite(MICRO_SD_CS, HIGH);
+      hal_digital_write(MICRO_SD_CS, HIGH);
 
       // Serial.println("init_sd_card() : invalid response after sending CMD55");
       return false;
@@ -1255,7 +4663,7 @@ bool init_sd_card()
     }
   }
 
-  digitalWrite(MICRO_SD_CS, HIGH);
+  hal_digital_write(MICRO_SD_CS, HIGH);
 
   // write an extra dunmmy byte after pulling the cs line high
   // this might be needed if you have other devices on the same
@@ -1314,7 +4722,7 @@ uint8_t read_card_response()
 
 bool wait_card_busy()
 {
-  auto start_time = millis();
+  auto start_time = hal_millis();
 
   // wait until the card pulls the DO high ( we receive a 0xFF )
   // or until we time out after 300ms, I don't have a particular reason
@@ -1330,7 +4738,7 @@ bool wait_card_busy()
       return true;
     }
 
-    if(millis() - start_time > 300)
+    if(hal_millis() - start_time > 300)
     {
       return false;
     }
@@ -1341,13 +4749,13 @@ bool read_card_block(uint32_t block_addr, uint8_t* buffer, uint16_t buffer_size)
 {
   SPISettings sdSpiSettings(250000, MSBFIRST, SPI_MODE0);
 
-  digitalWrite(MICRO_SD_CS, LOW);
+  hal_digital_write(MICRO_SD_CS, LOW);
 
   // send CMD17 ( read block ) with the block address as the parameter
   send_card_command(17, block_addr, 0x01);
   if (read_card_response() != 0x00)
   {
-    digitalWrite(MICRO_SD_CS, HIGH);
+    hal_digital_write(MICRO_SD_CS, HIGH);
     return false;
   }
 
@@ -1374,7 +4782,7 @@ bool read_card_block(uint32_t block_addr, uint8_t* buffer, uint16_t buffer_size)
 
   SPI.endTransaction();
 
-  digitalWrite(MICRO_SD_CS, HIGH);
+  hal_digital_write(MICRO_SD_CS, HIGH);
 
   // write an extra dunmmy byte after pulling the cs line high
   // this might be needed if you have other devices on the same
@@ -1388,13 +4796,13 @@ bool write_card_block(uint32_t block_addr, const void* buffer, uint16_t buffer_s
 {
   SPISettings sdSpiSettings(250000, MSBFIRST, SPI_MODE0);
 
-  digitalWrite(MICRO_SD_CS, LOW);
+  hal_digital_write(MICRO_SD_CS, LOW);
 
   // send CMD14 (block write)
   send_card_command(24, block_addr, 0x01);
   if (read_card_response() != 0x00)
   {
-    digitalWrite(MICRO_SD_CS, HIGH);
+    hal_digital_write(MICRO_SD_CS, HIGH);
     return false;
   }
 
@@ -1427,7 +4835,7 @@ bool write_card_block(uint32_t block_addr, const void* buffer, uint16_t buffer_s
   if ((response & 0x1F) != 0x05)
   {
     SPI.endTransaction();
-    digitalWrite(MICRO_SD_CS, HIGH);
+    hal_digital_write(MICRO_SD_CS, HIGH);
     return false;
   }
 
@@ -1436,7 +4844,7 @@ bool write_card_block(uint32_t block_addr, const void* buffer, uint16_t buffer_s
 
   SPI.endTransaction();
 
-  digitalWrite(MICRO_SD_CS, HIGH);
+  hal_digital_write(MICRO_SD_CS, HIGH);
 
   // write an extra dunmmy byte after pulling the cs line high
   // this might be needed if you have other devices on the same
@@ -0,0 +1,1731 @@
+// --------------------------------------------
+// Freezer X Controller - Control Tests
+// --------------------------------------------
+
+// the control core on the virtual hardware: the transition table, the predicates it's fed from & the compressor
+// protections end to end, then the features around it one section each. every scenario boots the unmodified firmware in its own process like native/replay.cpp does,
+// so the globals in main.cpp start over, and drives it on the virtual clock a second per loop() against a small model
+// of the two probes: the cabinet is wherever the test puts it, drifting down slowly while the compressor runs, and the
+// compressor shell warms up while it runs. both have to move during a run or the stuck check takes them out.
+//
+// `pio test -e test`
+
+#include <math.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <unity.h>
+
+#include "../../src/main.cpp"
+
+#include "hal_native.h"
+
+// --------------------------------------
+// Probe Model
+
+const double NTC_BETA = 3950;
+const double NTC_SERIES_RESISTOR = 10000;
+
+const double AMBIENT = 25;
+const double COMPRESSOR_RUNNING = 35; // the shell settles here while running, well clear of the max temp
+const double COMPRESSOR_TAU = 600; // seconds
+const double CABINET_PULL_DOWN = 0.002; // degrees per second while running, a loaded cabinet that takes hours to get there
+const double PROBE_RAMP = 1; // degrees per second, inside what the plausibility checks allow
+
+const uint32_t MINUTE = 60; // seconds, the tests count in those
+
+double cabinet_temperature = 0;
+double compressor_temperature = AMBIENT;
+bool compressor_held = false; // the test sets the shell temperature instead of the model
+uint16_t cabinet_adc_override = 0; // a shorted or broken cabinet probe, 0 reads the model
+
+uint16_t temperature_to_adc(double temperature, double r25)
+{
+  double resistance = r25 * exp(NTC_BETA * (1 / (temperature + 273.15) - 1 / 298.15));
+
+  return (uint16_t)(1023 * resistance / (resistance + NTC_SERIES_RESISTOR) + 0.5);
+}
+
+uint16_t read_probe_adc(uint8_t pin)
+{
+  if(pin == THERMISTOR_1_PIN)
+  {
+    return cabinet_adc_override ? cabinet_adc_override : temperature_to_adc(cabinet_temperature, NOMINAL_RESISTANCE_NTC_1);
+  }
+
+  if(pin == THERMISTOR_2_PIN)
+  {
+    return temperature_to_adc(compressor_temperature, NOMINAL_RESISTANCE_NTC_2);
+  }
+
+  return 0;
+}
+
+// --------------------------------------
+// Firmware
+
+bool is_relay_on()
+{
+  return hal_native_get_digital(COMPRESSOR_RELAY) == HIGH;
+}
+
+bool is_relay_off()
+{
+  return hal_native_get_digital(COMPRESSOR_RELAY) == LOW;
+}
+
+void boot()
+{
+  hal_native_erase_storage();
+  hal_native_analog_read = read_probe_adc;
+
+  setup();
+}
+
+void run_for(uint32_t seconds)
+{
+  for(uint32_t i = 0; i < seconds; i++)
+  {
+    bool running = is_relay_on();
+
+    cabinet_temperature -= running ? CABINET_PULL_DOWN : 0;
+
+    if(!compressor_held)
+    {
+      compressor_temperature += ((running ? COMPRESSOR_RUNNING : AMBIENT) - compressor_temperature) / COMPRESSOR_TAU;
+    }
+
+    hal_native_advance(1000);
+    loop();
+  }
+}
+
+// runs until the condition holds, returns false if it didn't within the time
+bool run_until(bool (*condition)(), uint32_t seconds)
+{
+  for(uint32_t i = 0; i < seconds; i++)
+  {
+    if(condition())
+    {
+      return true;
+    }
+
+    run_for(1);
+  }
+
+  return condition();
+}
+
+void move_cabinet_to(double temperature)
+{
+  while(fabs(cabinet_temperature - temperature) > PROBE_RAMP)
+  {
+    cabinet_temperature += cabinet_temperature < temperature ? PROBE_RAMP : -PROBE_RAMP;
+    run_for(1);
+  }
+
+  cabinet_temperature = temperature;
+  run_for(1);
+}
+
+void move_compressor_to(double temperature)
+{
+  compressor_held = true;
+
+  while(fabs(compressor_temperature - temperature) > PROBE_RAMP)
+  {
+    compressor_temperature += compressor_temperature < temperature ? PROBE_RAMP : -PROBE_RAMP;
+    run_for(1);
+  }
+
+  compressor_temperature = temperature;
+  run_for(1);
+}
+
+uint32_t seconds_since_boot()
+{
+  return hal_millis() / 1000;
+}
+
+// boots the firmware in a child process & runs the scenario there, a failed assertion has already been
+// reported by the child by the time it exits
+void run_booted(void (*scenario)())
+{
+  fflush(stdout);
+  pid_t child = fork();
+
+  if(child == 0)
+  {
+    if(TEST_PROTECT())
+    {
+      boot();
+      scenario();
+    }
+
+    fflush(stdout);
+    _exit(Unity.CurrentTestFailed ? 1 : 0);
+  }
+
+  int status = 0;
+  TEST_ASSERT_TRUE_MESSAGE(child > 0 && waitpid(child, &status, 0) == child, "couldn't start the firmware");
+  TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(status) && WEXITSTATUS(status) == 0, "failed in the booted firmware");
+}
+
+// --------------------------------------
+// Control Table
+
+void assert_transition(uint8_t status, uint16_t inputs, freezer_status expected_status, void (*expected_action)())
+{
+  control_transition transition = get_control_transition(find_control_transition(status, inputs));
+
+  TEST_ASSERT_EQUAL_INT(expected_status, transition.to);
+  TEST_ASSERT_TRUE(transition.action == expected_action);
+}
+
+void test_startup_delay_comes_first()
+{
+  assert_transition(freezer_status::off, input_startup_delay | input_demand | input_overheating | input_probe_failed, freezer_status::startup_delay, stop_compressor);
+}
+
+void test_failed_compressor_probe_stops()
+{
+  assert_transition(freezer_status::cooling, input_probe_failed | input_demand | input_compressor_on | input_min_runtime, freezer_status::sensor_failure, stop_compressor);
+}
+
+void test_overheat_with_demand_holds()
+{
+  assert_transition(freezer_status::cooling, input_demand | input_overheating | input_compressor_on, freezer_status::overheat, hold_compressor);
+}
+
+void test_overheat_without_demand_stops_as_overheat()
+{
+  // within the min runtime too, an overheat is the one thing that's allowed to cut a run short
+  assert_transition(freezer_status::min_runtime, input_overheating | input_compressor_on | input_min_runtime, freezer_status::overheat, stop_compressor);
+}
+
+void test_overheat_recovery_holds_off_demand()
+{
+  assert_transition(freezer_status::overheat, input_overheat_recovering | input_demand, freezer_status::overheat, stop_compressor);
+
+  // recovering only matters coming out of an overheat
+  assert_transition(freezer_status::reached_target, input_overheat_recovering | input_demand, freezer_status::cooling, run_compressor);
+}
+
+void test_max_runtime_holds_for_the_dead_time()
+{
+  assert_transition(freezer_status::cooling, input_demand | input_max_runtime | input_compressor_on, freezer_status::compressor_max_runtime, hold_compressor);
+  assert_transition(freezer_status::compressor_max_runtime, input_dead_time, freezer_status::compressor_max_runtime, stop_compressor);
+  assert_transition(freezer_status::compressor_max_runtime, input_demand, freezer_status::cooling, run_compressor);
+}
+
+void test_dead_time_only_holds_a_stopped_compressor()
+{
+  assert_transition(freezer_status::reached_target, input_demand | input_dead_time, freezer_status::dead_time, hold_compressor);
+  assert_transition(freezer_status::cooling, input_demand | input_dead_time | input_compressor_on, freezer_status::cooling, run_compressor);
+}
+
+void test_min_runtime_keeps_a_short_run_going()
+{
+  assert_transition(freezer_status::cooling, input_compressor_on | input_min_runtime, freezer_status::min_runtime, enforce_min_runtime);
+  assert_transition(freezer_status::cooling, input_demand | input_compressor_on | input_min_runtime, freezer_status::cooling, run_compressor);
+}
+
+void test_fallback_follows_its_own_demand()
+{
+  assert_transition(freezer_status::cooling, input_fallback | input_demand, freezer_status::sensor_fallback, run_compressor);
+  assert_transition(freezer_status::cooling, input_fallback, freezer_status::sensor_fallback, stop_compressor);
+}
+
+void test_demand_decides_the_rest()
+{
+  assert_transition(freezer_status::reached_target, input_demand, freezer_status::cooling, run_compressor);
+  assert_transition(freezer_status::cooling, 0, freezer_status::reached_target, stop_compressor);
+}
+
+// --------------------------------------
+// Compressor
+
+void switches_the_compressor()
+{
+  run_for(10);
+
+  uint32_t cycles = active_statistics.cycles;
+
+  set_compressor(HIGH);
+
+  TEST_ASSERT_TRUE(is_compressor_on());
+  TEST_ASSERT_TRUE(is_relay_on());
+  TEST_ASSERT_EQUAL_UINT8(HIGH, hal_native_get_digital(BLUE_LED_PIN));
+  TEST_ASSERT_EQUAL_UINT32(hal_millis(), compressor_turned_on_at);
+  TEST_ASSERT_EQUAL_UINT32(0, compressor_turned_off_at);
+  TEST_ASSERT_EQUAL_UINT32(cycles + 1, active_statistics.cycles);
+
+  // is_compressor_cooling() measures the rise of the shell from here
+  TEST_ASSERT_EQUAL_INT16(current_state.ntc_temperatures[COMPRESSOR_NTC].centi_degrees, estimator.compressor_start_temperature.centi_degrees);
+
+  // switching to the state it's already in changes nothing
+  hal_native_advance(90 * 1000);
+  uint32_t turned_on_at = compressor_turned_on_at;
+  set_compressor(HIGH);
+
+  TEST_ASSERT_EQUAL_UINT32(turned_on_at, compressor_turned_on_at);
+  TEST_ASSERT_EQUAL_UINT32(cycles + 1, active_statistics.cycles);
+
+  set_compressor(LOW);
+
+  TEST_ASSERT_FALSE(is_compressor_on());
+  TEST_ASSERT_TRUE(is_relay_off());
+  TEST_ASSERT_EQUAL_UINT8(LOW, hal_native_get_digital(BLUE_LED_PIN));
+  TEST_ASSERT_EQUAL_UINT32(hal_millis(), compressor_turned_off_at);
+  TEST_ASSERT_EQUAL_UINT32(0, compressor_turned_on_at);
+  TEST_ASSERT_EQUAL_UINT32(90 * 1000, last_compressor_on_duration);
+}
+
+void test_set_compressor()
+{
+  run_booted(switches_the_compressor);
+}
+
+// --------------------------------------
+// Scenarios
+
+void counts_the_dead_time_from_boot()
+{
+  // a reset might have cut a run short, so the first start waits out the dead time like any other
+  cabinet_temperature = 0;
+
+  run_for(1 * MINUTE);
+
+  TEST_ASSERT_FALSE(is_startup_delay_over());
+  TEST_ASSERT_EQUAL_INT(freezer_status::startup_delay, current_state.status);
+  TEST_ASSERT_TRUE(is_relay_off());
+
+  run_for(2 * MINUTE);
+
+  TEST_ASSERT_TRUE(is_startup_delay_over());
+  TEST_ASSERT_FALSE(has_dead_time_elapsed());
+  TEST_ASSERT_EQUAL_INT(freezer_status::dead_time, current_state.status);
+  TEST_ASSERT_EQUAL_UINT8(HIGH, current_state.target_compressor_state);
+  TEST_ASSERT_TRUE(is_relay_off());
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 3 * MINUTE));
+
+  TEST_ASSERT_INT_WITHIN(2, 5 * MINUTE, seconds_since_boot());
+  TEST_ASSERT_TRUE(has_dead_time_elapsed());
+  TEST_ASSERT_EQUAL_INT(freezer_status::cooling, current_state.status);
+}
+
+void test_dead_time_from_boot()
+{
+  run_booted(counts_the_dead_time_from_boot);
+}
+
+void keeps_a_short_run_going()
+{
+  cabinet_temperature = -17;
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 6 * MINUTE));
+  uint32_t started_at = seconds_since_boot();
+
+  // reaching the target right away, the demand is gone once the hysteresis time is over
+  move_cabinet_to(-20);
+  run_for(90);
+
+  TEST_ASSERT_TRUE(is_within_target_temperature());
+  TEST_ASSERT_TRUE(is_within_min_runtime());
+  TEST_ASSERT_EQUAL_INT(freezer_status::min_runtime, current_state.status);
+  TEST_ASSERT_EQUAL_UINT8(LOW, current_state.target_compressor_state);
+  TEST_ASSERT_TRUE(is_relay_on());
+  TEST_ASSERT_EQUAL_UINT32(1, current_state.prevented_short_cycles);
+
+  TEST_ASSERT_TRUE(run_until(is_relay_off, 1 * MINUTE));
+
+  TEST_ASSERT_INT_WITHIN(2, started_at + 2 * MINUTE, seconds_since_boot());
+  TEST_ASSERT_FALSE(is_within_min_runtime());
+  TEST_ASSERT_EQUAL_INT(freezer_status::reached_target, current_state.status);
+}
+
+void test_min_runtime()
+{
+  run_booted(keeps_a_short_run_going);
+}
+
+void stops_a_long_run()
+{
+  active_config.compressor_max_run_time = MIN_COMPRESSOR_MAX_RUNTIME;
+
+  // a cabinet that never gets there
+  cabinet_temperature = 0;
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 6 * MINUTE));
+  uint32_t started_at = seconds_since_boot();
+
+  TEST_ASSERT_TRUE(run_until(is_relay_off, 61 * MINUTE));
+
+  TEST_ASSERT_INT_WITHIN(2, started_at + 60 * MINUTE, seconds_since_boot());
+  TEST_ASSERT_EQUAL_INT(freezer_status::compressor_max_runtime, current_state.status);
+  TEST_ASSERT_FALSE(has_compressor_exceeded_max_runtime()); // only while it's running, the status carries it from here
+
+  // the demand is still there, it has to sit out the whole dead time
+  run_for(4 * MINUTE);
+
+  TEST_ASSERT_EQUAL_INT(freezer_status::compressor_max_runtime, current_state.status);
+  TEST_ASSERT_TRUE(is_relay_off());
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 2 * MINUTE));
+
+  TEST_ASSERT_INT_WITHIN(3, started_at + 65 * MINUTE, seconds_since_boot());
+  TEST_ASSERT_EQUAL_INT(freezer_status::cooling, current_state.status);
+}
+
+void test_max_runtime()
+{
+  run_booted(stops_a_long_run);
+}
+
+void stops_an_overheating_compressor_until_it_recovered()
+{
+  cabinet_temperature = 0;
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 6 * MINUTE));
+
+  // still within the min runtime, it doesn't get to finish it
+  move_compressor_to(47);
+
+  TEST_ASSERT_TRUE(run_until(is_relay_off, 10));
+  uint32_t stopped_at = seconds_since_boot();
+
+  TEST_ASSERT_TRUE(is_within_min_runtime() || !is_compressor_on());
+  TEST_ASSERT_TRUE(is_compressor_overheating());
+  TEST_ASSERT_EQUAL_INT(freezer_status::overheat, current_state.status);
+
+  // cooled down through the recovery band early on, but it still has to rest
+  compressor_held = false;
+  run_for(10 * MINUTE);
+
+  TEST_ASSERT_FALSE(is_compressor_overheating());
+  TEST_ASSERT_TRUE(is_compressor_recovering_from_overheat());
+  TEST_ASSERT_EQUAL_INT(freezer_status::overheat, current_state.status);
+  TEST_ASSERT_TRUE(is_relay_off());
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 6 * MINUTE));
+
+  TEST_ASSERT_INT_WITHIN(2, stopped_at + 15 * MINUTE, seconds_since_boot());
+  TEST_ASSERT_FALSE(is_compressor_recovering_from_overheat());
+  TEST_ASSERT_EQUAL_INT(freezer_status::cooling, current_state.status);
+}
+
+void test_overheat_stop_and_recovery()
+{
+  run_booted(stops_an_overheating_compressor_until_it_recovered);
+}
+
+void recovers_from_an_overheat_without_demand()
+{
+  cabinet_temperature = -17;
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 6 * MINUTE));
+
+  // the demand goes away, the min runtime keeps it going & then the shell overheats
+  move_cabinet_to(-20);
+  run_for(70);
+  TEST_ASSERT_EQUAL_INT(freezer_status::min_runtime, current_state.status);
+
+  move_compressor_to(47);
+
+  TEST_ASSERT_TRUE(run_until(is_relay_off, 10));
+  TEST_ASSERT_EQUAL_INT(freezer_status::overheat, current_state.status);
+
+  // the demand comes back once the dead time is over & the shell is below the max temp, but not through the band
+  move_cabinet_to(0);
+  move_compressor_to(42);
+  run_for(6 * MINUTE);
+
+  TEST_ASSERT_TRUE(has_dead_time_elapsed());
+  TEST_ASSERT_FALSE(is_compressor_overheating());
+  TEST_ASSERT_TRUE(is_compressor_recovering_from_overheat());
+  TEST_ASSERT_EQUAL_INT(freezer_status::overheat, current_state.status);
+  TEST_ASSERT_TRUE(is_relay_off());
+}
+
+void test_overheat_without_demand_recovers()
+{
+  run_booted(recovers_from_an_overheat_without_demand);
+}
+
+void cycles_without_the_cabinet_probe()
+{
+  // at the target, so nothing has run before the probe goes
+  cabinet_temperature = -25;
+  run_for(6 * MINUTE);
+
+  TEST_ASSERT_EQUAL_INT(freezer_status::reached_target, current_state.status);
+  TEST_ASSERT_FALSE(is_in_fallback_mode());
+
+  // shorted, it reads far too hot
+  cabinet_adc_override = 1;
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 10));
+  uint32_t started_at = seconds_since_boot();
+
+  TEST_ASSERT_TRUE(is_in_fallback_mode());
+  TEST_ASSERT_EQUAL_INT(freezer_status::sensor_fallback, current_state.status);
+
+  // without any learned cycles it's the default 15 minutes on & 15 off
+  TEST_ASSERT_TRUE(run_until(is_relay_off, 16 * MINUTE));
+  TEST_ASSERT_INT_WITHIN(2, started_at + 15 * MINUTE, seconds_since_boot());
+  TEST_ASSERT_EQUAL_INT(freezer_status::sensor_fallback, current_state.status);
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 16 * MINUTE));
+  TEST_ASSERT_INT_WITHIN(3, started_at + 30 * MINUTE, seconds_since_boot());
+  TEST_ASSERT_EQUAL_INT(freezer_status::sensor_fallback, current_state.status);
+}
+
+void test_fallback_cycling()
+{
+  run_booted(cycles_without_the_cabinet_probe);
+}
+
+// --------------------------------------
+// Temperatures
+
+void test_format_temperature()
+{
+  char buffer[16];
+
+  // one decimal rounds away from zero, like dtostrf() did
+  TEST_ASSERT_EQUAL_STRING("-18.6", format_temperature(centi_degrees(-1855), 0, 1, buffer));
+  TEST_ASSERT_EQUAL_STRING("  4.0", format_temperature(centi_degrees(399), 5, 1, buffer));
+
+  TEST_ASSERT_EQUAL_STRING(" -18.55", format_temperature(centi_degrees(-1855), 7, 2, buffer));
+  TEST_ASSERT_EQUAL_STRING("-0.05", format_temperature(centi_degrees(-5), 0, 2, buffer));
+
+  // the magnitude of the min doesn't fit in an int16_t
+  TEST_ASSERT_EQUAL_STRING("-327.68", format_temperature(MIN_REPRESENTABLE_TEMPERATURE, 0, 2, buffer));
+  TEST_ASSERT_EQUAL_STRING("-327.7", format_temperature(MIN_REPRESENTABLE_TEMPERATURE, 0, 1, buffer));
+  TEST_ASSERT_EQUAL_STRING("327.67", format_temperature(MAX_REPRESENTABLE_TEMPERATURE, 0, 2, buffer));
+}
+
+void test_temperature_from_celsius()
+{
+  TEST_ASSERT_EQUAL_INT16(2500, temperature_from_celsius(25).centi_degrees);
+  TEST_ASSERT_EQUAL_INT16(-1856, temperature_from_celsius(-18.556).centi_degrees);
+  TEST_ASSERT_EQUAL_INT16(1856, temperature_from_celsius(18.556).centi_degrees);
+
+  // out of range saturates instead of wrapping around
+  TEST_ASSERT_EQUAL_INT16(INT16_MAX, temperature_from_celsius(1000).centi_degrees);
+  TEST_ASSERT_EQUAL_INT16(INT16_MIN, temperature_from_celsius(-1000).centi_degrees);
+}
+
+// --------------------------------------
+// Calibration
+
+void converts_along_the_datasheet_curve()
+{
+  // the model probes follow the same b value curve the default tables are built from, so what's left is the
+  // interpolation between the table entries & the adc rounding
+  const double cabinet_temperatures[] = {-30, -18, 0, 25, 45};
+  const double compressor_temperatures[] = {25, 45, 60};
+
+  for(uint8_t i = 0; i < sizeof(cabinet_temperatures) / sizeof(cabinet_temperatures[0]); i++)
+  {
+    uint16_t adc_sum = temperature_to_adc(cabinet_temperatures[i], NOMINAL_RESISTANCE_NTC_1) * NTC_SAMPLE_COUNT;
+    TEST_ASSERT_INT_WITHIN(25, cabinet_temperatures[i] * 100, lookup_ntc_temperature(sensors.table(CABINET_NTC), adc_sum).centi_degrees);
+  }
+
+  for(uint8_t i = 0; i < sizeof(compressor_temperatures) / sizeof(compressor_temperatures[0]); i++)
+  {
+    uint16_t adc_sum = temperature_to_adc(compressor_temperatures[i], NOMINAL_RESISTANCE_NTC_2) * NTC_SAMPLE_COUNT;
+    TEST_ASSERT_INT_WITHIN(25, compressor_temperatures[i] * 100, lookup_ntc_temperature(sensors.table(COMPRESSOR_NTC), adc_sum).centi_degrees);
+  }
+
+  // shorted reads as hot as it gets, open as cold
+  TEST_ASSERT_EQUAL_INT16(INT16_MAX, lookup_ntc_temperature(sensors.table(CABINET_NTC), 0).centi_degrees);
+  TEST_ASSERT_TRUE(lookup_ntc_temperature(sensors.table(CABINET_NTC), ANALOG_RESOLUTION * NTC_SAMPLE_COUNT) < DISCONNECTED_NTC_TEMPERATURE);
+}
+
+void test_datasheet_curve()
+{
+  run_booted(converts_along_the_datasheet_curve);
+}
+
+// the points a probe with these coefficients would give the wizard, the references rounded like the menu does
+void capture_calibration_points(const ntc_coefficients& probe, const uint16_t* adc_sums, uint8_t count, calibration_point* points)
+{
+  for(uint8_t i = 0; i < count; i++)
+  {
+    points[i].adc_sum = adc_sums[i];
+    points[i].reference = ntc_coefficients_to_temperature(probe, adc_sums[i]);
+  }
+}
+
+void assert_same_curve(const ntc_coefficients& expected, const ntc_coefficients& actual)
+{
+  // between the points & past them on both sides
+  const uint16_t adc_sums[] = {3000, 6000, 9500, 12500, 15000, 16000};
+
+  for(uint8_t i = 0; i < sizeof(adc_sums) / sizeof(adc_sums[0]); i++)
+  {
+    TEST_ASSERT_INT_WITHIN(10, ntc_coefficients_to_temperature(expected, adc_sums[i]).centi_degrees, ntc_coefficients_to_temperature(actual, adc_sums[i]).centi_degrees);
+  }
+}
+
+void test_solve_two_point_calibration()
+{
+  // two points are the b value equation, so a b value probe comes back as it is
+  ntc_coefficients probe = default_ntc_coefficients(12000, 3435);
+
+  const uint16_t adc_sums[] = {7000, 14000};
+  calibration_point points[2];
+  capture_calibration_points(probe, adc_sums, 2, points);
+
+  ntc_coefficients solved;
+  TEST_ASSERT_TRUE(solve_ntc_coefficients(points, 2, &solved));
+  TEST_ASSERT_TRUE(solved.c == 0);
+
+  assert_same_curve(probe, solved);
+}
+
+void test_solve_three_point_calibration()
+{
+  // a full steinhart-hart curve off a 10k datasheet, the b value equation alone is off by close to a degree on it
+  ntc_coefficients probe = {1.009249522e-3, 2.378405444e-4, 2.019202697e-7};
+
+  const uint16_t adc_sums[] = {5000, 11000, 15500};
+  calibration_point points[3];
+  capture_calibration_points(probe, adc_sums, 3, points);
+
+  ntc_coefficients solved;
+  TEST_ASSERT_TRUE(solve_ntc_coefficients(points, 3, &solved));
+
+  assert_same_curve(probe, solved);
+}
+
+void test_solve_rejects_bad_points()
+{
+  ntc_coefficients probe = default_ntc_coefficients(NOMINAL_RESISTANCE_NTC_1, B_VALUE_NTC_1);
+
+  const uint16_t adc_sums[] = {5000, 11000, 15500};
+  calibration_point points[3];
+  ntc_coefficients solved;
+
+  // only 2 or 3 points
+  capture_calibration_points(probe, adc_sums, 3, points);
+  TEST_ASSERT_FALSE(solve_ntc_coefficients(points, 1, &solved));
+  TEST_ASSERT_FALSE(solve_ntc_coefficients(points, 4, &solved));
+
+  // the same point twice
+  points[2] = points[0];
+  TEST_ASSERT_FALSE(solve_ntc_coefficients(points, 3, &solved));
+  TEST_ASSERT_TRUE(solve_ntc_coefficients(points, 2, &solved)); // the first two are still fine
+
+  // captured from a shorted or an open probe
+  capture_calibration_points(probe, adc_sums, 3, points);
+  points[0].adc_sum = 0;
+  TEST_ASSERT_FALSE(solve_ntc_coefficients(points, 2, &solved));
+  points[0].adc_sum = ANALOG_RESOLUTION * NTC_SAMPLE_COUNT;
+  TEST_ASSERT_FALSE(solve_ntc_coefficients(points, 2, &solved));
+
+  // the references the wrong way around, it would get warmer as the resistance goes up
+  capture_calibration_points(probe, adc_sums, 2, points);
+  temperature reference = points[0].reference;
+  points[0].reference = points[1].reference;
+  points[1].reference = reference;
+  TEST_ASSERT_FALSE(solve_ntc_coefficients(points, 2, &solved));
+}
+
+// --------------------------------------
+// Plausibility
+
+void stages_a_failing_probe()
+{
+  cabinet_temperature = -18;
+  run_for(10);
+
+  TEST_ASSERT_EQUAL_INT(sensor_stage::sensor_ok, get_sensor_stage(CABINET_NTC));
+  TEST_ASSERT_EQUAL_UINT8(MAX_SENSOR_CONFIDENCE, sensor_health_states[CABINET_NTC].confidence);
+
+  temperature plausible = current_state.ntc_temperatures[CABINET_NTC];
+
+  // shorted, every reading is out of range & costs a quarter of the confidence
+  cabinet_adc_override = 1;
+  run_for(1);
+
+  TEST_ASSERT_EQUAL_UINT8(75, sensor_health_states[CABINET_NTC].confidence);
+  TEST_ASSERT_EQUAL_INT(sensor_stage::sensor_warning, get_sensor_stage(CABINET_NTC));
+  TEST_ASSERT_EQUAL_INT16(plausible.centi_degrees, current_state.ntc_temperatures[CABINET_NTC].centi_degrees);
+  TEST_ASSERT_FALSE(is_in_fallback_mode());
+
+  run_for(1);
+  TEST_ASSERT_EQUAL_INT(sensor_stage::sensor_warning, get_sensor_stage(CABINET_NTC));
+
+  run_for(1);
+  TEST_ASSERT_EQUAL_INT(sensor_stage::sensor_degraded_stage, get_sensor_stage(CABINET_NTC));
+  TEST_ASSERT_TRUE(is_in_fallback_mode());
+
+  run_for(1);
+  TEST_ASSERT_EQUAL_INT(sensor_stage::sensor_failed, get_sensor_stage(CABINET_NTC));
+  TEST_ASSERT_EQUAL_INT16(plausible.centi_degrees, current_state.ntc_temperatures[CABINET_NTC].centi_degrees);
+
+  // fixed, but it has to earn its way back to the warning level before it counts again
+  cabinet_adc_override = 0;
+  run_for(79);
+
+  TEST_ASSERT_EQUAL_UINT8(79, sensor_health_states[CABINET_NTC].confidence);
+  TEST_ASSERT_EQUAL_INT(sensor_stage::sensor_failed, get_sensor_stage(CABINET_NTC));
+
+  run_for(1);
+  TEST_ASSERT_EQUAL_INT(sensor_stage::sensor_ok, get_sensor_stage(CABINET_NTC));
+  TEST_ASSERT_FALSE(is_in_fallback_mode());
+}
+
+void test_failing_probe_stages()
+{
+  run_booted(stages_a_failing_probe);
+}
+
+void flags_a_stuck_probe()
+{
+  // the shell never warms up
+  cabinet_temperature = 0;
+  compressor_held = true;
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 6 * MINUTE));
+  run_for(14 * MINUTE);
+
+  TEST_ASSERT_FALSE(sensor_health_states[COMPRESSOR_NTC].stuck);
+  TEST_ASSERT_EQUAL_INT(sensor_stage::sensor_ok, get_sensor_stage(COMPRESSOR_NTC));
+
+  // from 15 minutes into the run it loses a point a second
+  run_for(90);
+
+  TEST_ASSERT_TRUE(sensor_health_states[COMPRESSOR_NTC].stuck);
+  TEST_ASSERT_EQUAL_INT(sensor_stage::sensor_warning, get_sensor_stage(COMPRESSOR_NTC));
+  TEST_ASSERT_EQUAL_INT(sensor_stage::sensor_ok, get_sensor_stage(CABINET_NTC));
+
+  // until it moves away from where it got stuck
+  compressor_held = false;
+  run_for(2 * MINUTE);
+
+  TEST_ASSERT_FALSE(sensor_health_states[COMPRESSOR_NTC].stuck);
+}
+
+void test_stuck_probe()
+{
+  run_booted(flags_a_stuck_probe);
+}
+
+void seeds_the_estimate_from_a_plausible_reading()
+{
+  // shorted from the very first reading & no startup delay to hide it
+  active_config.freezer_startup_delay = 0;
+  cabinet_temperature = -20;
+  cabinet_adc_override = 1;
+
+  run_for(3);
+
+  TEST_ASSERT_FALSE(estimator.initialized);
+  TEST_ASSERT_TRUE(is_in_fallback_mode());
+  TEST_ASSERT_EQUAL_INT16(0, current_state.estimated_cabinet_temperature.centi_degrees);
+
+  cabinet_adc_override = 0;
+  run_for(1);
+
+  TEST_ASSERT_TRUE(estimator.initialized);
+  TEST_ASSERT_INT_WITHIN(30, -2000, current_state.estimated_cabinet_temperature.centi_degrees);
+}
+
+void test_estimate_seed()
+{
+  run_booted(seeds_the_estimate_from_a_plausible_reading);
+}
+
+// --------------------------------------
+// Estimator
+
+void tracks_the_cabinet_ahead_of_the_probe()
+{
+  cabinet_temperature = -10;
+  run_for(4 * MINUTE);
+
+  // settled on a cabinet that isn't moving
+  TEST_ASSERT_INT_WITHIN(10, -1000, current_state.estimated_cabinet_temperature.centi_degrees);
+  TEST_ASSERT_INT_WITHIN(1, 0, current_state.estimated_cabinet_rate);
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 2 * MINUTE));
+  run_for(10 * MINUTE);
+
+  // the probe only moves an adc step every few minutes at this rate, so it's the average over a few steps
+  int32_t rate_sum = 0;
+  int32_t lead_sum = 0;
+
+  for(uint32_t i = 0; i < 10 * MINUTE; i++)
+  {
+    run_for(1);
+
+    rate_sum += current_state.estimated_cabinet_rate;
+    lead_sum += current_state.estimated_cabinet_temperature.centi_degrees - current_state.ntc_temperatures[CABINET_NTC].centi_degrees;
+  }
+
+  // the model pulls down 12 centi-degrees a minute, the estimate is where the probe gets to a lag later
+  TEST_ASSERT_INT_WITHIN(2, -CABINET_PULL_DOWN * 100 * MINUTE, rate_sum / (int32_t)(10 * MINUTE));
+  TEST_ASSERT_INT_WITHIN(8, -CABINET_PULL_DOWN * 100 * CABINET_PROBE_LAG_SECONDS, lead_sum / (int32_t)(10 * MINUTE));
+}
+
+void test_estimator()
+{
+  run_booted(tracks_the_cabinet_ahead_of_the_probe);
+}
+
+// --------------------------------------
+// Band Hysteresis
+
+void keeps_to_the_band()
+{
+  // -18 with the default 1.5 cut in & 0.5 cut out
+  active_config.hysteresis_mode = hysteresis_mode::band_hysteresis;
+  run_for(10);
+
+  current_state.estimated_cabinet_temperature = centi_degrees(-1651);
+  TEST_ASSERT_FALSE(should_band_compressor_run());
+
+  current_state.estimated_cabinet_temperature = centi_degrees(-1650);
+  TEST_ASSERT_TRUE(should_band_compressor_run());
+
+  // running, it keeps going through the band until the cut out
+  set_compressor(HIGH);
+
+  current_state.estimated_cabinet_temperature = centi_degrees(-1849);
+  TEST_ASSERT_TRUE(should_band_compressor_run());
+
+  current_state.estimated_cabinet_temperature = centi_degrees(-1850);
+  TEST_ASSERT_FALSE(should_band_compressor_run());
+
+  // once the rate had time to settle, it stops on where the cabinet is going to coast to
+  hal_native_advance(MIN_RATE_LEARNING_PHASE);
+  current_state.estimated_cabinet_temperature = centi_degrees(-1800);
+
+  current_state.predicted_coast_minimum = centi_degrees(-1849);
+  TEST_ASSERT_TRUE(should_band_compressor_run());
+
+  current_state.predicted_coast_minimum = centi_degrees(-1850);
+  TEST_ASSERT_FALSE(should_band_compressor_run());
+
+  // stopped, it stays off through the band
+  set_compressor(LOW);
+
+  current_state.estimated_cabinet_temperature = centi_degrees(-1700);
+  TEST_ASSERT_FALSE(should_band_compressor_run());
+}
+
+void test_band_hysteresis()
+{
+  run_booted(keeps_to_the_band);
+}
+
+// --------------------------------------
+// Thermal Model
+
+void fit_coasts(const int16_t* rates, const int16_t* coasts, uint8_t count)
+{
+  for(uint8_t i = 0; i < count; i++)
+  {
+    coast_history[i].cut_off_rate = rates[i];
+    coast_history[i].coast = coasts[i];
+  }
+
+  coast_history_count = count;
+  fit_thermal_model();
+}
+
+void fits_the_coast_to_the_cut_off_rate()
+{
+  const int16_t rates[] = {-8, -16, -24, -32};
+
+  // coast = 2 * rate - 50, a faster pull down coasts further
+  const int16_t steep[] = {-66, -82, -98, -114};
+  fit_coasts(rates, steep, 4);
+
+  TEST_ASSERT_EQUAL_INT16(2 * 256, active_thermal_model.coast_slope);
+  TEST_ASSERT_EQUAL_INT16(-50, active_thermal_model.coast_offset);
+  TEST_ASSERT_EQUAL_UINT8(1, active_thermal_model.learned_cycles);
+  TEST_ASSERT_FALSE(is_thermal_model_ready());
+
+  // coast = 0.75 * rate, the fraction is in the low 8 bits
+  const int16_t shallow[] = {-6, -12, -18, -24};
+  fit_coasts(rates, shallow, 4);
+
+  TEST_ASSERT_EQUAL_INT16(192, active_thermal_model.coast_slope);
+  TEST_ASSERT_EQUAL_INT16(0, active_thermal_model.coast_offset);
+
+  // coast = -rate - 100
+  const int16_t falling[] = {-92, -84, -76, -68};
+  fit_coasts(rates, falling, 4);
+
+  TEST_ASSERT_EQUAL_INT16(-256, active_thermal_model.coast_slope);
+  TEST_ASSERT_EQUAL_INT16(-100, active_thermal_model.coast_offset);
+  TEST_ASSERT_TRUE(is_thermal_model_ready());
+
+  // every cycle stopped at the same rate, so there is only the average
+  const int16_t same_rates[] = {-20, -20, -20, -20};
+  const int16_t coasts[] = {-40, -60, -50, -50};
+  fit_coasts(same_rates, coasts, 4);
+
+  TEST_ASSERT_EQUAL_INT16(0, active_thermal_model.coast_slope);
+  TEST_ASSERT_EQUAL_INT16(-50, active_thermal_model.coast_offset);
+
+  // the 4th cycle saved it
+  thermal_model saved;
+  hal_storage_get(THERMAL_MODEL_EEPROM_ADDRESS, saved);
+  TEST_ASSERT_EQUAL_UINT8(4, saved.learned_cycles);
+
+  // too few of our own yet, the loaded fit stays
+  fit_coasts(rates, steep, 2);
+
+  TEST_ASSERT_EQUAL_INT16(0, active_thermal_model.coast_slope);
+  TEST_ASSERT_EQUAL_INT16(-50, active_thermal_model.coast_offset);
+}
+
+void test_thermal_model_fit()
+{
+  run_booted(fits_the_coast_to_the_cut_off_rate);
+}
+
+// --------------------------------------
+// Startup Jitter
+
+void staggers_the_start_by_the_jitter()
+{
+  active_config.startup_jitter = MAX_STARTUP_JITTER;
+
+  uint32_t boot_seed = 0;
+  hal_storage_get(STARTUP_JITTER_SEED_EEPROM_ADDRESS, boot_seed);
+
+  // the seed moves on with every boot
+  initialize_startup_jitter();
+
+  uint32_t seed = 0;
+  hal_storage_get(STARTUP_JITTER_SEED_EEPROM_ADDRESS, seed);
+
+  TEST_ASSERT_NOT_EQUAL(boot_seed, seed);
+  TEST_ASSERT_LESS_OR_EQUAL(MAX_STARTUP_JITTER * 60 * 1000UL, startup_jitter_ms);
+
+  // the start waits out the delay with the jitter on top
+  uint32_t start_at = active_config.freezer_startup_delay * 60 * 1000UL + startup_jitter_ms;
+
+  hal_native_set_time(start_at - 1);
+  TEST_ASSERT_FALSE(is_startup_delay_over());
+
+  hal_native_set_time(start_at);
+  TEST_ASSERT_TRUE(is_startup_delay_over());
+}
+
+void test_startup_jitter()
+{
+  run_booted(staggers_the_start_by_the_jitter);
+}
+
+// the same stored seed & config at the same moment after the reset, like every unit on a site after a power cut
+uint32_t boot_jitter_seed(uint32_t stored_seed)
+{
+  hal_storage_put(STARTUP_JITTER_SEED_EEPROM_ADDRESS, stored_seed);
+  hal_native_set_time(1000);
+
+  initialize_startup_jitter();
+
+  uint32_t seed = 0;
+  return hal_storage_get(STARTUP_JITTER_SEED_EEPROM_ADDRESS, seed);
+}
+
+void seeds_the_jitter_from_the_probes()
+{
+  active_config.startup_jitter = MAX_STARTUP_JITTER;
+  cabinet_temperature = -18;
+
+  uint32_t seed = boot_jitter_seed(UINT32_MAX);
+  uint32_t jitter = startup_jitter_ms;
+
+  TEST_ASSERT_EQUAL_UINT32(seed, boot_jitter_seed(UINT32_MAX));
+  TEST_ASSERT_EQUAL_UINT32(jitter, startup_jitter_ms);
+
+  // a cabinet a few degrees apart
+  cabinet_temperature = -15;
+
+  TEST_ASSERT_NOT_EQUAL(seed, boot_jitter_seed(UINT32_MAX));
+  TEST_ASSERT_NOT_EQUAL(jitter, startup_jitter_ms);
+}
+
+void test_startup_jitter_seed()
+{
+  run_booted(seeds_the_jitter_from_the_probes);
+}
+
+// --------------------------------------
+// Demand Response
+
+void defers_within_the_allowance()
+{
+  cabinet_temperature = -20;
+  run_for(10);
+
+  active_config.demand_response_allowance = degrees(5);
+  current_state.estimated_cabinet_temperature = degrees(-19);
+
+  // the pin is pulled up, low is a request
+  TEST_ASSERT_FALSE(can_defer_compressor_start());
+
+  hal_native_set_digital(DEMAND_RESPONSE_PIN, LOW);
+  TEST_ASSERT_TRUE(can_defer_compressor_start());
+
+  // up to the target plus the allowance
+  current_state.estimated_cabinet_temperature = centi_degrees(-1301);
+  TEST_ASSERT_TRUE(can_defer_compressor_start());
+
+  current_state.estimated_cabinet_temperature = centi_degrees(-1300);
+  TEST_ASSERT_FALSE(can_defer_compressor_start());
+
+  // but never past -12, whatever the target
+  active_config.target_temperature = MAX_TARGET_TEMPERATURE;
+
+  current_state.estimated_cabinet_temperature = centi_degrees(-1201);
+  TEST_ASSERT_TRUE(can_defer_compressor_start());
+
+  current_state.estimated_cabinet_temperature = centi_degrees(-1200);
+  TEST_ASSERT_FALSE(can_defer_compressor_start());
+
+  // a request that goes on for too long isn't deferred anymore, until it's lifted & asked for again
+  current_state.estimated_cabinet_temperature = degrees(-15);
+
+  hal_native_advance(MAX_DEMAND_RESPONSE_DEFERRAL - 1000);
+  TEST_ASSERT_TRUE(can_defer_compressor_start());
+
+  hal_native_advance(1000);
+  TEST_ASSERT_FALSE(can_defer_compressor_start());
+
+  hal_native_set_digital(DEMAND_RESPONSE_PIN, HIGH);
+  TEST_ASSERT_FALSE(can_defer_compressor_start());
+
+  hal_native_set_digital(DEMAND_RESPONSE_PIN, LOW);
+  TEST_ASSERT_TRUE(can_defer_compressor_start());
+
+  // 0 turns it off
+  active_config.demand_response_allowance = degrees(0);
+  TEST_ASSERT_FALSE(can_defer_compressor_start());
+}
+
+void test_demand_response_limits()
+{
+  run_booted(defers_within_the_allowance);
+}
+
+void holds_back_a_start_during_a_request()
+{
+  active_config.demand_response_allowance = degrees(2);
+  hal_native_set_digital(DEMAND_RESPONSE_PIN, LOW);
+
+  cabinet_temperature = -17;
+  run_for(6 * MINUTE);
+
+  TEST_ASSERT_EQUAL_INT(freezer_status::demand_deferred, current_state.status);
+  TEST_ASSERT_TRUE(is_relay_off());
+
+  // past the allowance it starts anyway
+  move_cabinet_to(-15.5);
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 2 * MINUTE));
+  TEST_ASSERT_EQUAL_INT(freezer_status::cooling, current_state.status);
+}
+
+void test_demand_response_deferral()
+{
+  run_booted(holds_back_a_start_during_a_request);
+}
+
+// --------------------------------------
+// Statistics
+
+void rotates_the_statistics_slots()
+{
+  // nothing saved yet, so the first save goes in slot 0
+  TEST_ASSERT_EQUAL_UINT8(STATISTICS_EEPROM_SLOTS - 1, statistics_slot);
+  TEST_ASSERT_EQUAL_UINT32(0, active_statistics.sequence);
+
+  // every save goes in the next slot, so each one gets a 16th of the writes
+  for(uint8_t i = 0; i < 20; i++)
+  {
+    save_statistics();
+
+    TEST_ASSERT_EQUAL_UINT8(i % STATISTICS_EEPROM_SLOTS, statistics_slot);
+    TEST_ASSERT_EQUAL_UINT32(i + 1, active_statistics.sequence);
+  }
+
+  // after a reset the newest one is picked up again
+  active_statistics = compressor_statistics();
+  load_statistics();
+
+  TEST_ASSERT_EQUAL_UINT8(3, statistics_slot);
+  TEST_ASSERT_EQUAL_UINT32(20, active_statistics.sequence);
+
+  // a slot that was being written when the power went fails the crc, the one before it is used
+  hal_native_storage()[STATISTICS_EEPROM_ADDRESS + 3 * sizeof(compressor_statistics) + offsetof(compressor_statistics, on_seconds)] ^= 0xFF;
+  load_statistics();
+
+  TEST_ASSERT_EQUAL_UINT8(2, statistics_slot);
+  TEST_ASSERT_EQUAL_UINT32(19, active_statistics.sequence);
+}
+
+void test_statistics_slots()
+{
+  run_booted(rotates_the_statistics_slots);
+}
+
+void counts_the_on_time_and_energy()
+{
+  active_config.compressor_power = 100;
+  cabinet_temperature = 0;
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 6 * MINUTE));
+
+  uint32_t on_seconds = active_statistics.on_seconds;
+  uint32_t watt_hours = active_statistics.watt_hours;
+  uint32_t cycles = active_statistics.cycles;
+
+  run_for(36 * MINUTE);
+
+  TEST_ASSERT_INT_WITHIN(2, on_seconds + 36 * MINUTE, active_statistics.on_seconds);
+  TEST_ASSERT_INT_WITHIN(1, watt_hours + 60, active_statistics.watt_hours);
+  TEST_ASSERT_EQUAL_UINT32(cycles, active_statistics.cycles);
+  TEST_ASSERT_INT_WITHIN(2, seconds_since_boot(), active_statistics.powered_seconds);
+
+  // the window is still shorter than an hour, so it's the duty since the boot
+  TEST_ASSERT_INT_WITHIN(2, active_statistics.on_seconds * 100 / seconds_since_boot(), hour_duty.get_duty_percent());
+}
+
+void test_statistics_counters()
+{
+  run_booted(counts_the_on_time_and_energy);
+}
+
+// --------------------------------------
+// Load Events
+
+void starts_early_on_a_load_event()
+{
+  active_config.load_event_start = 1;
+
+  cabinet_temperature = -25;
+  run_for(6 * MINUTE);
+
+  TEST_ASSERT_EQUAL_INT(freezer_status::reached_target, current_state.status);
+  TEST_ASSERT_EQUAL_UINT16(0, current_state.load_events);
+
+  // the door is left open, the cabinet warms a degree a minute
+  for(uint32_t i = 0; i < 4 * MINUTE && !current_state.load_event_active; i++)
+  {
+    cabinet_temperature += 1.0 / MINUTE;
+    run_for(1);
+  }
+
+  TEST_ASSERT_TRUE(current_state.load_event_active);
+  TEST_ASSERT_EQUAL_UINT16(1, current_state.load_events);
+
+  // still well below the target, it's the event that starts it
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 2));
+  TEST_ASSERT_TRUE(current_state.estimated_cabinet_temperature < active_config.target_temperature - degrees(2));
+
+  // & the running compressor is the end of it
+  run_for(1);
+  TEST_ASSERT_FALSE(current_state.load_event_active);
+}
+
+void test_load_event_start()
+{
+  run_booted(starts_early_on_a_load_event);
+}
+
+// --------------------------------------
+// Boost
+
+bool is_boost_over()
+{
+  return !boost_active;
+}
+
+void ends_a_boost_after_its_duration()
+{
+  active_config.boost_duration = MIN_BOOST_DURATION;
+
+  cabinet_temperature = -20;
+  run_for(10);
+
+  set_boost(true);
+  uint32_t started_at = seconds_since_boot();
+
+  TEST_ASSERT_EQUAL_INT16(active_config.boost_target_temperature.centi_degrees, get_target_temperature().centi_degrees);
+
+  TEST_ASSERT_TRUE(run_until(is_boost_over, 31 * MINUTE));
+
+  TEST_ASSERT_INT_WITHIN(2, started_at + 30 * MINUTE, seconds_since_boot());
+  TEST_ASSERT_EQUAL_INT16(active_config.target_temperature.centi_degrees, get_target_temperature().centi_degrees);
+}
+
+void test_boost_expires()
+{
+  run_booted(ends_a_boost_after_its_duration);
+}
+
+void extends_the_max_runtime_for_a_boost()
+{
+  active_config.compressor_max_run_time = MIN_COMPRESSOR_MAX_RUNTIME;
+
+  set_boost(true);
+  set_compressor(HIGH);
+
+  // an hour on top of the max runtime
+  hal_native_advance(119 * MINUTE * 1000);
+  TEST_ASSERT_FALSE(has_compressor_exceeded_max_runtime());
+
+  hal_native_advance(1 * MINUTE * 1000);
+  TEST_ASSERT_TRUE(has_compressor_exceeded_max_runtime());
+
+  // but never past the longest the menu allows
+  active_config.compressor_max_run_time = MAX_COMPRESSOR_MAX_RUNTIME;
+  set_compressor(LOW);
+  set_compressor(HIGH);
+
+  hal_native_advance(599 * MINUTE * 1000);
+  TEST_ASSERT_FALSE(has_compressor_exceeded_max_runtime());
+
+  hal_native_advance(1 * MINUTE * 1000);
+  TEST_ASSERT_TRUE(has_compressor_exceeded_max_runtime());
+
+  // & nothing without a boost
+  active_config.compressor_max_run_time = MIN_COMPRESSOR_MAX_RUNTIME;
+  set_boost(false);
+  set_compressor(LOW);
+  set_compressor(HIGH);
+
+  hal_native_advance(60 * MINUTE * 1000);
+  TEST_ASSERT_TRUE(has_compressor_exceeded_max_runtime());
+}
+
+void test_boost_max_runtime()
+{
+  run_booted(extends_the_max_runtime_for_a_boost);
+}
+
+// --------------------------------------
+// Defrost
+
+bool is_defrosting()
+{
+  return current_state.defrost_active;
+}
+
+bool is_not_defrosting()
+{
+  return !current_state.defrost_active;
+}
+
+bool is_high_alarm_raised()
+{
+  return current_state.alarms_active & (1 << alarm_type::alarm_high_temperature);
+}
+
+void defrosts_on_the_interval()
+{
+  active_config.defrost_mode = defrost_mode::defrost_timed;
+  active_config.defrost_interval = MIN_DEFROST_INTERVAL;
+  active_config.defrost_timeout = MIN_DEFROST_TIMEOUT;
+
+  // at the target, so the compressor is off when it comes due
+  cabinet_temperature = -20;
+
+  TEST_ASSERT_TRUE(run_until(is_defrosting, 4 * 60 * MINUTE + MINUTE));
+  uint32_t started_at = seconds_since_boot();
+
+  TEST_ASSERT_INT_WITHIN(2, 4 * 60 * MINUTE, started_at);
+  TEST_ASSERT_EQUAL_INT(freezer_status::defrost, current_state.status);
+
+  // without an evaporator probe a warm cabinet doesn't end it, & it doesn't get to start the compressor either
+  move_cabinet_to(-12);
+
+  TEST_ASSERT_TRUE(is_defrosting());
+  TEST_ASSERT_EQUAL_INT(freezer_status::defrost, current_state.status);
+  TEST_ASSERT_TRUE(is_relay_off());
+
+  TEST_ASSERT_TRUE(run_until(is_not_defrosting, 5 * MINUTE));
+
+  TEST_ASSERT_INT_WITHIN(2, started_at + 5 * MINUTE, seconds_since_boot());
+  TEST_ASSERT_FALSE(is_defrost_due());
+
+  TEST_ASSERT_TRUE(run_until(is_relay_on, 1 * MINUTE));
+}
+
+void test_timed_defrost()
+{
+  run_booted(defrosts_on_the_interval);
+}
+
+// a compressor run that has just ended, with the cabinet dropping this far over it
+void end_measured_run(int16_t drop, uint32_t minutes)
+{
+  pull_down_measuring = true;
+  pull_down_started_at = hal_millis() - minutes * MINUTE * 1000;
+  pull_down_start_temperature = current_state.estimated_cabinet_temperature + centi_degrees(drop);
+
+  measure_pull_down_rate();
+}
+
+void defrosts_early_when_the_pull_down_slows()
+{
+  active_config.defrost_mode = defrost_mode::defrost_adaptive;
+  active_config.defrost_interval = 12;
+
+  cabinet_temperature = -20;
+  run_for(10);
+
+  // a good run sets the best rate, anything 30% slower than it is a degraded one
+  end_measured_run(100, 10);
+  TEST_ASSERT_EQUAL_INT16(10, best_pull_down_rate);
+
+  end_measured_run(60, 10);
+  end_measured_run(60, 10);
+  TEST_ASSERT_EQUAL_UINT8(2, degraded_pull_down_runs);
+
+  // a short run doesn't count either way
+  end_measured_run(10, 2);
+  TEST_ASSERT_EQUAL_UINT8(2, degraded_pull_down_runs);
+
+  end_measured_run(60, 10);
+  TEST_ASSERT_EQUAL_UINT8(DEFROST_DEGRADED_RUNS, degraded_pull_down_runs);
+
+  // but not within 4 hours of the last one, a few slow runs after loading stock shouldn't defrost over and over
+  hal_native_set_time(MIN_ADAPTIVE_DEFROST_INTERVAL - 1000);
+  TEST_ASSERT_FALSE(is_defrost_due());
+
+  hal_native_set_time(MIN_ADAPTIVE_DEFROST_INTERVAL);
+  TEST_ASSERT_TRUE(is_defrost_due());
+
+  // the timed mode only goes by the interval
+  active_config.defrost_mode = defrost_mode::defrost_timed;
+  TEST_ASSERT_FALSE(is_defrost_due());
+
+  hal_native_set_time(12UL * 60 * 60 * 1000);
+  TEST_ASSERT_TRUE(is_defrost_due());
+
+  // the defrost starts the best rate over
+  set_defrost(true);
+  set_defrost(false);
+
+  TEST_ASSERT_EQUAL_INT16(0, best_pull_down_rate);
+  TEST_ASSERT_EQUAL_UINT8(0, degraded_pull_down_runs);
+}
+
+void test_adaptive_defrost()
+{
+  run_booted(defrosts_early_when_the_pull_down_slows);
+}
+
+void keeps_the_high_alarm_during_a_defrost()
+{
+  active_config.defrost_mode = defrost_mode::defrost_timed;
+  active_config.defrost_timeout = MAX_DEFROST_TIMEOUT;
+  active_config.high_alarm_delay = MIN_ALARM_DELAY;
+
+  // below the high alarm, so it's armed
+  cabinet_temperature = -20;
+  run_for(6 * MINUTE);
+
+  TEST_ASSERT_TRUE(high_alarm_armed);
+
+  set_defrost(true);
+
+  // warmer than the high alarm, but within what a defrost is allowed
+  move_cabinet_to(-9);
+  run_for(2 * MINUTE);
+
+  TEST_ASSERT_TRUE(is_defrosting());
+  TEST_ASSERT_FALSE(is_high_alarm_raised());
+
+  // a defrost heater stuck on is still caught
+  move_cabinet_to(-3);
+
+  TEST_ASSERT_TRUE(run_until(is_high_alarm_raised, 1 * MINUTE));
+  TEST_ASSERT_TRUE(is_defrosting());
+}
+
+void test_defrost_high_alarm()
+{
+  run_booted(keeps_the_high_alarm_during_a_defrost);
+}
+
+// --------------------------------------
+// Profiles
+
+void repairs_a_corrupted_profile()
+{
+  freezer_config config;
+
+  // a change to the eco profile, then a bit flips in it
+  freezer_config eco = get_default_profile_config(config_profile::profile_eco);
+  eco.target_temperature = degrees(-16);
+  save_profile(config_profile::profile_eco, eco);
+
+  TEST_ASSERT_TRUE(load_profile(config_profile::profile_eco, config));
+  TEST_ASSERT_EQUAL_INT16(-1600, config.target_temperature.centi_degrees);
+
+  hal_native_storage()[get_profile_address(config_profile::profile_eco) + offsetof(freezer_config, target_temperature)] ^= 0x01;
+  TEST_ASSERT_FALSE(load_profile(config_profile::profile_eco, config));
+
+  freezer_config deep_freeze = get_default_profile_config(config_profile::profile_deep_freeze);
+  deep_freeze.boost_target_temperature = degrees(-32);
+  save_profile(config_profile::profile_deep_freeze, deep_freeze);
+
+  // the next boot puts the default back & leaves the others alone
+  load_config();
+
+  TEST_ASSERT_TRUE(load_profile(config_profile::profile_eco, config));
+  TEST_ASSERT_EQUAL_INT16(-1500, config.target_temperature.centi_degrees);
+  TEST_ASSERT_EQUAL_INT16(hysteresis_mode::band_hysteresis, config.hysteresis_mode);
+
+  TEST_ASSERT_TRUE(load_profile(config_profile::profile_deep_freeze, config));
+  TEST_ASSERT_EQUAL_INT16(-3200, config.boost_target_temperature.centi_degrees);
+
+  TEST_ASSERT_EQUAL_UINT8(config_profile::profile_standard, current_state.active_profile);
+  TEST_ASSERT_EQUAL_INT16(-1800, active_config.target_temperature.centi_degrees);
+}
+
+void test_profile_repair()
+{
+  run_booted(repairs_a_corrupted_profile);
+}
+
+void falls_back_to_the_standard_profile()
+{
+  select_profile(config_profile::profile_deep_freeze);
+  load_config();
+
+  TEST_ASSERT_EQUAL_UINT8(config_profile::profile_deep_freeze, current_state.active_profile);
+  TEST_ASSERT_EQUAL_INT16(MIN_TARGET_TEMPERATURE.centi_degrees, active_config.target_temperature.centi_degrees);
+
+  // the selection is corrupted, so it can't be told which one was meant
+  hal_native_storage()[PROFILE_SELECTION_EEPROM_ADDRESS + offsetof(profile_selection, crc)] ^= 0xFF;
+  load_config();
+
+  TEST_ASSERT_EQUAL_UINT8(config_profile::profile_standard, current_state.active_profile);
+  TEST_ASSERT_EQUAL_INT16(-1800, active_config.target_temperature.centi_degrees);
+
+  // & it's written back valid
+  profile_selection selection;
+  hal_storage_get(PROFILE_SELECTION_EEPROM_ADDRESS, selection);
+
+  TEST_ASSERT_EQUAL_UINT8(config_profile::profile_standard, selection.active_profile);
+  TEST_ASSERT_EQUAL_UINT8(calculate_crc8((uint8_t*)&selection, offsetof(profile_selection, crc)), selection.crc);
+}
+
+void test_profile_selection_fallback()
+{
+  run_booted(falls_back_to_the_standard_profile);
+}
+
+// --------------------------------------
+// Alarms
+
+bool is_high_alarm_cleared()
+{
+  return !is_high_alarm_raised();
+}
+
+bool is_low_alarm_raised()
+{
+  return current_state.alarms_active & (1 << alarm_type::alarm_low_temperature);
+}
+
+uint8_t get_saved_latched_alarms()
+{
+  alarm_record saved;
+  hal_storage_get(ALARMS_EEPROM_ADDRESS, saved);
+
+  return saved.latched;
+}
+
+void latches_an_alarm_until_acknowledged()
+{
+  const uint8_t high_alarm_bit = 1 << alarm_type::alarm_high_temperature;
+
+  active_config.high_alarm_delay = MIN_ALARM_DELAY;
+
+  // the first pull down from warm doesn't alarm, it has to have been below the limit first
+  cabinet_temperature = -5;
+  run_for(1 * MINUTE);
+
+  TEST_ASSERT_FALSE(high_alarm_armed);
+  TEST_ASSERT_EQUAL_UINT8(0, current_state.alarms_active);
+
+  move_cabinet_to(-20);
+  run_for(1 * MINUTE);
+
+  TEST_ASSERT_TRUE(high_alarm_armed);
+
+  move_cabinet_to(-5);
+
+  TEST_ASSERT_TRUE(run_until(is_high_alarm_raised, 1 * MINUTE));
+  TEST_ASSERT_EQUAL_INT(alarm_level::alarm_raised, current_alarm_level);
+  TEST_ASSERT_EQUAL_UINT8(high_alarm_bit, active_alarms.latched);
+  TEST_ASSERT_EQUAL_UINT8(high_alarm_bit, get_saved_latched_alarms());
+
+  // over, but nobody has seen it yet
+  move_cabinet_to(-20);
+
+  TEST_ASSERT_TRUE(run_until(is_high_alarm_cleared, 1 * MINUTE));
+  TEST_ASSERT_EQUAL_INT(alarm_level::alarm_unacknowledged, current_alarm_level);
+  TEST_ASSERT_EQUAL_UINT8(high_alarm_bit, current_state.alarms_latched);
+
+  // a reset doesn't lose it
+  active_alarms = alarm_record();
+  load_alarms();
+
+  TEST_ASSERT_EQUAL_UINT8(high_alarm_bit, current_state.alarms_latched);
+
+  acknowledge_alarms();
+  run_for(1);
+
+  TEST_ASSERT_EQUAL_INT(alarm_level::alarm_quiet, current_alarm_level);
+  TEST_ASSERT_EQUAL_UINT8(0, current_state.alarms_latched);
+  TEST_ASSERT_EQUAL_UINT8(0, get_saved_latched_alarms());
+}
+
+void test_alarm_latch()
+{
+  run_booted(latches_an_alarm_until_acknowledged);
+}
+
+void escalates_and_reminds()
+{
+  active_config.low_alarm_delay = MIN_ALARM_DELAY;
+
+  // below the target the compressor stays off, so the cabinet stays where it is
+  cabinet_temperature = -36;
+
+  TEST_ASSERT_TRUE(run_until(is_low_alarm_raised, 1 * MINUTE));
+
+  run_for(30 * MINUTE - 1);
+  TEST_ASSERT_EQUAL_INT(alarm_level::alarm_raised, current_alarm_level);
+
+  run_for(1);
+  TEST_ASSERT_EQUAL_INT(alarm_level::alarm_escalated, current_alarm_level);
+
+  // someone knows about it, but it's still there 2 hours later
+  acknowledge_alarms();
+  run_for(2 * 60 * MINUTE - 10);
+
+  TEST_ASSERT_EQUAL_INT(alarm_level::alarm_acknowledged, current_alarm_level);
+  TEST_ASSERT_EQUAL_UINT8(0, current_state.alarms_latched);
+
+  run_for(20);
+
+  TEST_ASSERT_EQUAL_INT(alarm_level::alarm_raised, current_alarm_level);
+  TEST_ASSERT_EQUAL_UINT8(1 << alarm_type::alarm_low_temperature, current_state.alarms_latched);
+}
+
+void test_alarm_escalation_and_reminder()
+{
+  run_booted(escalates_and_reminds);
+}
+
+// --------------------------------------
+// Health
+
+void set_health_baseline(int32_t pull_down_rate, int32_t compressor_temperature, int32_t run_time)
+{
+  active_health.learned_runs = HEALTH_BASELINE_RUNS;
+  active_health.baseline_pull_down_rate = pull_down_rate << 8;
+  active_health.baseline_compressor_temperature = compressor_temperature << 8;
+  active_health.baseline_run_time = run_time << 8;
+}
+
+void set_recent_health(int32_t pull_down_rate, int32_t compressor_temperature, int32_t run_time)
+{
+  recent_pull_down_rate = pull_down_rate << 8;
+  recent_compressor_temperature = compressor_temperature << 8;
+  recent_run_time = run_time << 8;
+}
+
+void test_health_score()
+{
+  uint8_t flags = 0;
+
+  set_health_baseline(100, 4000, 1200);
+
+  set_recent_health(100, 4000, 1200);
+  TEST_ASSERT_EQUAL_UINT8(100, get_health_score(&flags));
+  TEST_ASSERT_EQUAL_UINT8(0, flags);
+
+  // a pull down 30% slower costs 30
+  set_recent_health(70, 4000, 1200);
+  TEST_ASSERT_EQUAL_UINT8(70, get_health_score(&flags));
+  TEST_ASSERT_EQUAL_UINT8(health_pull_down_drift, flags);
+
+  // 5 degrees hotter, 4 a degree
+  set_recent_health(70, 4500, 1200);
+  TEST_ASSERT_EQUAL_UINT8(50, get_health_score(&flags));
+  TEST_ASSERT_EQUAL_UINT8(health_pull_down_drift | health_compressor_temperature_drift, flags);
+
+  // runs half as long again, half a point a percent
+  set_recent_health(70, 4500, 1800);
+  TEST_ASSERT_EQUAL_UINT8(25, get_health_score(&flags));
+  TEST_ASSERT_EQUAL_UINT8(health_pull_down_drift | health_compressor_temperature_drift | health_run_time_drift, flags);
+
+  // just below every flag
+  set_recent_health(76, 4499, 1799);
+  get_health_score(&flags);
+  TEST_ASSERT_EQUAL_UINT8(0, flags);
+
+  // doing better than the baseline isn't a bonus
+  set_recent_health(120, 3900, 1000);
+  TEST_ASSERT_EQUAL_UINT8(100, get_health_score(&flags));
+
+  // & there's no score until the baseline is learned
+  active_health.learned_runs = HEALTH_BASELINE_RUNS - 1;
+  TEST_ASSERT_EQUAL_UINT8(HEALTH_SCORE_UNKNOWN, get_health_score(&flags));
+  TEST_ASSERT_EQUAL_UINT8(0, flags);
+}
+
+void learns_the_health_baseline()
+{
+  const uint32_t run_time = 20UL * MINUTE * 1000;
+
+  run_for(10);
+
+  // a run that started close to the target
+  pull_down_start_temperature = degrees(-17);
+  run_peak_compressor_temperature = degrees(40);
+
+  update_compressor_health(100L << 8, run_time);
+
+  TEST_ASSERT_EQUAL_UINT8(1, active_health.learned_runs);
+  TEST_ASSERT_EQUAL_INT32(100L << 8, active_health.baseline_pull_down_rate);
+  TEST_ASSERT_EQUAL_INT32(4000L << 8, active_health.baseline_compressor_temperature);
+  TEST_ASSERT_EQUAL_INT32(1200L << 8, active_health.baseline_run_time);
+  TEST_ASSERT_EQUAL_INT32(100L << 8, recent_pull_down_rate);
+
+  // the baseline is a plain average while it's learning, the recent one moves an eighth of the way
+  update_compressor_health(120L << 8, run_time);
+
+  TEST_ASSERT_EQUAL_UINT8(2, active_health.learned_runs);
+  TEST_ASSERT_EQUAL_INT32(110L << 8, active_health.baseline_pull_down_rate);
+  TEST_ASSERT_EQUAL_INT32((100L << 8) + (20L << 8) / 8, recent_pull_down_rate);
+
+  // a boost, a warm start or a compressor probe that isn't ok isn't a normal run
+  boost_active = true;
+  update_compressor_health(50L << 8, run_time);
+  boost_active = false;
+
+  pull_down_start_temperature = degrees(-14);
+  update_compressor_health(50L << 8, run_time);
+  pull_down_start_temperature = degrees(-17);
+
+  sensor_health_states[COMPRESSOR_NTC].stage = sensor_stage::sensor_warning;
+  update_compressor_health(50L << 8, run_time);
+  sensor_health_states[COMPRESSOR_NTC].stage = sensor_stage::sensor_ok;
+
+  TEST_ASSERT_EQUAL_UINT8(2, active_health.learned_runs);
+  TEST_ASSERT_EQUAL_INT32(110L << 8, active_health.baseline_pull_down_rate);
+
+  // saved every 4th run
+  update_compressor_health(110L << 8, run_time);
+  update_compressor_health(110L << 8, run_time);
+
+  compressor_health saved;
+  hal_storage_get(HEALTH_EEPROM_ADDRESS, saved);
+
+  TEST_ASSERT_EQUAL_UINT8(4, saved.learned_runs);
+  TEST_ASSERT_EQUAL_INT32(active_health.baseline_pull_down_rate, saved.baseline_pull_down_rate);
+}
+
+void test_health_baseline()
+{
+  run_booted(learns_the_health_baseline);
+}
+
+// --------------------------------------
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_startup_delay_comes_first);
+  RUN_TEST(test_failed_compressor_probe_stops);
+  RUN_TEST(test_overheat_with_demand_holds);
+  RUN_TEST(test_overheat_without_demand_stops_as_overheat);
+  RUN_TEST(test_overheat_recovery_holds_off_demand);
+  RUN_TEST(test_max_runtime_holds_for_the_dead_time);
+  RUN_TEST(test_dead_time_only_holds_a_stopped_compressor);
+  RUN_TEST(test_min_runtime_keeps_a_short_run_going);
+  RUN_TEST(test_fallback_follows_its_own_demand);
+  RUN_TEST(test_demand_decides_the_rest);
+
+  RUN_TEST(test_set_compressor);
+
+  RUN_TEST(test_dead_time_from_boot);
+  RUN_TEST(test_min_runtime);
+  RUN_TEST(test_max_runtime);
+  RUN_TEST(test_overheat_stop_and_recovery);
+  RUN_TEST(test_overheat_without_demand_recovers);
+  RUN_TEST(test_fallback_cycling);
+
+  RUN_TEST(test_format_temperature);
+  RUN_TEST(test_temperature_from_celsius);
+
+  RUN_TEST(test_datasheet_curve);
+  RUN_TEST(test_solve_two_point_calibration);
+  RUN_TEST(test_solve_three_point_calibration);
+  RUN_TEST(test_solve_rejects_bad_points);
+
+  RUN_TEST(test_failing_probe_stages);
+  RUN_TEST(test_stuck_probe);
+  RUN_TEST(test_estimate_seed);
+
+  RUN_TEST(test_estimator);
+  RUN_TEST(test_band_hysteresis);
+  RUN_TEST(test_thermal_model_fit);
+
+  RUN_TEST(test_startup_jitter);
+  RUN_TEST(test_startup_jitter_seed);
+
+  RUN_TEST(test_demand_response_limits);
+  RUN_TEST(test_demand_response_deferral);
+
+  RUN_TEST(test_statistics_slots);
+  RUN_TEST(test_statistics_counters);
+
+  RUN_TEST(test_load_event_start);
+
+  RUN_TEST(test_boost_expires);
+  RUN_TEST(test_boost_max_runtime);
+
+  RUN_TEST(test_timed_defrost);
+  RUN_TEST(test_adaptive_defrost);
+  RUN_TEST(test_defrost_high_alarm);
+
+  RUN_TEST(test_profile_repair);
+  RUN_TEST(test_profile_selection_fallback);
+
+  RUN_TEST(test_alarm_latch);
+  RUN_TEST(test_alarm_escalation_and_reminder);
+
+  RUN_TEST(test_health_score);
+  RUN_TEST(test_health_baseline);
+
+  return UNITY_END();
+}